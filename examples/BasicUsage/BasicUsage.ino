@@ -19,7 +19,7 @@ void setup () {
     ThreadSafePing_t ping;
 
     Serial.printf ("Pinging %i times ...\n", PING_DEFAULT_COUNT);
-    ping.ping ("arduino.com"); // optional arguments: int count = PING_DEFAULT_COUNT, int interval = PING_DEFAULT_INTERVAL, int size = PING_DEFAULT_SIZE, int timeout = PING_DEFAULT_TIMEOUT
+    ping.ping ("arduino.com"); // optional arguments: int count = PING_DEFAULT_COUNT, int interval = PING_DEFAULT_INTERVAL, int size = PING_DEFAULT_SIZE, int timeout = PING_DEFAULT_TIMEOUT, int window = PING_DEFAULT_WINDOW
     if (ping.errText () != NULL) {
         Serial.printf ("Error %s\n", ping.errText ());
     } else {
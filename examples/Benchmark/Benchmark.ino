@@ -0,0 +1,199 @@
+#include <WiFi.h>
+#include <esp_freertos_hooks.h>
+#include <ThreadSafePing.h>
+#include <ThreadSafePingDispatcher.h>
+
+
+// the benchmark pings the same target from 1, 2, 4, ... BENCHMARK_MAX_TASKS concurrent tasks and reports
+// how the library behaves under load: achieved probes/s, CPU utilization per core, lwIP mutex contention,
+// heap low-water mark and round-trip time inflation compared to a single task
+#define BENCHMARK_MAX_TASKS         8
+#define BENCHMARK_COUNT             200     // echo requests per task
+#define BENCHMARK_INTERVAL_MICROS   10000   // 10 ms between echo requests of each task
+#define BENCHMARK_TIMEOUT_MICROS    500000
+#define BENCHMARK_WINDOW            1       // try PING_MAX_WINDOW to measure pipelining
+#define BENCHMARK_SIZE              PING_DEFAULT_SIZE
+#define BENCHMARK_USE_DISPATCHER    0       // try 1 to measure the central dispatcher
+#define BENCHMARK_STACK_SIZE        4096
+
+
+// CPU utilization is measured by counting how many times idle tasks run in a second, compared to an unloaded system
+static volatile uint32_t idleCount [portNUM_PROCESSORS];
+
+static bool idleHook0 () { idleCount [0]++; return false; }
+#if portNUM_PROCESSORS > 1
+    static bool idleHook1 () { idleCount [1]++; return false; }
+#endif
+
+static void readIdleCounts (uint32_t *counts) {
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+        counts [core] = idleCount [core];
+}
+
+
+// lwIP mutex contention is sampled by a low-priority task that measures how long it waits for the mutex
+struct mutexSampler_t {
+    volatile bool running;
+    volatile bool finished;
+    uint32_t samples;
+    uint64_t totalWaitMicros;
+    unsigned long maxWaitMicros;
+};
+
+static mutexSampler_t mutexSampler;
+
+static void mutexSamplerTask (void *param) {
+    while (mutexSampler.running) {
+        unsigned long startMicros = micros ();
+        xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+            unsigned long waitMicros = micros () - startMicros;
+        xSemaphoreGive (getLwIpMutex ());
+
+        mutexSampler.samples++;
+        mutexSampler.totalWaitMicros += waitMicros;
+        if (waitMicros > mutexSampler.maxWaitMicros)
+            mutexSampler.maxWaitMicros = waitMicros;
+        delay (1);
+    }
+    mutexSampler.finished = true;
+    vTaskDelete (NULL);
+}
+
+
+// each benchmark task runs its own ping session
+struct benchmarkTask_t {
+    ThreadSafePing_t ping;
+    SemaphoreHandle_t done;
+};
+
+static const char *benchmarkTarget;
+static benchmarkTask_t benchmarkTasks [BENCHMARK_MAX_TASKS];
+
+static void benchmarkTask (void *param) {
+    benchmarkTask_t *task = (benchmarkTask_t *) param;
+
+    ThreadSafePingOptions_t options;
+    options.count = BENCHMARK_COUNT;
+    options.intervalMicros = BENCHMARK_INTERVAL_MICROS;
+    options.timeoutMicros = BENCHMARK_TIMEOUT_MICROS;
+    options.size = BENCHMARK_SIZE;
+    options.window = BENCHMARK_WINDOW;
+    task->ping.ping (benchmarkTarget, options);
+
+    xSemaphoreGive (task->done);
+    vTaskDelete (NULL);
+}
+
+
+static float singleTaskMeanTime = 0;
+
+static void runBenchmark (int taskCount, const uint32_t *idlePerSecond) {
+    mutexSampler.running = true;
+    mutexSampler.finished = false;
+    mutexSampler.samples = 0;
+    mutexSampler.totalWaitMicros = 0;
+    mutexSampler.maxWaitMicros = 0;
+    xTaskCreate (mutexSamplerTask, "mutex_sampler", 2048, NULL, 1, NULL);
+
+    uint32_t idleBefore [portNUM_PROCESSORS];
+    readIdleCounts (idleBefore);
+    unsigned long startMillis = millis ();
+
+    for (int i = 0; i < taskCount; i++) {
+        benchmarkTasks [i].done = xSemaphoreCreateBinary ();
+        xTaskCreate (benchmarkTask, "benchmark_task", BENCHMARK_STACK_SIZE, &benchmarkTasks [i], 1, NULL);
+    }
+    for (int i = 0; i < taskCount; i++) {
+        xSemaphoreTake (benchmarkTasks [i].done, portMAX_DELAY);
+        vSemaphoreDelete (benchmarkTasks [i].done);
+    }
+
+    unsigned long elapsedMillis = millis () - startMillis;
+    uint32_t idleAfter [portNUM_PROCESSORS];
+    readIdleCounts (idleAfter);
+
+    mutexSampler.running = false;
+    while (!mutexSampler.finished)
+        delay (1);
+
+    // sum up the results of all the tasks
+    uint32_t sent = 0, received = 0, lost = 0;
+    double sumTime = 0;
+    for (int i = 0; i < taskCount; i++) {
+        ThreadSafePing_t& ping = benchmarkTasks [i].ping;
+        if (ping.errText () != NULL)
+            Serial.printf ("   task %i error: %s\n", i, ping.errText ());
+        sent += ping.sent ();
+        received += ping.received ();
+        lost += ping.lost ();
+        sumTime += (double) ping.mean_time () * ping.received ();
+    }
+    float meanTime = received ? sumTime / received : 0;
+    if (taskCount == 1)
+        singleTaskMeanTime = meanTime;
+
+    Serial.printf ("%2i tasks: %6.1f probes/s, sent = %lu, received = %lu, lost = %lu, mean = %.3fms", taskCount, sent * 1000.0 / elapsedMillis, (unsigned long) sent, (unsigned long) received, (unsigned long) lost, meanTime);
+    if (singleTaskMeanTime > 0)
+        Serial.printf (" (x%.2f)", meanTime / singleTaskMeanTime);
+    Serial.printf ("\n          CPU:");
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        float idle = (float) (idleAfter [core] - idleBefore [core]) / idlePerSecond [core] / (elapsedMillis / 1000.0f);
+        Serial.printf (" core %i = %.1f%%", core, idle < 1 ? 100 * (1 - idle) : 0);
+    }
+    Serial.printf (", lwIP mutex wait: mean = %.1fus, max = %luus, min free heap = %lu bytes\n",
+                   mutexSampler.samples ? (float) mutexSampler.totalWaitMicros / mutexSampler.samples : 0, mutexSampler.maxWaitMicros, (unsigned long) ESP.getMinFreeHeap ());
+}
+
+
+void setup () {
+    Serial.begin (115200);
+    while (!Serial)
+        delay (10);
+
+    WiFi.begin ("YourSSID", "YourPassword"); // use your WiFi credentials
+
+    Serial.print ("Connecting ... ");
+    while (WiFi.status () != WL_CONNECTED) delay (100);
+    Serial.print ("connected\nGetting IP address ... ");
+    while (WiFi.localIP () == IPAddress (0, 0, 0, 0)) delay (100);
+    Serial.println (WiFi.localIP ());
+
+
+    static char gateway [INET6_ADDRSTRLEN];
+    strcpy (gateway, WiFi.gatewayIP ().toString ().c_str ());
+    benchmarkTarget = gateway; // the gateway is close enough that the library's own overhead is visible
+
+    #if BENCHMARK_USE_DISPATCHER
+        const char *errText = ThreadSafePingDispatcher_t::begin ();
+        if (errText != NULL)
+            Serial.printf ("Dispatcher error %s\n", errText);
+    #endif
+
+
+    // calibrate: count idle task runs in a second while nothing is going on
+    esp_register_freertos_idle_hook_for_cpu (idleHook0, 0);
+    #if portNUM_PROCESSORS > 1
+        esp_register_freertos_idle_hook_for_cpu (idleHook1, 1);
+    #endif
+    uint32_t idleBefore [portNUM_PROCESSORS];
+    uint32_t idlePerSecond [portNUM_PROCESSORS];
+    readIdleCounts (idleBefore);
+    delay (1000);
+    readIdleCounts (idlePerSecond);
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+        idlePerSecond [core] = max (idlePerSecond [core] - idleBefore [core], (uint32_t) 1);
+
+
+    Serial.printf ("Benchmarking %s: %i echo requests per task, interval = %.1fms, window = %i, size = %i\n", benchmarkTarget, BENCHMARK_COUNT, BENCHMARK_INTERVAL_MICROS / 1000.0, BENCHMARK_WINDOW, BENCHMARK_SIZE);
+    for (int taskCount = 1; taskCount <= BENCHMARK_MAX_TASKS; taskCount *= 2)
+        runBenchmark (taskCount, idlePerSecond);
+
+    esp_deregister_freertos_idle_hook_for_cpu (idleHook0, 0);
+    #if portNUM_PROCESSORS > 1
+        esp_deregister_freertos_idle_hook_for_cpu (idleHook1, 1);
+    #endif
+}
+
+void loop () {
+
+}
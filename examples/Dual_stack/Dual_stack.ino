@@ -0,0 +1,52 @@
+#include <WiFi.h>
+#include <ThreadSafePingDualStack.h>
+
+
+void printStatistics (const char *family, ThreadSafePingStatistics_t *statistics, const char *errText) {
+    if (!statistics) {
+        Serial.printf ("    %s: %s\n", family, errText);
+        return;
+    }
+    Serial.printf ("    %s %s: Sent = %i, Received = %i, Lost = %i", family, statistics->target (), statistics->sent (), statistics->received (), statistics->lost ());
+    if (statistics->received ())
+        Serial.printf (", Min = %.3fms, Max = %.3fms, Avg = %.3fms\n", statistics->min_time (), statistics->max_time (), statistics->mean_time ());
+    else
+        Serial.printf ("\n");
+}
+
+
+void setup () {
+    Serial.begin (115200);
+    while (!Serial)
+        delay (10);
+
+    WiFi.begin ("YourSSID", "YourPassword"); // use your WiFi credentials
+
+    Serial.print ("Connecting ... ");
+    while (WiFi.status () != WL_CONNECTED) delay (100);
+    Serial.print ("connected\nGetting IP address ... ");
+    while (WiFi.localIP () == IPAddress (0, 0, 0, 0)) delay (100);
+    Serial.println (WiFi.localIP ());
+
+
+    // ping the IPv4 and the IPv6 address of the host at the same time
+    ThreadSafePingDualStack_t ping;
+    ThreadSafePingOptions_t options;
+    options.count = 5;
+
+    Serial.printf ("Pinging both addresses of google.com ...\n");
+    ping.ping ("google.com", options);
+    if (ping.errText () != NULL) {
+        Serial.printf ("Error %s\n", ping.errText ());
+    } else {
+        printStatistics ("IPv4", ping.IPv4 (), ping.errTextIPv4 ());
+        printStatistics ("IPv6", ping.IPv6 (), ping.errTextIPv6 ());
+
+        int family = ping.fastestFamily ();
+        Serial.printf ("Connect with %s\n", family == AF_INET ? "IPv4" : family == AF_INET6 ? "IPv6" : "neither, the host doesn't answer");
+    }
+}
+
+void loop () {
+
+}
@@ -0,0 +1,59 @@
+#include <WiFi.h>
+#include <ThreadSafePingHealthCheck.h>
+
+
+// report the targets that go up or down
+class MyHealthCheck_t : public ThreadSafePingHealthCheck_t {
+    public:
+        void onStateChange (int target, int state) {
+            IPAddress a = address (target);
+            Serial.printf ("%u.%u.%u.%u is %s (last time = %.2fms, loss = %.1f%%), %i of %i targets up\n", a [0], a [1], a [2], a [3], state == UP ? "up" : "down", last_time (target), loss (target) * 100, upCount (), targets ());
+        }
+};
+
+
+void healthCheckTask (void *param) {
+    MyHealthCheck_t healthCheck;
+
+    // the gateway each second, the rest of the local /24 network each 30 seconds
+    healthCheck.addTarget (WiFi.gatewayIP (), 1000000);
+    IPAddress localIP = WiFi.localIP ();
+    for (int i = 1; i < 255; i++) {
+        IPAddress a (localIP [0], localIP [1], localIP [2], i);
+        if (a != localIP && a != WiFi.gatewayIP ())
+            healthCheck.addTarget (a, 30000000);
+    }
+
+    ThreadSafePingHealthCheckOptions_t options;
+    options.rate = 20;          // echo requests per second, to all the targets together
+    options.window = 8;         // echo requests in flight at the same time
+    options.onWaitMicros = 0;   // onWait () is not needed, let the task sleep between echo requests
+
+    const char *errText = healthCheck.run (options); // runs until stop () is called
+    if (errText)
+        Serial.printf ("Error %s\n", errText);
+    vTaskDelete (NULL);
+}
+
+
+void setup () {
+    Serial.begin (115200);
+    while (!Serial)
+        delay (10);
+
+    WiFi.begin ("YourSSID", "YourPassword"); // use your WiFi credentials
+
+    Serial.print ("Connecting ... ");
+    while (WiFi.status () != WL_CONNECTED) delay (100);
+    Serial.print ("connected\nGetting IP address ... ");
+    while (WiFi.localIP () == IPAddress (0, 0, 0, 0)) delay (100);
+    Serial.println (WiFi.localIP ());
+
+
+    // a single task keeps probing all the targets, next to lwIP's tcpip task
+    xTaskCreatePinnedToCore (healthCheckTask, "healthCheck", 6 * 1024, NULL, 3, NULL, PING_TCPIP_CORE);
+}
+
+void loop () {
+
+}
@@ -0,0 +1,47 @@
+#include <WiFi.h>
+#include <ThreadSafeMultiPing.h>
+
+
+void setup () {
+    Serial.begin (115200);
+    while (!Serial)
+        delay (10);
+
+    WiFi.begin ("YourSSID", "YourPassword"); // use your WiFi credentials
+
+    Serial.print ("Connecting ... ");
+    while (WiFi.status () != WL_CONNECTED) delay (100);
+    Serial.print ("connected\nGetting IP address ... ");
+    while (WiFi.localIP () == IPAddress (0, 0, 0, 0)) delay (100);
+    Serial.println (WiFi.localIP ());
+
+
+    // all the targets are pinged from this task through the same socket
+    ThreadSafeMultiPing_t ping;
+
+    ping.addTarget (WiFi.gatewayIP ());
+    ping.addTarget ("arduino.com");
+    ping.addTarget ("github.com");
+    ping.addTarget ("espressif.com");
+
+    Serial.printf ("Pinging %i targets %i times ...\n", ping.targets (), PING_DEFAULT_COUNT);
+    ping.ping (); // optional arguments: int count = PING_DEFAULT_COUNT, int interval = PING_DEFAULT_INTERVAL, int size = PING_DEFAULT_SIZE, int timeout = PING_DEFAULT_TIMEOUT
+    if (ping.errText () != NULL) {
+        Serial.printf ("Error %s\n", ping.errText ());
+    } else {
+        for (int i = 0; i < ping.targets (); i++) {
+            Serial.printf ("Ping statistics for %s:\n"
+                           "    Packets: Sent = %i, Received = %i, Lost = %i", ping [i].target (), ping [i].sent (), ping [i].received (), ping [i].lost ());
+            if (ping [i].received ()) {
+                Serial.printf (" (%.2f%% loss)\nRound trip:\n"
+                               "   Min = %.3fms, Max = %.3fms, Avg = %.3fms, Stdev = %.3fms\n", (float) ping [i].lost () / (float) ping [i].sent () * 100, ping [i].min_time (), ping [i].max_time (), ping [i].mean_time (), sqrt (ping [i].var_time () / ping [i].received ()));
+            } else {
+                Serial.printf ("\n");
+            }
+        }
+    }
+}
+
+void loop () {
+
+}
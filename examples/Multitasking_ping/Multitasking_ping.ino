@@ -16,12 +16,13 @@ void setup () {
     Serial.println (WiFi.localIP ());
     
 
-    // create a separate task to ping arduino.com
-    xTaskCreate ([] (void *param)  {
+    // create a separate task to ping arduino.com, pinned to the core of lwIP's tcpip task so that it doesn't float between
+    // the cores, with a priority above the tasks that would otherwise preempt it while it time-stamps the echo replies
+    xTaskCreatePinnedToCore ([] (void *param)  {
         ThreadSafePing_t ping;
 
         Serial.printf ("Pinging arduino.com %i times ...\n", PING_DEFAULT_COUNT);
-        ping.ping ("arduino.com"); // optional arguments: int count = PING_DEFAULT_COUNT, int interval = PING_DEFAULT_INTERVAL, int size = PING_DEFAULT_SIZE, int timeout = PING_DEFAULT_TIMEOUT
+        ping.ping ("arduino.com"); // optional arguments: int count = PING_DEFAULT_COUNT, int interval = PING_DEFAULT_INTERVAL, int size = PING_DEFAULT_SIZE, int timeout = PING_DEFAULT_TIMEOUT, int window = PING_DEFAULT_WINDOW
         if (ping.errText () != NULL) {
             Serial.printf ("Error %s\n", ping.errText ());
         } else {
@@ -37,7 +38,7 @@ void setup () {
 
         vTaskDelete (NULL);
     }, 
-    "ping_task", 4068, NULL, 1, NULL);
+    "ping_task", 4068, NULL, 3, NULL, PING_TCPIP_CORE);
 
 
     // wait 5s and ping github.com
@@ -46,7 +47,7 @@ void setup () {
     ThreadSafePing_t ping;
 
     Serial.printf ("Pinging github.com %i times ...\n", PING_DEFAULT_COUNT);
-    ping.ping ("github.com"); // optional arguments: int count = PING_DEFAULT_COUNT, int interval = PING_DEFAULT_INTERVAL, int size = PING_DEFAULT_SIZE, int timeout = PING_DEFAULT_TIMEOUT
+    ping.ping ("github.com"); // optional arguments: int count = PING_DEFAULT_COUNT, int interval = PING_DEFAULT_INTERVAL, int size = PING_DEFAULT_SIZE, int timeout = PING_DEFAULT_TIMEOUT, int window = PING_DEFAULT_WINDOW
     if (ping.errText () != NULL) {
         Serial.printf ("Error %s\n", ping.errText ());
     } else {
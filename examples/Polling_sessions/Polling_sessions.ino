@@ -0,0 +1,66 @@
+#include <WiFi.h>
+#include <ThreadSafePing.h>
+#include <ThreadSafePingDispatcher.h>
+
+
+// loop () drives all the sessions, no task is needed for any of them
+#define SESSION_COUNT   16
+
+class countingPing_t : public ThreadSafePing_t {
+    public:
+        int reported = 0;
+
+        void onReceive (int bytes) override {
+            reported++;
+        }
+};
+
+static countingPing_t sessions [SESSION_COUNT];
+static bool reported = false;
+
+
+void setup () {
+    Serial.begin (115200);
+    while (!Serial)
+        delay (10);
+
+    WiFi.begin ("YourSSID", "YourPassword"); // use your WiFi credentials
+
+    Serial.print ("Connecting ... ");
+    while (WiFi.status () != WL_CONNECTED) delay (100);
+    Serial.print ("connected\nGetting IP address ... ");
+    while (WiFi.localIP () == IPAddress (0, 0, 0, 0)) delay (100);
+    Serial.println (WiFi.localIP ());
+
+
+    // each session would otherwise need its own socket and there are only few of them (MEMP_NUM_NETCONN), the dispatcher also time-stamps the replies as they arrive
+    const char *errText = ThreadSafePingDispatcher_t::begin ();
+    if (errText != NULL)
+        Serial.printf ("Dispatcher error %s\n", errText);
+
+    // ping the hosts .1 to .16 of the local network
+    ThreadSafePingOptions_t options;
+    options.count = 10;
+    options.intervalMicros = 200000; // 200 ms
+    IPAddress localIP = WiFi.localIP ();
+    for (int i = 0; i < SESSION_COUNT; i++) {
+        errText = sessions [i].begin (IPAddress (localIP [0], localIP [1], localIP [2], i + 1), options);
+        if (errText != NULL)
+            Serial.printf ("Session %i error %s\n", i, errText);
+    }
+}
+
+void loop () {
+    bool allDone = true;
+    for (int i = 0; i < SESSION_COUNT; i++)
+        if (!sessions [i].poll ())
+            allDone = false;
+
+    if (allDone && !reported) {
+        for (int i = 0; i < SESSION_COUNT; i++)
+            Serial.printf ("%-16s sent = %lu, received = %lu, lost = %lu, mean = %.3fms\n", sessions [i].target (), (unsigned long) sessions [i].sent (), (unsigned long) sessions [i].received (), (unsigned long) sessions [i].lost (), sessions [i].mean_time ());
+        reported = true;
+    }
+
+    delay (1); // other things could be done here as well
+}
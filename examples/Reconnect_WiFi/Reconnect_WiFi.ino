@@ -25,7 +25,7 @@ void loop () {
 
         ThreadSafePing_t ping;
         // ping router 4 times
-        ping.ping (WiFi.gatewayIP (), 4); // optional arguments: int count = PING_DEFAULT_COUNT, int interval = PING_DEFAULT_INTERVAL, int size = PING_DEFAULT_SIZE, int timeout = PING_DEFAULT_TIMEOUT
+        ping.ping (WiFi.gatewayIP (), 4); // optional arguments: int count = PING_DEFAULT_COUNT, int interval = PING_DEFAULT_INTERVAL, int size = PING_DEFAULT_SIZE, int timeout = PING_DEFAULT_TIMEOUT, int window = PING_DEFAULT_WINDOW
         if (ping.received () == 0) {
             Serial.printf ("Reconnecting ... \n");
             WiFi.disconnect ();
@@ -0,0 +1,56 @@
+#include <WiFi.h>
+#include <ThreadSafePing.h>
+
+
+// the pinging task only pushes the records into the queue, the (slow) printing is done by the reporting task
+static ThreadSafePingResults_t results (64);
+
+static void reportingTask (void *param) {
+    ThreadSafePingResults_t::record_t records [16];
+    while (true) {
+        int n = results.receive (records, 16); // waits for the first record, then takes the ones that are already waiting
+        for (int i = 0; i < n; i++) {
+            ThreadSafePingResults_t::record_t *r = &records [i];
+            switch (r->status) {
+                case ThreadSafePingResults_t::REPLY:    Serial.printf ("session %u: seqno = %lu, bytes = %i, time = %.3fms\n", r->tag, (unsigned long) r->seqno, r->bytes, r->elapsedMicros / 1000.0); break;
+                case ThreadSafePingResults_t::LOST:     Serial.printf ("session %u: seqno = %lu lost\n", r->tag, (unsigned long) r->seqno); break;
+                case ThreadSafePingResults_t::LATE:     Serial.printf ("session %u: seqno = %lu arrived late, time = %.3fms\n", r->tag, (unsigned long) r->seqno, r->elapsedMicros / 1000.0); break;
+            }
+        }
+        if (results.dropped ())
+            Serial.printf ("%lu records dropped so far\n", (unsigned long) results.dropped ());
+    }
+}
+
+
+void setup () {
+    Serial.begin (115200);
+    while (!Serial)
+        delay (10);
+
+    WiFi.begin ("YourSSID", "YourPassword"); // use your WiFi credentials
+
+    Serial.print ("Connecting ... ");
+    while (WiFi.status () != WL_CONNECTED) delay (100);
+    Serial.print ("connected\nGetting IP address ... ");
+    while (WiFi.localIP () == IPAddress (0, 0, 0, 0)) delay (100);
+    Serial.println (WiFi.localIP ());
+
+
+    xTaskCreate (reportingTask, "reporting_task", 4096, NULL, 1, NULL);
+
+    ThreadSafePing_t ping;
+    ping.setResults (&results, 1); // tag 1 tells this session's records apart from the others that may share the queue
+
+    ThreadSafePingOptions_t options;
+    options.count = 100;
+    options.intervalMicros = 20000; // 20 ms, faster than Serial could report in onReceive
+    options.window = 4;
+    const char *errText = ping.ping ("arduino.cc", options);
+    if (errText != NULL)
+        Serial.printf ("Error %s\n", errText);
+}
+
+void loop () {
+
+}
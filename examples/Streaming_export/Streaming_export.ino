@@ -0,0 +1,58 @@
+#include <WiFi.h>
+#include <ThreadSafePing.h>
+
+
+// the pinging task only encodes a few bytes per echo request into the exporter's buffer, its own task writes the full buffers out
+static ThreadSafePingExporter_t exporter;
+
+
+void setup () {
+    Serial.begin (115200);
+    while (!Serial)
+        delay (10);
+
+    WiFi.begin ("YourSSID", "YourPassword"); // use your WiFi credentials
+
+    Serial.print ("Connecting ... ");
+    while (WiFi.status () != WL_CONNECTED) delay (100);
+    Serial.print ("connected\nGetting IP address ... ");
+    while (WiFi.localIP () == IPAddress (0, 0, 0, 0)) delay (100);
+    Serial.println (WiFi.localIP ());
+
+
+    // CSV to Serial, one tag,status,seqno difference,sentMicros difference,elapsedMicros,bytes line per echo request
+    ThreadSafePingExporterOptions_t exporterOptions;
+    exporterOptions.format = PING_EXPORT_CSV;
+    const char *errText = exporter.begin (Serial, exporterOptions);
+
+    // or the binary format to a LittleFS file (#include <LittleFS.h>), larger buffers mean fewer writes to the flash:
+    //     LittleFS.begin (true);
+    //     static File file = LittleFS.open ("/rtt.bin", "a");
+    //     exporterOptions.format = PING_EXPORT_BINARY;
+    //     exporterOptions.bufferSize = 4096;
+    //     errText = exporter.begin (file, exporterOptions);
+    // or each chunk as a UDP datagram to a collector, which can decode it with ThreadSafePingExporter_t::decode ():
+    //     errText = exporter.begin (IPAddress (192, 168, 1, 10), 9000);
+    if (errText != NULL) {
+        Serial.printf ("Error %s\n", errText);
+        return;
+    }
+
+    ThreadSafePing_t ping;
+    ping.setExporter (&exporter, 1); // tag 1 tells this session's records apart from the others that may share the exporter
+
+    ThreadSafePingOptions_t options;
+    options.count = 100;
+    options.intervalMicros = 20000; // 20 ms, faster than Serial could report in onReceive
+    options.window = 4;
+    errText = ping.ping ("arduino.cc", options);
+    if (errText != NULL)
+        Serial.printf ("Error %s\n", errText);
+
+    exporter.end (); // writes out what is still in the buffers
+    Serial.printf ("%lu records exported, %lu dropped\n", (unsigned long) exporter.exported (), (unsigned long) exporter.dropped ());
+}
+
+void loop () {
+
+}
@@ -0,0 +1,47 @@
+#include <WiFi.h>
+#include <ThreadSafePingSweep.h>
+
+
+void setup () {
+    Serial.begin (115200);
+    while (!Serial)
+        delay (10);
+
+    WiFi.begin ("YourSSID", "YourPassword"); // use your WiFi credentials
+
+    Serial.print ("Connecting ... ");
+    while (WiFi.status () != WL_CONNECTED) delay (100);
+    Serial.print ("connected\nGetting IP address ... ");
+    while (WiFi.localIP () == IPAddress (0, 0, 0, 0)) delay (100);
+    Serial.println (WiFi.localIP ());
+
+
+    // find the live hosts on the local /24 network
+    char cidr [INET_ADDRSTRLEN + 3];
+    IPAddress localIP = WiFi.localIP ();
+    snprintf (cidr, sizeof (cidr), "%u.%u.%u.0/24", localIP [0], localIP [1], localIP [2]);
+
+    ThreadSafePingSweep_t sweep;
+    ThreadSafePingSweepOptions_t options;
+    options.rate = 200;     // echo requests per second
+    options.window = 32;    // echo requests in flight at the same time
+    options.attempts = 2;   // probe the hosts that haven't replied once more
+
+    Serial.printf ("Sweeping %s ...\n", cidr);
+    unsigned long startMillis = millis ();
+    sweep.sweep (cidr, options);
+    if (sweep.errText () != NULL) {
+        Serial.printf ("Error %s\n", sweep.errText ());
+    } else {
+        for (int i = 0; i < sweep.hosts (); i++)
+            if (sweep.alive (i)) {
+                IPAddress a = sweep.address (i);
+                Serial.printf ("    %u.%u.%u.%u time = %.2fms\n", a [0], a [1], a [2], a [3], sweep.elapsed_time (i));
+            }
+        Serial.printf ("%i of %i hosts alive, %lu echo requests sent in %lu ms\n", sweep.aliveCount (), sweep.hosts (), (unsigned long) sweep.sent (), millis () - startMillis);
+    }
+}
+
+void loop () {
+
+}
@@ -0,0 +1,51 @@
+#include <WiFi.h>
+#include <ThreadSafePingTraceroute.h>
+
+
+// reports each answer as soon as it arrives, the answers of different hops come in mixed order since the hops are probed in parallel
+class verboseTraceroute_t : public ThreadSafePingTraceroute_t {
+    void onReceive (int hop, const char *address, float elapsedTime) override {
+        Serial.printf ("    hop %i: %s time = %.3fms\n", hop, address, elapsedTime);
+    }
+};
+
+
+void setup () {
+    Serial.begin (115200);
+    while (!Serial)
+        delay (10);
+
+    WiFi.begin ("YourSSID", "YourPassword"); // use your WiFi credentials
+
+    Serial.print ("Connecting ... ");
+    while (WiFi.status () != WL_CONNECTED) delay (100);
+    Serial.print ("connected\nGetting IP address ... ");
+    while (WiFi.localIP () == IPAddress (0, 0, 0, 0)) delay (100);
+    Serial.println (WiFi.localIP ());
+
+
+    verboseTraceroute_t traceroute;
+    ThreadSafePingTracerouteOptions_t options;
+    options.maxHops = 20;
+    options.probes = 3;     // echo requests per hop
+    options.window = 16;    // echo requests (to different hops) in flight at the same time
+
+    Serial.printf ("Tracing the route to arduino.cc ...\n");
+    unsigned long startMillis = millis ();
+    traceroute.trace ("arduino.cc", options);
+    if (traceroute.errText () != NULL) {
+        Serial.printf ("Error %s\n", traceroute.errText ());
+    } else {
+        for (int hop = 1; hop <= traceroute.hops (); hop++)
+            if (traceroute.received (hop))
+                Serial.printf ("%2i  %-16s %i/%i  min = %.3fms  mean = %.3fms  max = %.3fms%s\n", hop, traceroute.address (hop), traceroute.received (hop), traceroute.sent (hop),
+                               traceroute.min_time (hop), traceroute.mean_time (hop), traceroute.max_time (hop), traceroute.unreachable (hop) ? "  unreachable" : "");
+            else
+                Serial.printf ("%2i  *\n", hop);
+        Serial.printf ("%s %s in %lu ms\n", traceroute.target (), traceroute.reached () ? "reached" : "not reached", millis () - startMillis);
+    }
+}
+
+void loop () {
+
+}
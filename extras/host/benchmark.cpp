@@ -0,0 +1,214 @@
+/*
+    benchmark.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Micro-benchmarks of the library's hot paths on the host: building and time-stamping echo requests, parsing and matching
+    replies, updating the statistics, and whole round trips through the simulated network. Each benchmark is repeated a few
+    times and the best time is reported, so that the numbers can be compared from one build to another.
+
+*/
+
+
+#include <ThreadSafePing.h>
+#include "simnet.h"
+#include <chrono>
+
+extern "C" void _exit (int); // <unistd.h> would clash with the close () of the lwIP socket shim
+
+
+#define BENCHMARK_ITERATIONS    200000
+#define BENCHMARK_REPETITIONS   5
+
+
+static volatile uint32_t __sink__; // keeps the compiler from optimizing the measured work away
+
+// runs body iterations times, BENCHMARK_REPETITIONS times over, and returns the best time per iteration in ns
+template <typename F> static double __measure__ (int iterations, F body) {
+    double best = 1e18;
+    for (int r = 0; r < BENCHMARK_REPETITIONS; r++) {
+        auto start = std::chrono::steady_clock::now ();
+        for (int i = 0; i < iterations; i++)
+            body (i);
+        double ns = std::chrono::duration<double, std::nano> (std::chrono::steady_clock::now () - start).count () / iterations;
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+static void __report__ (const char *name, double ns) {
+    Serial.printf ("%-52s %10.1f ns\n", name, ns);
+}
+
+
+class ThreadSafePingBenchmark_t {
+
+    public:
+        // the template of each ping () and the per echo request patch of its sequence number, time stamp and checksum
+        static void packetBuilding () {
+            static char packet [sizeof (struct icmp_echo_hdr) + PING_MAX_SIZE];
+
+            __report__ ("__buildPacket__ (32 B)", __measure__ (BENCHMARK_ITERATIONS, [] (int i) {
+                ThreadSafePing_t::__buildPacket__ (packet, false, LWIP_SOCKET_OFFSET, 32);
+                __sink__ += packet [2];
+            }));
+            __report__ ("__buildPacket__ (1024 B)", __measure__ (BENCHMARK_ITERATIONS / 10, [] (int i) {
+                ThreadSafePing_t::__buildPacket__ (packet, false, LWIP_SOCKET_OFFSET, 1024);
+                __sink__ += packet [2];
+            }));
+
+            ThreadSafePing_t::__buildPacket__ (packet, false, LWIP_SOCKET_OFFSET, 32);
+            __report__ ("__stampPacket__", __measure__ (BENCHMARK_ITERATIONS, [] (int i) {
+                __sink__ += (uint32_t) ThreadSafePing_t::__stampPacket__ (packet);
+            }));
+
+            // the whole send path, including the lwIP mutex and the shim's sendto, the echo requests are lost so nothing comes back
+            ThreadSafePing_t ping;
+            ping.__resolveTargetName__ ("10.0.0.1");
+            const char *errText;
+            int sockfd = ThreadSafePing_t::__takeSocket__ (false, &errText);
+            float lossRate = simnet.lossRate;
+            simnet.lossRate = 1;
+            __report__ ("__ping_send__ (32 B, shim sendto)", __measure__ (BENCHMARK_ITERATIONS, [&] (int i) {
+                __sink__ += ThreadSafePing_t::__ping_send__ (&ping, sockfd, packet, (uint16_t) i, 32) == NULL;
+            }));
+            simnet.lossRate = lossRate;
+            ThreadSafePing_t::__releaseSocket__ (sockfd, false);
+        }
+
+        // what the receiving side does with each packet: parse it, find the slot of its echo request and hand it over to the owner
+        static void replyMatching () {
+            static char reply [20 + sizeof (struct icmp_echo_hdr) + 32];
+            struct ip_hdr *iphdr = (struct ip_hdr *) reply;
+            iphdr->_v_hl = 0x45;
+            iphdr->_len = htons (sizeof (reply));
+            iphdr->_proto = IPPROTO_ICMP;
+            ThreadSafePing_t::__buildPacket__ (reply + 20, false, LWIP_SOCKET_OFFSET, 32);
+            ((struct icmp_echo_hdr *) (reply + 20))->type = ICMP_ER;
+
+            __report__ ("__parseEchoReply__ (IPv4)", __measure__ (BENCHMARK_ITERATIONS, [] (int i) {
+                int bytes = sizeof (reply);
+                uint16_t id;
+                uint16_t seqno;
+                int64_t sentMicros;
+                __sink__ += ThreadSafePing_t::__parseEchoReply__ (false, reply, &bytes, &id, &seqno, &sentMicros) + bytes + seqno;
+            }));
+
+            // options.verify: the length, the checksum and the payload pattern
+            static char verified [20 + sizeof (struct icmp_echo_hdr) + 1024] __attribute__ ((aligned (4)));
+            memcpy (verified, reply, 20);
+            ((struct ip_hdr *) verified)->_len = htons (sizeof (verified));
+            ThreadSafePing_t::__buildPacket__ (verified + 20, false, LWIP_SOCKET_OFFSET, 1024);
+            ((struct icmp_echo_hdr *) (verified + 20))->type = ICMP_ER;
+            ((struct icmp_echo_hdr *) (verified + 20))->chksum = 0;
+            ((struct icmp_echo_hdr *) (verified + 20))->chksum = inet_chksum (verified + 20, sizeof (verified) - 20);
+            __report__ ("__verifyEchoReply__ (IPv4, 1024 B)", __measure__ (BENCHMARK_ITERATIONS / 10, [] (int i) {
+                __sink__ += ThreadSafePing_t::__verifyEchoReply__ (false, verified, sizeof (verified), 1024);
+            }));
+            if (!ThreadSafePing_t::__verifyEchoReply__ (false, verified, sizeof (verified), 1024))
+                Serial.printf ("    the intact reply failed verification\n");
+
+            #if PING_IPV6
+                static char reply6 [40 + sizeof (struct icmp6_echo_hdr) + 32];
+                reply6 [0] = 0x60;
+                reply6 [5] = sizeof (struct icmp6_echo_hdr) + 32;
+                reply6 [6] = IPPROTO_ICMPV6;
+                ThreadSafePing_t::__buildPacket__ (reply6 + 40, true, LWIP_SOCKET_OFFSET, 32);
+                ((struct icmp6_echo_hdr *) (reply6 + 40))->type = ICMP6_ECHO_REPLY;
+
+                __report__ ("__parseEchoReply__ (IPv6)", __measure__ (BENCHMARK_ITERATIONS, [] (int i) {
+                    int bytes = sizeof (reply6);
+                    uint16_t id;
+                    uint16_t seqno;
+                    int64_t sentMicros;
+                    __sink__ += ThreadSafePing_t::__parseEchoReply__ (true, reply6, &bytes, &id, &seqno, &sentMicros) + bytes + seqno;
+                }));
+            #endif
+
+            // the life of a slot: the owner sends, the reader records the reply, the owner reports it
+            ThreadSafePing_t::__pingReply_t__ *slots = ThreadSafePing_t::__getPingReplies__ () [0];
+            __report__ ("slot: __slotSend__ + __recordReply__ + release", __measure__ (BENCHMARK_ITERATIONS, [slots] (int i) {
+                uint16_t seqno = (uint16_t) i;
+                ThreadSafePing_t::__pingReply_t__ *slot = &slots [seqno % PING_MAX_WINDOW];
+                ThreadSafePing_t::__slotSend__ (slot, seqno);
+                __sink__ += ThreadSafePing_t::__recordReply__ (LWIP_SOCKET_OFFSET, seqno, slot->sent_time, 1000, 32, true);
+                uint32_t word = ThreadSafePing_t::__slotState__ (slot);
+                __sink__ += ThreadSafePing_t::__slotRelease__ (slot, word, ThreadSafePing_t::__SLOT_REPORTED__);
+            }));
+            __report__ ("__recordReply__ (stale)", __measure__ (BENCHMARK_ITERATIONS, [] (int i) {
+                __sink__ += ThreadSafePing_t::__recordReply__ (LWIP_SOCKET_OFFSET, (uint16_t) (i + 1), 0, 1000, 32, false);
+            }));
+            for (int i = 0; i < PING_MAX_WINDOW; i++)
+                ThreadSafePing_t::__slotClear__ (&slots [i]);
+        }
+
+        // everything a reply updates: min/max/mean/variance, jitter, reordering, optionally the histogram
+        static void statistics () {
+            static ThreadSafePing_t ping;
+            ping.__resetStatistics__ (32);
+            __report__ ("__countReply__", __measure__ (BENCHMARK_ITERATIONS, [] (int i) {
+                ping.__countReply__ (i, 1000LL * i, 1000 + (i & 255), 32);
+            }));
+            __sink__ += (uint32_t) ping.mean_time ();
+
+            static ThreadSafePingHistogram_t histogram;
+            ping.setHistogram (&histogram);
+            ping.__resetStatistics__ (32);
+            __report__ ("__countReply__ with histogram", __measure__ (BENCHMARK_ITERATIONS, [] (int i) {
+                ping.__countReply__ (i, 1000LL * i, 1000 + (i & 255), 32);
+            }));
+            ping.setHistogram (NULL);
+            __sink__ += (uint32_t) ping.mean_time ();
+
+            // what the pinging task pays for each record of the streaming export, the sink is the (null) UDP socket of the shim
+            for (int format = PING_EXPORT_BINARY; format <= PING_EXPORT_CSV; format++) {
+                static ThreadSafePingExporter_t exporter;
+                ThreadSafePingExporterOptions_t options;
+                options.format = (ThreadSafePingExportFormat_t) format;
+                exporter.begin (IPAddress (10, 0, 0, 9), 9000, options);
+                ping.setExporter (&exporter);
+                __report__ (format == PING_EXPORT_BINARY ? "__countReply__ with exporter (binary)" : "__countReply__ with exporter (CSV)", __measure__ (BENCHMARK_ITERATIONS, [] (int i) {
+                    ping.__countReply__ (i, 1000LL * i, 1000 + (i & 255), 32);
+                }));
+                ping.setExporter (NULL);
+                exporter.end ();
+                if (exporter.dropped ())
+                    Serial.printf ("    %u of %u records dropped\n", (unsigned) exporter.dropped (), (unsigned) (exporter.dropped () + exporter.exported ()));
+            }
+        }
+
+        // whole round trips, without network delay, so that the numbers show what the library (and the shim) costs
+        static void roundTrips () {
+            simnet.delayMicros = 0;
+            simnet.jitterMicros = 0;
+
+            ThreadSafePing_t ping;
+            ThreadSafePingOptions_t options;
+            options.count = 20000;
+            options.mode = PING_MODE_FLOOD;
+            options.window = PING_MAX_WINDOW;
+            options.timeoutMicros = 100000;
+            options.onWaitMicros = 0;
+
+            int64_t start = esp_timer_get_time ();
+            ping.ping ("10.0.0.1", options);
+            double ns = 1000.0 * (esp_timer_get_time () - start) / options.count;
+            __report__ ("ping () round trip (flood, simulated network)", ns);
+            if (ping.received () != (uint32_t) options.count)
+                Serial.printf ("    %s: %u of %u replies\n", ping.errText () ? ping.errText () : "", (unsigned) ping.received (), (unsigned) options.count);
+        }
+};
+
+
+int main () {
+    Serial.printf ("%-52s %10s\n", "benchmark", "per call");
+
+    ThreadSafePingBenchmark_t::packetBuilding ();
+    ThreadSafePingBenchmark_t::replyMatching ();
+    ThreadSafePingBenchmark_t::statistics ();
+    ThreadSafePingBenchmark_t::roundTrips ();
+
+    fflush (stdout);
+    _exit (0);
+}
@@ -0,0 +1,55 @@
+/*
+    Arduino.h - host shim (only what the library uses)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/select.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef uint8_t byte;
+
+class IPAddress;
+
+unsigned long millis ();
+unsigned long micros ();
+void delay (unsigned long ms);
+void delayMicroseconds (unsigned int us);
+uint32_t esp_random ();
+#include "esp_timer.h"
+
+class Print {
+    public:
+        virtual ~Print () {}
+        virtual size_t write (const uint8_t *buf, size_t len) = 0;
+        virtual void flush () {}
+};
+
+class HardwareSerial_t : public Print {
+    public:
+        void begin (unsigned long) {}
+        operator bool () { return true; }
+        int printf (const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+        size_t write (const uint8_t *buf, size_t len) override { return fwrite (buf, 1, len, stdout); }
+        void print (const char *s) { fputs (s, stdout); }
+        void println (const char *s = "") { puts (s); }
+        void print (const IPAddress &ip);
+        void println (const IPAddress &ip);
+        void print (int i) { ::printf ("%i", i); }
+        void println (int i) { ::printf ("%i\n", i); }
+        void flush () override { fflush (stdout); }
+};
+extern HardwareSerial_t Serial;
+#ifndef portNUM_PROCESSORS
+    #define portNUM_PROCESSORS 2
+#endif
+class EspClass_t { public: uint32_t getMinFreeHeap () { return 123456; } };
+extern EspClass_t ESP;
+template <class T> static inline T max (T a, T b) { return a > b ? a : b; }
@@ -0,0 +1,40 @@
+#include <string>
+#include <stdio.h>
+/*
+    WiFi.h - host shim
+*/
+
+#pragma once
+
+#include "Arduino.h"
+#include "lwip/sockets.h"
+#include "lwip/mem.h"
+
+class IPAddress {
+    public:
+        IPAddress () {}
+        IPAddress (uint8_t a, uint8_t b, uint8_t c, uint8_t d) { __b__ [0] = a; __b__ [1] = b; __b__ [2] = c; __b__ [3] = d; }
+        uint8_t operator [] (int i) const { return __b__ [i]; }
+        uint8_t &operator [] (int i) { return __b__ [i]; }
+        bool operator == (const IPAddress &o) const { return !memcmp (__b__, o.__b__, 4); }
+        bool operator != (const IPAddress &o) const { return !(*this == o); }
+        operator uint32_t () const { uint32_t u; memcpy (&u, __b__, 4); return u; }
+        std::string toString () const { char s [16]; snprintf (s, sizeof (s), "%u.%u.%u.%u", __b__ [0], __b__ [1], __b__ [2], __b__ [3]); return s; }
+    private:
+        uint8_t __b__ [4] = {};
+};
+
+#define WL_CONNECTED 3
+
+class WiFiClass {
+    public:
+        void begin (const char *, const char *) {}
+        int status () { return WL_CONNECTED; }
+        bool isConnected () { return true; }
+        IPAddress localIP () { return IPAddress (10, 0, 0, 2); }
+        IPAddress gatewayIP () { return IPAddress (10, 0, 0, 1); }
+        IPAddress subnetMask () { return IPAddress (255, 255, 255, 0); }
+        void disconnect () {}
+        void reconnect () {}
+};
+extern WiFiClass WiFi;
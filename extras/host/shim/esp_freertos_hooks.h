@@ -0,0 +1,4 @@
+#pragma once
+typedef bool (*esp_freertos_idle_cb_t) ();
+static inline int esp_register_freertos_idle_hook_for_cpu (esp_freertos_idle_cb_t, unsigned) { return 0; }
+static inline void esp_deregister_freertos_idle_hook_for_cpu (esp_freertos_idle_cb_t, unsigned) {}
@@ -0,0 +1,57 @@
+/*
+    FreeRTOS.h - host shim (pthread-backed)
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  1
+#define pdFAIL  0
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define configTICK_RATE_HZ 1000
+#define tskNO_AFFINITY 0x7fffffff
+#define configMAX_PRIORITIES 25
+
+typedef struct shimSemaphore *SemaphoreHandle_t;
+SemaphoreHandle_t xSemaphoreCreateMutex ();
+SemaphoreHandle_t xSemaphoreCreateBinary ();
+BaseType_t xSemaphoreTake (SemaphoreHandle_t s, TickType_t ticks);
+BaseType_t xSemaphoreGive (SemaphoreHandle_t s);
+void vSemaphoreDelete (SemaphoreHandle_t s);
+
+// spinlock critical sections, as on the dual-core ESP32 (interrupts are not masked here)
+typedef struct { int owner; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portENTER_CRITICAL(mux) do { while (__atomic_exchange_n (&(mux)->owner, 1, __ATOMIC_ACQUIRE)) ; } while (0)
+#define portEXIT_CRITICAL(mux) __atomic_store_n (&(mux)->owner, 0, __ATOMIC_RELEASE)
+
+typedef struct shimQueue *QueueHandle_t;
+QueueHandle_t xQueueCreate (UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend (QueueHandle_t q, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive (QueueHandle_t q, void *item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting (QueueHandle_t q);
+void vQueueDelete (QueueHandle_t q);
+BaseType_t xQueueReset (QueueHandle_t q);
+#define xQueueSendToBack xQueueSend
+
+typedef struct shimTask *TaskHandle_t;
+typedef void (*TaskFunction_t) (void *);
+BaseType_t xTaskCreate (TaskFunction_t f, const char *name, uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *handle);
+BaseType_t xTaskCreatePinnedToCore (TaskFunction_t f, const char *name, uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *handle, BaseType_t core);
+void vTaskDelete (TaskHandle_t t);
+void vTaskDelay (TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle ();
+TickType_t xTaskGetTickCount ();
+BaseType_t xTaskNotifyGive (TaskHandle_t t);
+uint32_t ulTaskNotifyTake (BaseType_t clear, TickType_t ticks);
+UBaseType_t uxTaskGetStackHighWaterMark (TaskHandle_t t);
+BaseType_t xPortGetCoreID ();
+void vTaskPrioritySet (TaskHandle_t t, UBaseType_t prio);
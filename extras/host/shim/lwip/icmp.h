@@ -0,0 +1,31 @@
+/*
+    lwip/icmp.h - host shim
+*/
+
+#pragma once
+
+#include "lwip/opt.h"
+
+#define ICMP_ER   0
+#define ICMP_DUR  3
+#define ICMP_SQ   4
+#define ICMP_RD   5
+#define ICMP_ECHO 8
+#define ICMP_TE   11
+#define ICMP_PP   12
+
+struct icmp_echo_hdr {
+    u8_t type;
+    u8_t code;
+    u16_t chksum;
+    u16_t id;
+    u16_t seqno;
+} __attribute__ ((packed));
+
+struct icmp6_echo_hdr {
+    u8_t type;
+    u8_t code;
+    u16_t chksum;
+    u16_t id;
+    u16_t seqno;
+} __attribute__ ((packed));
@@ -0,0 +1,9 @@
+/*
+    lwip/inet_chksum.h - host shim
+*/
+
+#pragma once
+
+#include "lwip/opt.h"
+
+u16_t inet_chksum (const void *dataptr, u16_t len);
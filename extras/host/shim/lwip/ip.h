@@ -0,0 +1,31 @@
+/*
+    lwip/ip.h - host shim
+*/
+
+#pragma once
+
+#include "lwip/opt.h"
+
+struct ip_hdr {
+    u8_t _v_hl;
+    u8_t _tos;
+    u16_t _len;
+    u16_t _id;
+    u16_t _offset;
+    u8_t _ttl;
+    u8_t _proto;
+    u16_t _chksum;
+    u32_t src;
+    u32_t dest;
+} __attribute__ ((packed));
+
+#define IP_RF      0x8000U
+#define IP_DF      0x4000U
+#define IP_MF      0x2000U
+#define IP_OFFMASK 0x1fffU
+#define IP_HLEN    20
+#define IPH_V(hdr)  ((hdr)->_v_hl >> 4)
+#define IPH_HL(hdr) ((hdr)->_v_hl & 0x0f)
+#define IPH_LEN(hdr) ((hdr)->_len)
+#define IPH_TTL(hdr) ((hdr)->_ttl)
+#define IPH_PROTO(hdr) ((hdr)->_proto)
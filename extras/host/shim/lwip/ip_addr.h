@@ -0,0 +1,18 @@
+/*
+    lwip/ip_addr.h - host shim
+*/
+
+#pragma once
+
+#include "lwip/opt.h"
+
+typedef struct { u32_t addr; } ip4_addr_t;
+typedef struct { u32_t addr [4]; u8_t zone; } ip6_addr_t;
+typedef struct ip_addr { union { ip6_addr_t ip6; ip4_addr_t ip4; } u_addr; u8_t type; } ip_addr_t;
+
+#define IPADDR_TYPE_V4   0U
+#define IPADDR_TYPE_V6   6U
+#define IPADDR_TYPE_ANY 46U
+
+#define ip_addr_set_ip4_u32(ipaddr, val) do { (ipaddr)->u_addr.ip4.addr = (val); (ipaddr)->type = IPADDR_TYPE_V4; } while (0)
+#define IP_ADDR6(ipaddr, i0, i1, i2, i3) do { (ipaddr)->u_addr.ip6.addr [0] = (i0); (ipaddr)->u_addr.ip6.addr [1] = (i1); (ipaddr)->u_addr.ip6.addr [2] = (i2); (ipaddr)->u_addr.ip6.addr [3] = (i3); (ipaddr)->u_addr.ip6.zone = 0; (ipaddr)->type = IPADDR_TYPE_V6; } while (0)
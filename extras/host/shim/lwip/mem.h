@@ -0,0 +1,2 @@
+#pragma once
+#include "lwip/opt.h"
@@ -0,0 +1,33 @@
+/*
+    lwip/netdb.h - host shim
+*/
+
+#pragma once
+
+#include "lwip/sockets.h"
+
+#define EAI_NONAME      200
+#define EAI_SERVICE     201
+#define EAI_FAIL        202
+#define EAI_MEMORY      203
+#define EAI_FAMILY      204
+#define EAI_AGAIN       205
+#define EAI_BADFLAGS    206
+#define EAI_SOCKTYPE    207
+#define HOST_NOT_FOUND  210
+
+struct addrinfo {
+    int ai_flags;
+    int ai_family;
+    int ai_socktype;
+    int ai_protocol;
+    socklen_t ai_addrlen;
+    struct sockaddr *ai_addr;
+    char *ai_canonname;
+    struct addrinfo *ai_next;
+};
+
+int lwip_getaddrinfo (const char *nodename, const char *servname, const struct addrinfo *hints, struct addrinfo **res);
+void lwip_freeaddrinfo (struct addrinfo *ai);
+#define getaddrinfo(n, s, h, r) lwip_getaddrinfo (n, s, h, r)
+#define freeaddrinfo(ai)        lwip_freeaddrinfo (ai)
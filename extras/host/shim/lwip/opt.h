@@ -0,0 +1,27 @@
+/*
+    lwip/opt.h - host shim
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uint8_t  u8_t;
+typedef int8_t   s8_t;
+typedef uint16_t u16_t;
+typedef int16_t  s16_t;
+typedef uint32_t u32_t;
+typedef int32_t  s32_t;
+typedef s8_t     err_t;
+#define ERR_OK  0
+#define ERR_MEM -1
+#define ERR_BUF -2
+#define ERR_RTE -4
+#define ERR_VAL -6
+
+#define MEMP_NUM_NETCONN    10
+#define LWIP_SOCKET_OFFSET  54
+#define LWIP_IPV6           1
+
+void *mem_malloc (size_t size);
+void mem_free (void *p);
@@ -0,0 +1,22 @@
+/*
+    lwip/pbuf.h - host shim, single-buffer pbufs only
+*/
+
+#pragma once
+
+#include "lwip/opt.h"
+
+typedef enum { PBUF_TRANSPORT, PBUF_IP, PBUF_LINK, PBUF_RAW } pbuf_layer;
+typedef enum { PBUF_RAM, PBUF_ROM, PBUF_REF, PBUF_POOL } pbuf_type;
+
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    u16_t tot_len;
+    u16_t len;
+};
+
+struct pbuf *pbuf_alloc (pbuf_layer layer, u16_t length, pbuf_type type);
+u8_t pbuf_free (struct pbuf *p);
+err_t pbuf_take (struct pbuf *buf, const void *dataptr, u16_t len);
+u16_t pbuf_copy_partial (const struct pbuf *p, void *dataptr, u16_t len, u16_t offset);
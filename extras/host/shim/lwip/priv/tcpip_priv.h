@@ -0,0 +1,16 @@
+/*
+    lwip/priv/tcpip_priv.h - host shim, tcpip_api_call only
+*/
+
+#pragma once
+
+#include "lwip/tcpip.h"
+
+struct tcpip_api_call_data {
+    err_t err;
+};
+
+typedef err_t (*tcpip_api_call_fn) (struct tcpip_api_call_data *call);
+
+// runs fn in the tcpip thread and waits for it on a condition variable of its own, like lwIP does with a semaphore per call
+err_t tcpip_api_call (tcpip_api_call_fn fn, struct tcpip_api_call_data *call);
@@ -0,0 +1,27 @@
+/*
+    lwip/raw.h - host shim, raw API backed by the simulated network
+*/
+
+#pragma once
+
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+struct raw_pcb;
+typedef u8_t (*raw_recv_fn) (void *arg, struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *addr);
+
+struct raw_pcb {
+    u8_t type;
+    u8_t protocol;
+    u8_t chksum_reqd;
+    u16_t chksum_offset;
+    raw_recv_fn recv;
+    void *recv_arg;
+};
+
+struct raw_pcb *raw_new (u8_t proto);
+struct raw_pcb *raw_new_ip_type (u8_t type, u8_t proto);
+void raw_remove (struct raw_pcb *pcb);
+void raw_recv (struct raw_pcb *pcb, raw_recv_fn recv, void *recv_arg);
+err_t raw_sendto (struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *ipaddr);
@@ -0,0 +1,81 @@
+/*
+    lwip/sockets.h - host shim, BSD socket API of lwIP backed by a simulated network
+*/
+
+#pragma once
+
+#include <sys/select.h>
+#include <sys/time.h>
+#include "lwip/opt.h"
+
+typedef uint32_t socklen_t_shim;
+#define socklen_t socklen_t_shim
+typedef uint8_t sa_family_t_shim;
+#define sa_family_t sa_family_t_shim
+
+#define AF_UNSPEC   0
+#define AF_INET     2
+#define AF_INET6    10
+#define PF_INET     AF_INET
+#define PF_INET6    AF_INET6
+#define SOCK_STREAM 1
+#define SOCK_DGRAM  2
+#define SOCK_RAW    3
+#define IPPROTO_IP      0
+#define IPPROTO_ICMP    1
+#define IPPROTO_UDP     17
+#define IPPROTO_IPV6    41
+#define IPPROTO_ICMPV6  58
+#define SOL_SOCKET  0xfff
+#define SO_RCVTIMEO 0x1006
+#define SO_RCVBUF   0x1002
+#define IP_TOS      1
+#define IP_TTL      2
+#define IPV6_UNICAST_HOPS 4
+#define F_GETFL     3
+#define F_SETFL     4
+#define O_NONBLOCK  1
+#define INET_ADDRSTRLEN  16
+#define INET6_ADDRSTRLEN 46
+
+struct in_addr { uint32_t s_addr; };
+struct in6_addr { union { uint32_t u32_addr [4]; uint8_t u8_addr [16]; } un; };
+#define s6_addr un.u8_addr
+
+struct sockaddr { uint8_t sa_len; sa_family_t sa_family; char sa_data [14]; };
+struct sockaddr_in { uint8_t sin_len; sa_family_t sin_family; uint16_t sin_port; struct in_addr sin_addr; char sin_zero [8]; };
+struct sockaddr_in6 { uint8_t sin6_len; sa_family_t sin6_family; uint16_t sin6_port; uint32_t sin6_flowinfo; struct in6_addr sin6_addr; uint32_t sin6_scope_id; };
+struct sockaddr_storage { uint8_t s2_len; sa_family_t ss_family; char s2_data1 [2]; uint32_t s2_data2 [3]; uint32_t s2_data3 [3]; };
+
+int lwip_socket (int domain, int type, int protocol);
+int lwip_close (int s);
+int lwip_fcntl (int s, int cmd, int val);
+int lwip_sendto (int s, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen);
+int lwip_recvfrom (int s, void *mem, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen);
+int lwip_select (int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout);
+int lwip_setsockopt (int s, int level, int optname, const void *optval, socklen_t optlen);
+int lwip_getsockopt (int s, int level, int optname, void *optval, socklen_t *optlen);
+const char *lwip_inet_ntop (int af, const void *src, char *dst, socklen_t size);
+int lwip_inet_pton (int af, const char *src, void *dst);
+
+#define socket(a, b, c)             lwip_socket (a, b, c)
+#define closesocket(s)              lwip_close (s)
+#define close(s)                    lwip_close (s)
+#define fcntl(s, c, v)              lwip_fcntl (s, c, v)
+#define sendto(s, d, l, f, t, tl)   lwip_sendto (s, d, l, f, t, tl)
+#define recvfrom(s, m, l, f, fr, fl) lwip_recvfrom (s, m, l, f, fr, fl)
+#define recv(s, m, l, f)            lwip_recvfrom (s, m, l, f, NULL, NULL)
+#define select(m, r, w, e, t)       lwip_select (m, r, w, e, t)
+#define setsockopt(s, l, n, v, ol)  lwip_setsockopt (s, l, n, v, ol)
+#define getsockopt(s, l, n, v, ol)  lwip_getsockopt (s, l, n, v, ol)
+#define inet_ntop(a, s, d, l)       lwip_inet_ntop (a, s, d, l)
+#define inet_pton(a, s, d)          lwip_inet_pton (a, s, d)
+
+static inline uint16_t lwip_htons (uint16_t x) { return (uint16_t) ((x << 8) | (x >> 8)); }
+static inline uint32_t lwip_htonl (uint32_t x) { return __builtin_bswap32 (x); }
+#define htons(x) lwip_htons (x)
+#define ntohs(x) lwip_htons (x)
+#define htonl(x) lwip_htonl (x)
+#define ntohl(x) lwip_htonl (x)
+#define PP_HTONS(x) ((uint16_t) ((((x) & 0xff) << 8) | (((x) & 0xff00) >> 8)))
+#define PP_NTOHS(x) PP_HTONS (x)
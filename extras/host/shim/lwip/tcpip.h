@@ -0,0 +1,11 @@
+/*
+    lwip/tcpip.h - host shim, the tcpip thread runs the callbacks and the raw_pcb input
+*/
+
+#pragma once
+
+#include "lwip/opt.h"
+
+typedef void (*tcpip_callback_fn) (void *ctx);
+
+err_t tcpip_callback (tcpip_callback_fn function, void *ctx);
@@ -0,0 +1,926 @@
+/*
+    shim.cpp - host shim: Arduino timing, FreeRTOS primitives on pthreads, lwIP BSD sockets and raw API on a simulated network
+*/
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <lwip/netdb.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/ip.h>
+#include <lwip/icmp.h>
+#include <lwip/raw.h>
+#include <lwip/tcpip.h>
+#include <lwip/priv/tcpip_priv.h>
+#include "simnet.h"
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <vector>
+#include <random>
+#include <stdarg.h>
+#include <pthread.h>
+
+
+simnet_config_t simnet;
+int simnet_bad_checksums = 0;
+int simnet_sockets_created = 0;
+int simnet_udp_datagrams = 0;
+void (*simnet_on_udp) (const void *data, size_t size, const struct sockaddr *to) = NULL;
+HardwareSerial_t Serial;
+WiFiClass WiFi;
+EspClass_t ESP;
+
+
+// ----- timing -----
+
+static const auto __start__ = std::chrono::steady_clock::now ();
+
+int64_t esp_timer_get_time () { return std::chrono::duration_cast<std::chrono::microseconds> (std::chrono::steady_clock::now () - __start__).count (); }
+unsigned long millis () { return (unsigned long) (uint32_t) (esp_timer_get_time () / 1000); }
+unsigned long micros () { return (unsigned long) (uint32_t) esp_timer_get_time (); }
+uint32_t esp_random () { static std::mt19937 r (7); return r (); }
+void delay (unsigned long ms) { std::this_thread::sleep_for (std::chrono::milliseconds (ms)); }
+void delayMicroseconds (unsigned int us) { std::this_thread::sleep_for (std::chrono::microseconds (us)); }
+
+int HardwareSerial_t::printf (const char *fmt, ...) {
+    va_list ap;
+    va_start (ap, fmt);
+    int i = vprintf (fmt, ap);
+    va_end (ap);
+    return i;
+}
+
+void HardwareSerial_t::print (const IPAddress &ip) { ::printf ("%u.%u.%u.%u", ip [0], ip [1], ip [2], ip [3]); }
+void HardwareSerial_t::println (const IPAddress &ip) { print (ip); puts (""); }
+
+
+// ----- FreeRTOS -----
+
+struct shimSemaphore {
+    std::mutex m;
+    std::condition_variable cv;
+    int count;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex () { SemaphoreHandle_t s = new shimSemaphore; s->count = 1; return s; }
+SemaphoreHandle_t xSemaphoreCreateBinary () { SemaphoreHandle_t s = new shimSemaphore; s->count = 0; return s; }
+void vSemaphoreDelete (SemaphoreHandle_t s) { delete s; }
+
+BaseType_t xSemaphoreTake (SemaphoreHandle_t s, TickType_t ticks) {
+    std::unique_lock<std::mutex> l (s->m);
+    if (ticks == portMAX_DELAY)
+        s->cv.wait (l, [s] { return s->count > 0; });
+    else if (!s->cv.wait_for (l, std::chrono::milliseconds (ticks), [s] { return s->count > 0; }))
+        return pdFALSE;
+    s->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive (SemaphoreHandle_t s) {
+    std::lock_guard<std::mutex> l (s->m);
+    if (s->count > 0)
+        return pdFALSE;
+    s->count++;
+    s->cv.notify_one ();
+    return pdTRUE;
+}
+
+struct shimQueue {
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+};
+
+QueueHandle_t xQueueCreate (UBaseType_t length, UBaseType_t itemSize) { QueueHandle_t q = new shimQueue; q->length = length; q->itemSize = itemSize; return q; }
+void vQueueDelete (QueueHandle_t q) { delete q; }
+BaseType_t xQueueReset (QueueHandle_t q) { std::lock_guard<std::mutex> l (q->m); q->items.clear (); q->cv.notify_all (); return pdPASS; }
+UBaseType_t uxQueueMessagesWaiting (QueueHandle_t q) { std::lock_guard<std::mutex> l (q->m); return q->items.size (); }
+
+BaseType_t xQueueSend (QueueHandle_t q, const void *item, TickType_t ticks) {
+    std::unique_lock<std::mutex> l (q->m);
+    auto notFull = [q] { return q->items.size () < q->length; };
+    if (ticks == portMAX_DELAY)
+        q->cv.wait (l, notFull);
+    else if (!q->cv.wait_for (l, std::chrono::milliseconds (ticks), notFull))
+        return pdFALSE;
+    q->items.emplace_back ((const uint8_t *) item, (const uint8_t *) item + q->itemSize);
+    q->cv.notify_all ();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive (QueueHandle_t q, void *item, TickType_t ticks) {
+    std::unique_lock<std::mutex> l (q->m);
+    auto notEmpty = [q] { return !q->items.empty (); };
+    if (ticks == portMAX_DELAY)
+        q->cv.wait (l, notEmpty);
+    else if (!q->cv.wait_for (l, std::chrono::milliseconds (ticks), notEmpty))
+        return pdFALSE;
+    memcpy (item, q->items.front ().data (), q->itemSize);
+    q->items.pop_front ();
+    q->cv.notify_all ();
+    return pdTRUE;
+}
+
+struct shimTask {
+    std::mutex m;
+    std::condition_variable cv;
+    uint32_t notifications = 0;
+    TaskFunction_t f;
+    void *param;
+};
+
+static thread_local shimTask *__currentTask__ = nullptr;
+
+TaskHandle_t xTaskGetCurrentTaskHandle () {
+    if (!__currentTask__)
+        __currentTask__ = new shimTask;  // the main thread or a thread created outside of the shim
+    return __currentTask__;
+}
+
+BaseType_t xTaskCreatePinnedToCore (TaskFunction_t f, const char *name, uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *handle, BaseType_t core) {
+    shimTask *t = new shimTask;
+    t->f = f;
+    t->param = param;
+    if (handle)
+        *handle = t;
+    std::thread ([t] { __currentTask__ = t; t->f (t->param); }).detach ();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate (TaskFunction_t f, const char *name, uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore (f, name, stack, param, prio, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete (TaskHandle_t t) {
+    if (t == NULL || t == __currentTask__)
+        pthread_exit (NULL);
+}
+
+void vTaskDelay (TickType_t ticks) { delay (ticks); }
+TickType_t xTaskGetTickCount () { return (TickType_t) millis (); }
+UBaseType_t uxTaskGetStackHighWaterMark (TaskHandle_t t) { return 0; }
+BaseType_t xPortGetCoreID () { return 0; }
+void vTaskPrioritySet (TaskHandle_t t, UBaseType_t prio) {}
+
+BaseType_t xTaskNotifyGive (TaskHandle_t t) {
+    std::lock_guard<std::mutex> l (t->m);
+    t->notifications++;
+    t->cv.notify_all ();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake (BaseType_t clear, TickType_t ticks) {
+    shimTask *t = xTaskGetCurrentTaskHandle ();
+    std::unique_lock<std::mutex> l (t->m);
+    auto notified = [t] { return t->notifications > 0; };
+    if (ticks == portMAX_DELAY)
+        t->cv.wait (l, notified);
+    else
+        t->cv.wait_for (l, std::chrono::milliseconds (ticks), notified);
+    uint32_t n = t->notifications;
+    if (n)
+        t->notifications = clear ? 0 : n - 1;
+    return n;
+}
+
+
+// ----- lwIP memory and checksum -----
+
+static std::mutex __memMutex__;
+static size_t __memUsed__ = 0;
+
+void *mem_malloc (size_t size) {
+    size_t *p = (size_t *) malloc (size + sizeof (size_t));
+    if (!p)
+        return NULL;
+    *p = size;
+    std::lock_guard<std::mutex> l (__memMutex__);
+    __memUsed__ += size;
+    return p + 1;
+}
+
+void mem_free (void *m) {
+    if (!m)
+        return;
+    size_t *p = (size_t *) m - 1;
+    {
+        std::lock_guard<std::mutex> l (__memMutex__);
+        __memUsed__ -= *p;
+    }
+    free (p);
+}
+
+u16_t inet_chksum (const void *dataptr, u16_t len) {
+    const uint8_t *p = (const uint8_t *) dataptr;
+    uint32_t sum = 0;
+    for (int i = 0; i + 1 < len; i += 2) {
+        uint16_t w;
+        memcpy (&w, p + i, 2);
+        sum += w;
+    }
+    if (len & 1)
+        sum += p [len - 1];  // little endian host: the odd byte is the low byte
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (u16_t) ~sum;
+}
+
+
+// ----- simulated network -----
+
+struct __simPacket__ {
+    int64_t deliverAt;
+    std::vector<uint8_t> data;
+    struct sockaddr_storage from;
+};
+
+struct __simSocket__ {
+    bool used = false;
+    int family;
+    int type;
+    bool nonBlocking = false;
+    int ttl = 64;
+    uint32_t rcvTimeoutMs = 0;
+    std::deque<__simPacket__> rx;
+};
+
+static std::mutex __netMutex__;
+static std::condition_variable __netCv__;
+static __simSocket__ __sockets__ [MEMP_NUM_NETCONN];
+static std::mt19937 __rng__ (12345);
+
+static float __random__ () { return std::uniform_real_distribution<float> (0.0f, 1.0f) (__rng__); }
+
+static int64_t __oneWay__ () { return simnet.delayMicros + (simnet.jitterMicros ? __rng__ () % simnet.jitterMicros : 0); }
+
+int lwip_socket (int domain, int type, int protocol) {
+    std::lock_guard<std::mutex> l (__netMutex__);
+    for (int i = 0; i < MEMP_NUM_NETCONN; i++)
+        if (!__sockets__ [i].used) {
+            __sockets__ [i] = __simSocket__ ();
+            __sockets__ [i].used = true;
+            __sockets__ [i].family = domain;
+            __sockets__ [i].type = type;
+            simnet_sockets_created++;
+            return i + LWIP_SOCKET_OFFSET;
+        }
+    errno = ENFILE;
+    return -1;
+}
+
+static __simSocket__ *__sock__ (int s) {
+    if (s < LWIP_SOCKET_OFFSET || s >= LWIP_SOCKET_OFFSET + MEMP_NUM_NETCONN || !__sockets__ [s - LWIP_SOCKET_OFFSET].used) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &__sockets__ [s - LWIP_SOCKET_OFFSET];
+}
+
+int lwip_close (int s) {
+    std::lock_guard<std::mutex> l (__netMutex__);
+    __simSocket__ *k = __sock__ (s);
+    if (!k)
+        return -1;
+    k->used = false;
+    k->rx.clear ();
+    return 0;
+}
+
+int lwip_fcntl (int s, int cmd, int val) {
+    std::lock_guard<std::mutex> l (__netMutex__);
+    __simSocket__ *k = __sock__ (s);
+    if (!k)
+        return -1;
+    if (cmd == F_GETFL)
+        return k->nonBlocking ? O_NONBLOCK : 0;
+    if (cmd == F_SETFL) {
+        k->nonBlocking = val & O_NONBLOCK;
+        return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+int lwip_setsockopt (int s, int level, int optname, const void *optval, socklen_t optlen) {
+    std::lock_guard<std::mutex> l (__netMutex__);
+    __simSocket__ *k = __sock__ (s);
+    if (!k)
+        return -1;
+    if (level == SOL_SOCKET && optname == SO_RCVTIMEO) {
+        const struct timeval *tv = (const struct timeval *) optval;
+        k->rcvTimeoutMs = tv->tv_sec * 1000 + tv->tv_usec / 1000;
+        return 0;
+    }
+    if ((level == IPPROTO_IP && optname == IP_TTL) || (level == IPPROTO_IPV6 && optname == IPV6_UNICAST_HOPS)) {
+        k->ttl = *(const int *) optval;
+        return 0;
+    }
+    return 0;
+}
+
+int lwip_getsockopt (int s, int level, int optname, void *optval, socklen_t *optlen) {
+    std::lock_guard<std::mutex> l (__netMutex__);
+    __simSocket__ *k = __sock__ (s);
+    if (!k)
+        return -1;
+    if ((level == IPPROTO_IP && optname == IP_TTL) || (level == IPPROTO_IPV6 && optname == IPV6_UNICAST_HOPS)) {
+        *(int *) optval = k->ttl;
+        return 0;
+    }
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
+static std::vector<struct raw_pcb *> __rawPcbs__;
+static std::multimap<int64_t, std::pair<int, __simPacket__>> __rawPending__;  // packets that the raw_pcbs get to see first, by arrival time
+static std::deque<std::pair<tcpip_callback_fn, void *>> __tcpipCalls__;
+static std::condition_variable __tcpipCv__;
+static void __startTcpipThread__ ();
+
+static bool __hasRawPcb__ (int family) {
+    for (auto pcb : __rawPcbs__)
+        if ((pcb->type == IPADDR_TYPE_V6) == (family == AF_INET6))
+            return true;
+    return false;
+}
+
+// deliver a copy of an incoming ICMP packet to every raw socket of the family, like lwIP's raw_input does - must be called with __netMutex__ taken
+static void __deliverToSockets__ (int family, int64_t at, const std::vector<uint8_t> &data, const struct sockaddr_storage &from) {
+    for (int i = 0; i < MEMP_NUM_NETCONN; i++)
+        if (__sockets__ [i].used && __sockets__ [i].family == family) {
+            auto &rx = __sockets__ [i].rx;
+            auto it = rx.begin ();
+            while (it != rx.end () && it->deliverAt <= at)
+                it++;
+            rx.insert (it, { at, data, from });
+        }
+    __netCv__.notify_all ();
+}
+
+// the raw_pcbs get incoming packets first, in the tcpip thread, and the sockets only get the ones they don't eat - must be called with __netMutex__ taken
+static void __deliver__ (int family, int64_t at, const std::vector<uint8_t> &data, const struct sockaddr_storage &from) {
+    if (!__hasRawPcb__ (family))
+        return __deliverToSockets__ (family, at, data, from);
+    __rawPending__.insert ({ at, { family, { at, data, from } } });
+    __tcpipCv__.notify_all ();
+}
+
+static void __icmpFixChecksum__ (uint8_t *icmp, size_t len) {
+    icmp [2] = icmp [3] = 0;
+    uint16_t c = inet_chksum (icmp, len);
+    memcpy (icmp + 2, &c, 2);
+}
+
+// the ICMPv6 checksum of a packet with the IPv6 header in front, over the pseudo header: the addresses, the length and the next header
+static void __icmp6FixChecksum__ (uint8_t *ip6) {
+    uint8_t *icmp = ip6 + 40;
+    size_t len = ip6 [4] << 8 | ip6 [5];
+    uint8_t pseudo [8] = { 0, 0, (uint8_t) (len >> 8), (uint8_t) len, 0, 0, 0, IPPROTO_ICMPV6 };
+    icmp [2] = icmp [3] = 0;
+    uint32_t sum = (uint16_t) ~inet_chksum (ip6 + 8, 32);
+    sum += (uint16_t) ~inet_chksum (pseudo, sizeof (pseudo));
+    sum += (uint16_t) ~inet_chksum (icmp, len);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    uint16_t c = ~sum;
+    memcpy (icmp + 2, &c, 2);
+}
+
+// simulates the path of an ICMP packet and its response - must be called with __netMutex__ taken
+static int __simSend__ (int ttl, const void *data, size_t size, const struct sockaddr *to) {
+    if (size < 8 || size > 65000) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    const uint8_t *icmp = (const uint8_t *) data;
+    int64_t now = esp_timer_get_time ();
+    int family = to->sa_family;
+
+    // the response goes through the same path: the request gets there, the reply gets back
+    if (__random__ () < simnet.lossRate || __random__ () < simnet.lossRate)
+        return size;
+
+    struct sockaddr_storage from = {};
+    memcpy (&from, to, family == AF_INET ? sizeof (struct sockaddr_in) : sizeof (struct sockaddr_in6));
+
+    if (family == AF_INET) {
+        uint32_t dst = ((const struct sockaddr_in *) to)->sin_addr.s_addr;
+        if (icmp [0] != ICMP_ECHO)
+            return size;
+        if (inet_chksum (icmp, size) != 0) {
+            simnet_bad_checksums++;
+            return size; // a real host would drop it
+        }
+        std::vector<uint8_t> reply (20 + size);
+        struct ip_hdr *ip = (struct ip_hdr *) reply.data ();
+        ip->_v_hl = 0x45;
+        ip->_len = htons (20 + size);
+        ip->_ttl = 64;
+        ip->_proto = IPPROTO_ICMP;
+        ip->src = dst;
+        memcpy (reply.data () + 20, icmp, size);
+
+        if (ttl <= simnet.hops) {
+            // a router on the way answers with time exceeded, quoting the IP header and the first 8 bytes of the original datagram
+            std::vector<uint8_t> te (20 + 8 + 28);
+            struct ip_hdr *teip = (struct ip_hdr *) te.data ();
+            teip->_v_hl = 0x45;
+            teip->_len = htons (te.size ());
+            teip->_ttl = 64;
+            teip->_proto = IPPROTO_ICMP;
+            teip->src = htonl (0x0a640000 + ttl);  // 10.100.0.<hop>
+            te [20] = ICMP_TE;
+            struct ip_hdr *quoted = (struct ip_hdr *) (te.data () + 28);
+            quoted->_v_hl = 0x45;
+            quoted->_proto = IPPROTO_ICMP;
+            quoted->dest = dst;
+            memcpy (te.data () + 48, icmp, 8);
+            __icmpFixChecksum__ (te.data () + 20, te.size () - 20);
+            ((struct sockaddr_in *) &from)->sin_addr.s_addr = teip->src;
+            __deliver__ (AF_INET, now + 2 * (__oneWay__ () * ttl / (simnet.hops + 1)), te, from);
+            return size;
+        }
+        if ((ntohl (dst) & 0xff) >= simnet.deadFrom)
+            return size;
+        if (20 + (int) size > simnet.pathMtu)
+            return size; // fragmented somewhere on the path and the fragments got dropped (lwIP can't set DF)
+
+        reply [20] = ICMP_ER;
+        __icmpFixChecksum__ (reply.data () + 20, size);
+        if (__random__ () < simnet.corruptRate)
+            reply [20 + 8 + __rng__ () % (size - 8 > 0 ? size - 8 : 1)] ^= 0x10;
+        int64_t at = now + __oneWay__ () + __oneWay__ ();
+        __deliver__ (AF_INET, at, reply, from);
+        if (__random__ () < simnet.duplicateRate)
+            __deliver__ (AF_INET, at + __oneWay__ (), reply, from);
+    } else {
+        if (icmp [0] != 128)
+            return size;
+        std::vector<uint8_t> reply (40 + size);
+        reply [0] = 0x60;
+        reply [4] = size >> 8;
+        reply [5] = size & 0xff;
+        reply [6] = IPPROTO_ICMPV6;
+        reply [7] = 64;
+        memcpy (reply.data () + 8, &((const struct sockaddr_in6 *) to)->sin6_addr, 16);
+        memcpy (reply.data () + 40, icmp, size);
+        reply [40] = 129;
+        __icmp6FixChecksum__ (reply.data ());
+        if (__random__ () < simnet.corruptRate)
+            reply [40 + 8 + __rng__ () % (size - 8 > 0 ? size - 8 : 1)] ^= 0x10;
+        if (ttl <= simnet.hops) {
+            // time exceeded from 2001:db8:ffff::<hop>, quoting the IPv6 header and the beginning of the original datagram
+            std::vector<uint8_t> te (40 + 8 + 40 + 8);
+            te [0] = 0x60;
+            te [5] = te.size () - 40;
+            te [6] = IPPROTO_ICMPV6;
+            te [7] = 64;
+            te [40] = 3;
+            te [48] = 0x60;
+            te [54] = IPPROTO_ICMPV6;
+            memcpy (te.data () + 48 + 24, &((const struct sockaddr_in6 *) to)->sin6_addr, 16);
+            memcpy (te.data () + 88, icmp, 8);
+            struct sockaddr_in6 *f6 = (struct sockaddr_in6 *) &from;
+            memset (&f6->sin6_addr, 0, 16);
+            f6->sin6_addr.s6_addr [0] = 0x20; f6->sin6_addr.s6_addr [1] = 0x01; f6->sin6_addr.s6_addr [2] = 0x0d; f6->sin6_addr.s6_addr [3] = 0xb8;
+            f6->sin6_addr.s6_addr [4] = 0xff; f6->sin6_addr.s6_addr [5] = 0xff; f6->sin6_addr.s6_addr [15] = ttl;
+            memcpy (te.data () + 8, &f6->sin6_addr, 16);
+            __icmp6FixChecksum__ (te.data ());
+            __deliver__ (AF_INET6, now + 2 * (__oneWay__ () * ttl / (simnet.hops + 1)), te, from);
+            return size;
+        }
+        if (40 + (int) size > simnet.pathMtu)
+            return size;
+        int64_t at = now + __oneWay__ () + __oneWay__ ();
+        __deliver__ (AF_INET6, at, reply, from);
+        if (__random__ () < simnet.duplicateRate)
+            __deliver__ (AF_INET6, at + __oneWay__ (), reply, from);
+    }
+    return size;
+}
+
+int lwip_sendto (int s, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen) {
+    std::lock_guard<std::mutex> l (__netMutex__);
+    __simSocket__ *k = __sock__ (s);
+    if (!k)
+        return -1;
+    if (k->type == SOCK_DGRAM) {
+        simnet_udp_datagrams++;
+        if (simnet_on_udp)
+            simnet_on_udp (data, size, to);
+        return size;
+    }
+    return __simSend__ (k->ttl, data, size, to);
+}
+
+static bool __readable__ (__simSocket__ *k, int64_t now) { return !k->rx.empty () && k->rx.front ().deliverAt <= now; }
+
+// time of the next packet arrival on any of the sockets in the set (or -1) - must be called with __netMutex__ taken
+static int64_t __nextArrival__ (__simSocket__ *k) { return k->rx.empty () ? -1 : k->rx.front ().deliverAt; }
+
+int lwip_recvfrom (int s, void *mem, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen) {
+    std::unique_lock<std::mutex> l (__netMutex__);
+    __simSocket__ *k = __sock__ (s);
+    if (!k)
+        return -1;
+    int64_t deadline = k->rcvTimeoutMs ? esp_timer_get_time () + 1000LL * k->rcvTimeoutMs : INT64_MAX;
+    while (!__readable__ (k, esp_timer_get_time ())) {
+        int64_t now = esp_timer_get_time ();
+        if (k->nonBlocking || now >= deadline) {
+            errno = EAGAIN;
+            return -1;
+        }
+        int64_t next = __nextArrival__ (k);
+        int64_t until = next >= 0 && next < deadline ? next : deadline;
+        if (until == INT64_MAX)
+            __netCv__.wait (l);
+        else
+            __netCv__.wait_for (l, std::chrono::microseconds (until - now));
+        if (!k->used) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    __simPacket__ p = std::move (k->rx.front ());
+    k->rx.pop_front ();
+    size_t n = p.data.size () < len ? p.data.size () : len;
+    memcpy (mem, p.data.data (), n);
+    if (from && fromlen) {
+        socklen_t fl = p.from.ss_family == AF_INET ? sizeof (struct sockaddr_in) : sizeof (struct sockaddr_in6);
+        if (*fromlen > fl)
+            *fromlen = fl;
+        memcpy (from, &p.from, *fromlen);
+    }
+    return (int) n;
+}
+
+int lwip_select (int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout) {
+    std::unique_lock<std::mutex> l (__netMutex__);
+    int64_t deadline = timeout ? esp_timer_get_time () + timeout->tv_sec * 1000000LL + timeout->tv_usec : INT64_MAX;
+    fd_set in;
+    FD_ZERO (&in);
+    if (readset)
+        in = *readset;
+    while (true) {
+        int64_t now = esp_timer_get_time ();
+        int64_t until = deadline;
+        int ready = 0;
+        if (readset)
+            FD_ZERO (readset);
+        for (int s = LWIP_SOCKET_OFFSET; s < maxfdp1 && s < LWIP_SOCKET_OFFSET + MEMP_NUM_NETCONN; s++)
+            if (FD_ISSET (s, &in)) {
+                __simSocket__ *k = &__sockets__ [s - LWIP_SOCKET_OFFSET];
+                if (!k->used) {
+                    errno = EBADF;
+                    return -1;
+                }
+                if (__readable__ (k, now)) {
+                    FD_SET (s, readset);
+                    ready++;
+                } else {
+                    int64_t next = __nextArrival__ (k);
+                    if (next >= 0 && next < until)
+                        until = next;
+                }
+            }
+        if (writeset)
+            FD_ZERO (writeset);
+        if (exceptset)
+            FD_ZERO (exceptset);
+        if (ready || now >= deadline)
+            return ready;
+        if (until == INT64_MAX)
+            __netCv__.wait (l);
+        else
+            __netCv__.wait_for (l, std::chrono::microseconds (until - now));
+    }
+}
+
+const char *lwip_inet_ntop (int af, const void *src, char *dst, socklen_t size) {
+    const uint8_t *b = (const uint8_t *) src;
+    if (af == AF_INET)
+        snprintf (dst, size, "%u.%u.%u.%u", b [0], b [1], b [2], b [3]);
+    else {
+        // no :: compression, good enough for the simulation
+        int n = 0;
+        for (int i = 0; i < 16 && n < (int) size; i += 2)
+            n += snprintf (dst + n, size - n, i ? ":%x" : "%x", (b [i] << 8) | b [i + 1]);
+    }
+    return dst;
+}
+
+int lwip_inet_pton (int af, const char *src, void *dst) {
+    uint8_t *b = (uint8_t *) dst;
+    if (af == AF_INET) {
+        unsigned a [4];
+        char c;
+        if (sscanf (src, "%u.%u.%u.%u%c", &a [0], &a [1], &a [2], &a [3], &c) != 4)
+            return 0;
+        for (int i = 0; i < 4; i++) {
+            if (a [i] > 255)
+                return 0;
+            b [i] = a [i];
+        }
+        return 1;
+    }
+    // IPv6: full form or with a single ::
+    uint16_t head [8], tail [8];
+    int nh = 0, nt = 0;
+    bool compressed = false;
+    const char *p = src;
+    if (!*p)
+        return 0;
+    while (*p) {
+        if (p [0] == ':' && p [1] == ':') {
+            if (compressed)
+                return 0;
+            compressed = true;
+            p += 2;
+            continue;
+        }
+        if (*p == ':') {
+            p++;
+            continue;
+        }
+        char *e;
+        unsigned long v = strtoul (p, &e, 16);
+        if (e == p || v > 0xffff)
+            return 0;
+        if (compressed) {
+            if (nt == 8) return 0;
+            tail [nt++] = v;
+        } else {
+            if (nh == 8) return 0;
+            head [nh++] = v;
+        }
+        p = e;
+    }
+    if (nh + nt > 8 || (!compressed && nh != 8))
+        return 0;
+    uint16_t w [8] = {};
+    for (int i = 0; i < nh; i++)
+        w [i] = head [i];
+    for (int i = 0; i < nt; i++)
+        w [8 - nt + i] = tail [i];
+    for (int i = 0; i < 8; i++) {
+        b [2 * i] = w [i] >> 8;
+        b [2 * i + 1] = w [i] & 0xff;
+    }
+    return 1;
+}
+
+// numeric addresses resolve to themselves, "v6.<anything>" to an IPv6 address, "dual.<anything>" to both, "nx.<anything>" does not exist, anything else to 10.0.1.<hash>
+int lwip_getaddrinfo (const char *nodename, const char *servname, const struct addrinfo *hints, struct addrinfo **res) {
+    struct in_addr a4;
+    struct in6_addr a6;
+    bool has4 = false, has6 = false;
+    if (lwip_inet_pton (AF_INET, nodename, &a4))
+        has4 = true;
+    else if (lwip_inet_pton (AF_INET6, nodename, &a6))
+        has6 = true;
+    else if (!strncmp (nodename, "nx.", 3))
+        return EAI_NONAME;
+    else {
+        uint32_t h = 5381;
+        for (const char *p = nodename; *p; p++)
+            h = h * 33 + *p;
+        uint8_t *b = (uint8_t *) &a4.s_addr;
+        b [0] = 10; b [1] = 0; b [2] = 1; b [3] = 1 + h % 150;
+        memset (&a6, 0, sizeof (a6));
+        a6.s6_addr [0] = 0x20; a6.s6_addr [1] = 0x01; a6.s6_addr [2] = 0x0d; a6.s6_addr [3] = 0xb8; a6.s6_addr [15] = b [3];
+        has6 = !strncmp (nodename, "v6.", 3) || !strncmp (nodename, "dual.", 5);
+        has4 = strncmp (nodename, "v6.", 3);
+    }
+    delayMicroseconds (3000);  // DNS round trip
+    int family = hints ? hints->ai_family : AF_UNSPEC;
+    struct addrinfo *first = NULL, **last = &first;
+    auto add = [&] (int af, const void *addr) {
+        struct addrinfo *ai = (struct addrinfo *) calloc (1, sizeof (struct addrinfo) + sizeof (struct sockaddr_in6));
+        ai->ai_family = af;
+        ai->ai_socktype = hints ? hints->ai_socktype : 0;
+        ai->ai_addr = (struct sockaddr *) (ai + 1);
+        if (af == AF_INET) {
+            struct sockaddr_in *s = (struct sockaddr_in *) ai->ai_addr;
+            s->sin_len = sizeof (*s);
+            s->sin_family = AF_INET;
+            memcpy (&s->sin_addr, addr, 4);
+            ai->ai_addrlen = sizeof (*s);
+        } else {
+            struct sockaddr_in6 *s = (struct sockaddr_in6 *) ai->ai_addr;
+            s->sin6_len = sizeof (*s);
+            s->sin6_family = AF_INET6;
+            memcpy (&s->sin6_addr, addr, 16);
+            ai->ai_addrlen = sizeof (*s);
+        }
+        *last = ai;
+        last = &ai->ai_next;
+    };
+    if (has4 && (family == AF_UNSPEC || family == AF_INET))
+        add (AF_INET, &a4);
+    if (has6 && (family == AF_UNSPEC || family == AF_INET6))
+        add (AF_INET6, &a6);
+    if (!first)
+        return EAI_NONAME;
+    *res = first;
+    return 0;
+}
+
+void lwip_freeaddrinfo (struct addrinfo *ai) {
+    while (ai) {
+        struct addrinfo *n = ai->ai_next;
+        free (ai);
+        ai = n;
+    }
+}
+
+
+// ----- lwIP raw API and the tcpip thread -----
+
+struct pbuf *pbuf_alloc (pbuf_layer layer, u16_t length, pbuf_type type) {
+    struct pbuf *p = (struct pbuf *) malloc (sizeof (struct pbuf) + length);
+    if (!p)
+        return NULL;
+    p->next = NULL;
+    p->payload = p + 1;
+    p->tot_len = p->len = length;
+    return p;
+}
+
+u8_t pbuf_free (struct pbuf *p) {
+    while (p) {
+        struct pbuf *next = p->next;
+        free (p);
+        p = next;
+    }
+    return 1;
+}
+
+err_t pbuf_take (struct pbuf *buf, const void *dataptr, u16_t len) {
+    if (len > buf->tot_len)
+        return ERR_MEM;
+    memcpy (buf->payload, dataptr, len);
+    return ERR_OK;
+}
+
+u16_t pbuf_copy_partial (const struct pbuf *p, void *dataptr, u16_t len, u16_t offset) {
+    u16_t copied = 0;
+    for (; p && copied < len; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        u16_t n = p->len - offset < len - copied ? p->len - offset : len - copied;
+        memcpy ((uint8_t *) dataptr + copied, (const uint8_t *) p->payload + offset, n);
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}
+
+// an incoming packet as a chain of two pbufs, split at an odd offset inside the payload like a reassembled packet, so that the code that walks pbuf chains gets exercised
+static struct pbuf *__pbufChain__ (const std::vector<uint8_t> &data) {
+    u16_t first = data.size () > 67 ? 67 : data.size ();
+    struct pbuf *p = pbuf_alloc (PBUF_IP, first, PBUF_RAM);
+    memcpy (p->payload, data.data (), first);
+    p->tot_len = data.size ();
+    if (first < data.size ()) {
+        p->next = pbuf_alloc (PBUF_IP, data.size () - first, PBUF_RAM);
+        memcpy (p->next->payload, data.data () + first, data.size () - first);
+    }
+    return p;
+}
+
+struct raw_pcb *raw_new_ip_type (u8_t type, u8_t proto) {
+    struct raw_pcb *pcb = new raw_pcb ();
+    pcb->type = type;
+    pcb->protocol = proto;
+    std::lock_guard<std::mutex> l (__netMutex__);
+    __rawPcbs__.push_back (pcb);
+    return pcb;
+}
+
+struct raw_pcb *raw_new (u8_t proto) { return raw_new_ip_type (IPADDR_TYPE_V4, proto); }
+
+void raw_remove (struct raw_pcb *pcb) {
+    std::lock_guard<std::mutex> l (__netMutex__);
+    for (auto it = __rawPcbs__.begin (); it != __rawPcbs__.end (); it++)
+        if (*it == pcb) {
+            __rawPcbs__.erase (it);
+            break;
+        }
+    delete pcb;
+}
+
+void raw_recv (struct raw_pcb *pcb, raw_recv_fn recv, void *recv_arg) {
+    pcb->recv = recv;
+    pcb->recv_arg = recv_arg;
+}
+
+err_t raw_sendto (struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *ipaddr) {
+    struct sockaddr_storage to = {};
+    if (ipaddr->type == IPADDR_TYPE_V6) {
+        to.ss_family = AF_INET6;
+        memcpy (&((struct sockaddr_in6 *) &to)->sin6_addr, ipaddr->u_addr.ip6.addr, 16);
+    } else {
+        to.ss_family = AF_INET;
+        ((struct sockaddr_in *) &to)->sin_addr.s_addr = ipaddr->u_addr.ip4.addr;
+    }
+    std::vector<uint8_t> data ((uint8_t *) p->payload, (uint8_t *) p->payload + p->len);
+    if (pcb->chksum_reqd)
+        __icmpFixChecksum__ (data.data (), data.size ()); // the simulated network doesn't use the pseudo header
+    std::lock_guard<std::mutex> l (__netMutex__);
+    return __simSend__ (64, data.data (), data.size (), (struct sockaddr *) &to) < 0 ? ERR_VAL : ERR_OK;
+}
+
+err_t tcpip_callback (tcpip_callback_fn function, void *ctx) {
+    __startTcpipThread__ ();
+    std::lock_guard<std::mutex> l (__netMutex__);
+    __tcpipCalls__.push_back ({ function, ctx });
+    __tcpipCv__.notify_all ();
+    return ERR_OK;
+}
+
+err_t tcpip_api_call (tcpip_api_call_fn fn, struct tcpip_api_call_data *call) {
+    struct context_t {
+        tcpip_api_call_fn fn;
+        struct tcpip_api_call_data *call;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done;
+    } context { fn, call, {}, {}, false };
+
+    tcpip_callback ([] (void *arg) {
+                        context_t *c = (context_t *) arg;
+                        c->call->err = c->fn (c->call);
+                        std::lock_guard<std::mutex> l (c->mutex);
+                        c->done = true;
+                        c->cv.notify_one ();
+                    }, &context);
+    std::unique_lock<std::mutex> l (context.mutex);
+    context.cv.wait (l, [&] { return context.done; });
+    return call->err;
+}
+
+// runs tcpip_callback functions and hands the arriving packets to the raw_pcbs, like lwIP's tcpip thread
+static void __tcpipThread__ () {
+    std::unique_lock<std::mutex> l (__netMutex__);
+    while (true) {
+        int64_t now = esp_timer_get_time ();
+        if (!__tcpipCalls__.empty ()) {
+            auto call = __tcpipCalls__.front ();
+            __tcpipCalls__.pop_front ();
+            l.unlock ();
+            call.first (call.second);
+            l.lock ();
+        } else if (!__rawPending__.empty () && __rawPending__.begin ()->first <= now) {
+            int family = __rawPending__.begin ()->second.first;
+            __simPacket__ packet = std::move (__rawPending__.begin ()->second.second);
+            __rawPending__.erase (__rawPending__.begin ());
+            std::vector<struct raw_pcb *> pcbs = __rawPcbs__;
+            l.unlock ();
+            ip_addr_t from = {};
+            bool eaten = false;
+            for (auto pcb : pcbs)
+                if ((pcb->type == IPADDR_TYPE_V6) == (family == AF_INET6) && pcb->recv) {
+                    struct pbuf *p = __pbufChain__ (packet.data);
+                    if ((pcb->recv) (pcb->recv_arg, pcb, p, &from)) {
+                        eaten = true;
+                        break;
+                    }
+                    pbuf_free (p);
+                }
+            l.lock ();
+            if (!eaten)
+                __deliverToSockets__ (family, packet.deliverAt, packet.data, packet.from);
+        } else if (!__rawPending__.empty ()) {
+            __tcpipCv__.wait_for (l, std::chrono::microseconds (__rawPending__.begin ()->first - now));
+        } else {
+            __tcpipCv__.wait (l);
+        }
+    }
+}
+
+static void __startTcpipThread__ () {
+    static std::once_flag once;
+    std::call_once (once, [] { std::thread (__tcpipThread__).detach (); });
+}
+
+
+// ----- configuration of the simulated network from the environment -----
+
+static void __envFloat__ (const char *name, float *value) { const char *s = getenv (name); if (s) *value = atof (s); }
+static void __envUint__ (const char *name, uint32_t *value) { const char *s = getenv (name); if (s) *value = strtoul (s, NULL, 10); }
+
+void simnet_from_env () {
+    __envUint__ ("SIMNET_DELAY", &simnet.delayMicros);
+    __envUint__ ("SIMNET_JITTER", &simnet.jitterMicros);
+    __envFloat__ ("SIMNET_LOSS", &simnet.lossRate);
+    __envFloat__ ("SIMNET_DUPLICATE", &simnet.duplicateRate);
+    __envFloat__ ("SIMNET_CORRUPT", &simnet.corruptRate);
+}
@@ -0,0 +1,33 @@
+/*
+    simnet.h - host shim, knobs of the simulated network behind the lwIP socket shim
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct sockaddr;
+
+struct simnet_config_t {
+    uint32_t delayMicros = 2000;     // one-way delay of each packet
+    uint32_t jitterMicros = 500;     // uniformly distributed additional one-way delay, reorders the replies when it is larger than the gap between echo requests
+    float lossRate = 0.0f;           // probability that an echo request or reply gets lost
+    float duplicateRate = 0.0f;      // probability that a reply is delivered twice
+    float corruptRate = 0.0f;        // probability that a reply payload gets a flipped bit
+    int   hops = 5;                  // number of routers between us and any target (for TTL)
+    int   pathMtu = 1500;            // larger packets do not get through (their fragments get dropped)
+    uint8_t deadFrom = 200;          // IPv4 hosts x.x.x.deadFrom and above do not answer
+};
+
+extern simnet_config_t simnet;
+
+extern int simnet_bad_checksums;
+extern int simnet_sockets_created;
+
+// UDP datagrams are not simulated, they are only counted and handed to simnet_on_udp, if it is set
+extern int simnet_udp_datagrams;
+extern void (*simnet_on_udp) (const void *data, size_t size, const struct sockaddr *to);
+
+// overrides the defaults with SIMNET_DELAY, SIMNET_JITTER (us), SIMNET_LOSS, SIMNET_DUPLICATE and SIMNET_CORRUPT (0 - 1) environment variables
+void simnet_from_env ();
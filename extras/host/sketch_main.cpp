@@ -0,0 +1,31 @@
+/*
+    sketch_main.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Runs an Arduino sketch on the host: setup () once and loop () LOOPS times. The Makefile passes the sketch path as SKETCH.
+
+*/
+
+
+#include SKETCH
+#include "simnet.h"
+
+extern "C" void _exit (int); // <unistd.h> would clash with the close () of the lwIP socket shim
+
+#ifndef LOOPS
+    #define LOOPS 0
+#endif
+
+
+int main () {
+    simnet_from_env ();
+
+    setup ();
+    for (int i = 0; i < LOOPS; i++)
+        loop ();
+
+    // the tasks the sketch has started may still be running, don't wait for them
+    fflush (stdout);
+    _exit (0);
+}
@@ -0,0 +1,275 @@
+/*
+    ThreadSafeMultiPing.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafeMultiPing.h"
+#include <new>
+
+
+ThreadSafeMultiPing_t::ThreadSafeMultiPing_t (int maxTargets) {
+    __targets__ = new (std::nothrow) ThreadSafePingStatistics_t [maxTargets];
+    __probes__ = new (std::nothrow) ThreadSafePing_t::__pingReply_t__ [maxTargets];
+    if (!__targets__ || !__probes__) {
+        __errText__ = "out of memory";
+        return;
+    }
+    __maxTargets__ = maxTargets;
+}
+
+ThreadSafeMultiPing_t::~ThreadSafeMultiPing_t () {
+    delete [] __targets__;
+    delete [] __probes__;
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafeMultiPing_t::addTarget (const char *pingTarget, int family) {
+    if (!__targets__ || !__probes__)
+        return "out of memory"; // the constructor couldn't allocate them
+    if (__targetCount__ >= __maxTargets__)
+        return "too many targets";
+    const char *e = __targets__ [__targetCount__].__resolveTargetName__ (pingTarget, family);
+    __targets__ [__targetCount__].__errText__ = e;
+    if (e)
+        return e;
+    __targetCount__++;
+    return NULL; // OK
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafeMultiPing_t::addTarget (const IPAddress& pingTarget) {
+    char s [INET_ADDRSTRLEN];
+    snprintf (s, sizeof (s), "%u.%u.%u.%u", pingTarget [0], pingTarget [1], pingTarget [2], pingTarget [3]);
+    return addTarget (s);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafeMultiPing_t::ping (int count, int interval, int size, int timeout) {
+    // check argument values given in seconds
+    if (interval < 1 || interval > 3600) return "invalid value";
+    if (timeout < 1 || timeout > 30) return "invalid value";
+
+    ThreadSafePingOptions_t options;
+    options.count = count;
+    options.intervalMicros = 1000000UL * interval;
+    options.size = size;
+    options.timeoutMicros = 1000000UL * timeout;
+    return ping (options);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafeMultiPing_t::ping (const ThreadSafePingOptions_t& options) {
+    if (!WiFi.isConnected () || WiFi.localIP () == IPAddress (0, 0, 0, 0))
+        return "not connected";
+
+    int count = options.count;
+    unsigned long intervalMicros = options.intervalMicros;
+    int size = options.size;
+    unsigned long timeoutMicros = options.timeoutMicros;
+
+    // check argument values
+    if (count < 0) return "invalid value";
+    if (intervalMicros < 1000 || intervalMicros > 3600000000UL) return "invalid value";
+    if (size < 4 || size > PING_STACK_MAX_SIZE) return "invalid value";
+    if (timeoutMicros < 1000 || timeoutMicros > intervalMicros) return "invalid value";
+    if (options.onWaitMicros && (options.onWaitMicros < 1000 || options.onWaitMicros > 3600000000UL)) return "invalid value";
+    if (options.verify) return "invalid value"; // the replies are not verified, so don't pretend they are
+    if (!__targetCount__) return "no targets";
+    for (int i = 0; i < __targetCount__; i++)
+        if (__targets__ [i].__monitor__ && __targets__ [i].__monitor__->errText ()) return "out of memory"; // its mutex couldn't be created
+
+    // initialize measuring variables
+    bool needIPv4 = false, needIPv6 = false;
+    for (int i = 0; i < __targetCount__; i++) {
+        __targets__ [i].__resetStatistics__ (size);
+        __probes__ [i] = {};
+        if (__targets__ [i].__isIPv6__) needIPv6 = true; else needIPv4 = true;
+    }
+    __stopped__ = false;
+    __errText__ = NULL;
+
+    // payloads of 4 - 7 bytes are padded to hold the 64-bit time stamp, like ThreadSafePing_t does, the replies are reported with the requested size
+    __padding__ = ThreadSafePing_t::__paddingOf__ (size);
+    size += __padding__;
+
+    // take one socket per address family from the pool (or create them)
+    int sockfdIPv4 = -1, sockfdIPv6 = -1;
+    if (needIPv4)
+        sockfdIPv4 = ThreadSafePing_t::__takeSocket__ (false, &__errText__);
+    if (needIPv6 && !__errText__)
+        sockfdIPv6 = ThreadSafePing_t::__takeSocket__ (true, &__errText__);
+    if (__errText__) {
+        if (sockfdIPv4 >= 0) ThreadSafePing_t::__releaseSocket__ (sockfdIPv4, false);
+        return __errText__;
+    }
+
+    // the sockets may have been used by single-target pings before, make sure their echo requests in flight are forgotten
+    for (int i = 0; i < PING_MAX_WINDOW; i++) {
+        if (sockfdIPv4 >= 0) ThreadSafePing_t::__slotClear__ (&ThreadSafePing_t::__getPingReplies__ () [sockfdIPv4 - LWIP_SOCKET_OFFSET][i]);
+        if (sockfdIPv6 >= 0) ThreadSafePing_t::__slotClear__ (&ThreadSafePing_t::__getPingReplies__ () [sockfdIPv6 - LWIP_SOCKET_OFFSET][i]);
+    }
+
+    // build the echo requests only once, one template per socket
+    uint32_t packetIPv4 [(sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE + 3) / 4];
+    if (sockfdIPv4 >= 0) ThreadSafePing_t::__buildPacket__ ((char *) packetIPv4, false, sockfdIPv4, size);
+    #if PING_IPV6
+        uint32_t packetIPv6 [(sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE + 3) / 4];
+        if (sockfdIPv6 >= 0) ThreadSafePing_t::__buildPacket__ ((char *) packetIPv6, true, sockfdIPv6, size);
+    #endif
+
+    // begin ping ...
+    //  - each round sends one echo request to each of the targets and all the echo requests of the round carry the sequence number of the round
+    //  - the reply is matched against the target by the address it comes from
+    uint32_t rounds = 0;
+    unsigned long dueMicros = micros (); // when the next round is due
+    unsigned long lastWaitMicros = micros (); // when onWait () has been called the last time
+
+    while (!__stopped__) {
+        bool moreRounds = count == 0 || rounds < (uint32_t) count;
+
+        // start the next round if it is due
+        if (moreRounds && (long) (micros () - dueMicros) >= 0) {
+            dueMicros = micros () - dueMicros < intervalMicros ? dueMicros + intervalMicros : micros () + intervalMicros;
+            rounds++;
+
+            for (int i = 0; i < __targetCount__ && !__stopped__; i++) {
+                ThreadSafePingStatistics_t *t = &__targets__ [i];
+
+                // the previous echo request is still in flight (timeout == interval), it can't be answered any more
+                if (!ThreadSafePing_t::__slotReported__ (__probes__ [i].state)) {
+                    t->__countLoss__ (rounds - 1, __probes__ [i].sent_time);
+                    __probes__ [i].bytes = -1;
+                    __report__ (i, rounds - 1);
+                }
+
+                ThreadSafePing_t::__harvestSlot__ (t, &__probes__ [i], __padding__); // count the duplicates and the late reply of the previous round
+                ThreadSafePing_t::__slotSend__ (&__probes__ [i], (uint16_t) rounds);
+                t->__sent__++;
+                #if PING_IPV6
+                    if (t->__isIPv6__)
+                        t->__errText__ = ThreadSafePing_t::__ping_send__ (t, sockfdIPv6, (char *) packetIPv6, (uint16_t) rounds, size);
+                    else
+                #endif
+                t->__errText__ = ThreadSafePing_t::__ping_send__ (t, sockfdIPv4, (char *) packetIPv4, (uint16_t) rounds, size);
+                if (t->__errText__) {
+                    t->__countLoss__ (rounds, __probes__ [i].sent_time);
+                    __probes__ [i].bytes = -1;
+                    ThreadSafePing_t::__slotClear__ (&__probes__ [i]);
+                    __report__ (i, rounds);
+                }
+            }
+        }
+
+        // pick up all the replies that are waiting
+        if (sockfdIPv4 >= 0) __receive__ (sockfdIPv4, false);
+        if (sockfdIPv6 >= 0) __receive__ (sockfdIPv6, true);
+
+        // report the replies that have arrived and the echo requests that have timed out meanwhile
+        bool inFlight = false;
+        unsigned long waitMicros = intervalMicros; // the next round is due by then anyway
+        for (int i = 0; i < __targetCount__; i++) {
+            // the probes are accessed only by this task, no other task can be writing into them
+            uint32_t state = ThreadSafePing_t::__slotStateOf__ (__probes__ [i].state);
+            if (ThreadSafePing_t::__slotReported__ (state))
+                continue;
+
+            unsigned long waitingMicros = ThreadSafePing_t::__nowMicros__ () - __probes__ [i].sent_time;
+            if (state == ThreadSafePing_t::__SLOT_ARRIVED__) {
+                __probes__ [i].bytes -= __padding__;
+                __targets__ [i].__countReply__ (rounds, __probes__ [i].sent_time, __probes__ [i].elapsed_time, __probes__ [i].bytes);
+                __probes__ [i].state = ThreadSafePing_t::__slotWord__ ((uint16_t) rounds, ThreadSafePing_t::__SLOT_REPORTED__);
+            } else if (waitingMicros >= timeoutMicros) {
+                __targets__ [i].__countLoss__ (rounds, __probes__ [i].sent_time);
+                __probes__ [i].bytes = -1;
+                __probes__ [i].state = ThreadSafePing_t::__slotWord__ ((uint16_t) rounds, ThreadSafePing_t::__SLOT_EXPIRED__);
+            } else {
+                inFlight = true;
+                if (waitMicros > timeoutMicros - waitingMicros) waitMicros = timeoutMicros - waitingMicros;
+                continue; // still waiting
+            }
+            __report__ (i, rounds);
+        }
+
+        if (!moreRounds && !inFlight)
+            break; // finished
+
+        // report waiting each onWaitMicros
+        if (options.onWaitMicros) {
+            if (micros () - lastWaitMicros >= options.onWaitMicros) {
+                lastWaitMicros = micros ();
+                onWait ();
+            }
+            unsigned long sinceMicros = micros () - lastWaitMicros;
+            unsigned long untilWaitMicros = sinceMicros < options.onWaitMicros ? options.onWaitMicros - sinceMicros : 0;
+            if (waitMicros > untilWaitMicros) waitMicros = untilWaitMicros;
+        }
+
+        // sleep until a reply arrives, the next echo request times out, the next round is due or waiting should be reported again
+        if (moreRounds) {
+            long untilRoundMicros = (long) (dueMicros - micros ());
+            if (untilRoundMicros < 0) untilRoundMicros = 0;
+            if (waitMicros > (unsigned long) untilRoundMicros) waitMicros = untilRoundMicros;
+        }
+        ThreadSafePing_t::__waitForPacket__ (sockfdIPv4, sockfdIPv6, waitMicros);
+    }
+
+    // count the duplicates and the late replies that have arrived so far
+    for (int i = 0; i < __targetCount__; i++)
+        ThreadSafePing_t::__harvestSlot__ (&__targets__ [i], &__probes__ [i], __padding__);
+
+    if (sockfdIPv4 >= 0) ThreadSafePing_t::__releaseSocket__ (sockfdIPv4, false);
+    if (sockfdIPv6 >= 0) ThreadSafePing_t::__releaseSocket__ (sockfdIPv6, true);
+    return NULL; // OK
+}
+
+// reads all the packets waiting on the socket and writes the replies into the per-target slots
+void ThreadSafeMultiPing_t::__receive__ (int sockfd, bool isIPv6) {
+    char buf [60 + sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE]; // the longest IPv4 header, longer replies of other sessions get truncated, but their length is still known
+    ThreadSafePing_t::__drainSocket__ (sockfd, isIPv6, buf, sizeof (buf), sockfd, 1, NULL,
+                                       [] (void *context, const ThreadSafePing_t::__packet_t__ *packet) {
+                                           return ((ThreadSafeMultiPing_t *) context)->__match__ (packet);
+                                       }, this);
+}
+
+// writes an echo reply to one of our echo requests into its target's slot, or counts it as duplicate or late
+bool ThreadSafeMultiPing_t::__match__ (const ThreadSafePing_t::__packet_t__ *packet) {
+    if (!packet->isEcho)
+        return false;
+
+    // find the target by the address the reply comes from, the same target may appear more than once, so prefer the one still waiting for this reply
+    int target = -1;
+    for (int i = 0; i < __targetCount__; i++) {
+        ThreadSafePingStatistics_t *t = &__targets__ [i];
+        if (t->__isIPv6__ != packet->isIPv6)
+            continue;
+        #if PING_IPV6
+            if (packet->isIPv6 ? memcmp (&t->__target_addr_IPv6__.sin6_addr, &((const struct sockaddr_in6 *) packet->from)->sin6_addr, sizeof (t->__target_addr_IPv6__.sin6_addr))
+                               : t->__target_addr_IPv4__.sin_addr.s_addr != ((const struct sockaddr_in *) packet->from)->sin_addr.s_addr)
+                continue;
+        #else
+            if (t->__target_addr_IPv4__.sin_addr.s_addr != ((const struct sockaddr_in *) packet->from)->sin_addr.s_addr)
+                continue;
+        #endif
+
+        if (target < 0)
+            target = i;
+        if (__probes__ [i].state == ThreadSafePing_t::__slotWord__ (packet->seqno, ThreadSafePing_t::__SLOT_PENDING__)) {
+            target = i;
+            break;
+        }
+    }
+    // record the reply, or count it as duplicate or late
+    if (target < 0 || ThreadSafePing_t::__slotRecord__ (&__probes__ [target], packet->seqno, packet->sentMicros, packet->receivedMicros - packet->sentMicros, packet->bytes, true) == ThreadSafePing_t::__REPLY_STALE__)
+        ThreadSafePing_t::__count__ (target < 0 ? NULL : &__targets__ [target].__counters__, &ThreadSafePingCounters_t::stale);
+    return true;
+}
+
+void ThreadSafeMultiPing_t::__report__ (int target, uint32_t seqno) {
+    __targets__ [target].__seqno__ = seqno;
+
+    // report intermediate results
+    onReceive (target, __probes__ [target].bytes);
+}
@@ -0,0 +1,68 @@
+/*
+    ThreadSafeMultiPing.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Pings many targets round-robin (fping-style) from a single task through a single raw socket per address family,
+    instead of running a task and opening a socket for each target. Replies are demultiplexed by the sequence number
+    and the address they come from, statistics are kept for each target separately.
+
+*/
+
+
+#ifndef __ThreadSafeMultiPing_H__
+    #define __ThreadSafeMultiPing_H__
+
+
+    #include "ThreadSafePing.h"
+
+
+    #ifndef PING_MULTI_DEFAULT_MAX_TARGETS
+        #define PING_MULTI_DEFAULT_MAX_TARGETS 64
+    #endif
+
+
+    class ThreadSafeMultiPing_t {
+
+        private:
+            ThreadSafePingStatistics_t *__targets__ = nullptr;          // per-target address and statistics
+            ThreadSafePing_t::__pingReply_t__ *__probes__ = nullptr;    // per-target echo request in flight
+            int __maxTargets__ = 0;
+            int __targetCount__ = 0;
+            int __padding__;                                            // bytes added to payloads too short for the time stamp, not reported
+
+            const char *__errText__ = nullptr;
+            bool __stopped__;
+
+            void __receive__ (int sockfd, bool isIPv6);
+            bool __match__ (const ThreadSafePing_t::__packet_t__ *packet);
+            void __report__ (int target, uint32_t seqno);
+
+        public:
+            ThreadSafeMultiPing_t (int maxTargets = PING_MULTI_DEFAULT_MAX_TARGETS);
+            virtual ~ThreadSafeMultiPing_t (); // subclasses override onReceive () and onWait ()
+
+            // returns error text or NULL if OK
+            const char *addTarget (const char *pingTarget, int family = AF_UNSPEC); // AF_INET or AF_INET6 picks the address of that family of a dual-stack host
+            const char *addTarget (const IPAddress& pingTarget);
+            inline void clearTargets () { __targetCount__ = 0; }
+
+            // each interval one echo request is sent to each of the targets, timeout must not be longer than interval
+            const char *ping (int count = PING_DEFAULT_COUNT,
+                              int interval = PING_DEFAULT_INTERVAL,
+                              int size = PING_DEFAULT_SIZE,
+                              int timeout = PING_DEFAULT_TIMEOUT);
+            const char *ping (const ThreadSafePingOptions_t& options); // window and mode are not used, verify is not supported (invalid value)
+
+            inline void stop () { __stopped__ = true; }
+
+            inline int targets () { return __targetCount__; }
+            inline ThreadSafePingStatistics_t& operator [] (int target) { return __targets__ [target]; } // target address and statistics: target (), sent (), received (), mean_time (), ...
+
+            inline const char *errText () { return __errText__; }
+
+            virtual void onReceive (int target, int bytes) {}
+            virtual void onWait () {}
+    };
+
+#endif
@@ -21,8 +21,11 @@
 
 
 #include "ThreadSafePing.h"
+#include "ThreadSafePingDispatcher.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/select.h>
+#include <new>
 
 
 // constructor with specified target (the one without target specified is in ThreadSafePing_t.h)
@@ -36,32 +39,185 @@ ThreadSafePing_t::ThreadSafePing_t (const IPAddress& pingTarget) {
     __errText__ = __resolveTargetName__ (__pingTargetIp__);
 }
 
-// returns error text or NULL if OK
-const char *ThreadSafePing_t::__resolveTargetName__ (const char *pingTarget) {
+// DNS cache, shared by all the instances: the resolved address (or the failure) of a name is kept for PING_DNS_CACHE_TTL (or PING_DNS_CACHE_NEGATIVE_TTL) seconds
+#if PING_DNS_CACHE_SIZE > 0
+
+    struct __dnsCacheEntry_t__ {
+        char name [PING_DNS_CACHE_NAME_LENGTH];     // "" = free entry
+        int family;                                 // the address family asked for: AF_UNSPEC, AF_INET or AF_INET6
+        bool isIPv6;
+        char ip [PING_ADDRSTRLEN];
+        const char *errText;                        // != NULL for names that could not be resolved
+        int64_t expiresMicros;                      // esp_timer_get_time () time base, it doesn't wrap around like millis () does after ~49 days
+    };
+
+    static __dnsCacheEntry_t__ __dnsCache__ [PING_DNS_CACHE_SIZE] = {};
+
+    // singleton mutex, it only guards the cache, so cache look-ups don't have to wait for the lwIP mutex
+    static SemaphoreHandle_t __getDnsCacheMutex__ () {
+        static SemaphoreHandle_t semaphore = xSemaphoreCreateMutex ();
+        return semaphore;
+    }
+
+    static bool __dnsCacheEntryValid__ (const __dnsCacheEntry_t__ *entry) {
+        return *entry->name && esp_timer_get_time () < entry->expiresMicros;
+    }
+
+    // returns true and copies the entry if name (asked for the address family) is found in the cache, isIPv6 and ip are left as they are for a cached failure
+    static bool __dnsCacheLookup__ (const char *name, int family, bool *isIPv6, char *ip, const char **errText) {
+        bool found = false;
+        xSemaphoreTake (__getDnsCacheMutex__ (), portMAX_DELAY);
+            for (int i = 0; i < PING_DNS_CACHE_SIZE; i++)
+                if (__dnsCacheEntryValid__ (&__dnsCache__ [i]) && __dnsCache__ [i].family == family && !strcmp (__dnsCache__ [i].name, name)) {
+                    *errText = __dnsCache__ [i].errText;
+                    if (!*errText) {
+                        *isIPv6 = __dnsCache__ [i].isIPv6;
+                        strcpy (ip, __dnsCache__ [i].ip);
+                    }
+                    found = true;
+                    break;
+                }
+        xSemaphoreGive (__getDnsCacheMutex__ ());
+        return found;
+    }
+
+    // stores the entry over the same name and family, a free or an expired entry or else over the one that expires first
+    static void __dnsCacheStore__ (const char *name, int family, bool isIPv6, const char *ip, const char *errText) {
+        if (strlen (name) >= PING_DNS_CACHE_NAME_LENGTH)
+            return; // too long to be cached
+        xSemaphoreTake (__getDnsCacheMutex__ (), portMAX_DELAY);
+            int e = 0;
+            for (int i = 0; i < PING_DNS_CACHE_SIZE; i++) {
+                if ((__dnsCache__ [i].family == family && !strcmp (__dnsCache__ [i].name, name)) || !__dnsCacheEntryValid__ (&__dnsCache__ [i])) {
+                    e = i;
+                    break;
+                }
+                if (__dnsCache__ [i].expiresMicros < __dnsCache__ [e].expiresMicros)
+                    e = i;
+            }
+            strcpy (__dnsCache__ [e].name, name);
+            __dnsCache__ [e].family = family;
+            __dnsCache__ [e].isIPv6 = isIPv6;
+            strcpy (__dnsCache__ [e].ip, ip);
+            __dnsCache__ [e].errText = errText;
+            __dnsCache__ [e].expiresMicros = esp_timer_get_time () + 1000000LL * (errText ? PING_DNS_CACHE_NEGATIVE_TTL : PING_DNS_CACHE_TTL);
+        xSemaphoreGive (__getDnsCacheMutex__ ());
+    }
+
+#endif
+
+void ThreadSafePingStatistics_t::clearDnsCache () {
+    #if PING_DNS_CACHE_SIZE > 0
+        xSemaphoreTake (__getDnsCacheMutex__ (), portMAX_DELAY);
+            for (int i = 0; i < PING_DNS_CACHE_SIZE; i++)
+                *__dnsCache__ [i].name = 0;
+        xSemaphoreGive (__getDnsCacheMutex__ ());
+    #endif
+}
+
+// resolves pingTarget to an address of the family (AF_INET, AF_INET6 or AF_UNSPEC for any), returns error text or NULL if OK
+const char *ThreadSafePingStatistics_t::__resolveTargetName__ (const char *pingTarget, int family) {
     if (!WiFi.isConnected () || WiFi.localIP () == IPAddress (0, 0, 0, 0)) // esp32 can crash without this check
         return "not connected";
+    if (family != AF_UNSPEC && family != AF_INET && family != AF_INET6)
+        return "invalid value";
+    #if !PING_IPV6
+        if (family == AF_INET6)
+            return "IPv6 not supported"; // compiled out with PING_IPV6 0
+    #endif
+
+    // numeric addresses don't need to be resolved
+    struct in6_addr addr; // large enough for IPv4 address as well
+    if (inet_pton (AF_INET, pingTarget, &addr) > 0) {
+        if (family == AF_INET6)
+            return "no address of this family";
+        #if PING_IPV6
+            __isIPv6__ = false;
+        #endif
+        inet_ntop (AF_INET, &addr, __pingTargetIp__, sizeof (__pingTargetIp__));
+    } else if (inet_pton (AF_INET6, pingTarget, &addr) > 0) {
+        if (family == AF_INET)
+            return "no address of this family";
+        #if PING_IPV6
+            __isIPv6__ = true;
+            inet_ntop (AF_INET6, &addr, __pingTargetIp__, sizeof (__pingTargetIp__));
+        #else
+            return "IPv6 not supported"; // compiled out with PING_IPV6 0
+        #endif
+    } else {
+        const char *errText = __resolveByDns__ (pingTarget, family);
+        if (errText)
+            return errText;
+    }
+
+    #if PING_IPV6
+        if (__isIPv6__) {
+            __target_addr_IPv6__ = {};
+            __target_addr_IPv6__.sin6_family = AF_INET6;
+            __target_addr_IPv6__.sin6_len = sizeof (__target_addr_IPv6__);
+            if (inet_pton (AF_INET6, __pingTargetIp__, &__target_addr_IPv6__.sin6_addr) <= 0)
+                return "invalid network address";
+        } else
+    #endif
+    {
+        __target_addr_IPv4__ = {};
+        __target_addr_IPv4__.sin_family = AF_INET;
+        __target_addr_IPv4__.sin_len = sizeof (__target_addr_IPv4__);
+        if (inet_pton (AF_INET, __pingTargetIp__, &__target_addr_IPv4__.sin_addr) <= 0)
+            return "invalid network address";
+    }
+
+    return NULL; // OK
+}
+
+// resolves the name through the DNS cache, sets __isIPv6__ and __pingTargetIp__, returns error text or NULL if OK
+const char *ThreadSafePingStatistics_t::__resolveByDns__ (const char *pingTarget, int family) {
+    #if PING_DNS_CACHE_SIZE > 0
+        const char *errText;
+        bool isIPv6 = __isIPv6__;
+        if (__dnsCacheLookup__ (pingTarget, family, &isIPv6, __pingTargetIp__, &errText)) {
+            #if PING_IPV6
+                __isIPv6__ = isIPv6;
+            #endif
+            return errText;
+        }
+    #endif
 
     struct addrinfo hints, *res, *p;
     memset (&hints, 0, sizeof (hints));
-    hints.ai_family = AF_UNSPEC;
+    #if PING_IPV6
+        hints.ai_family = family; // lwIP returns a single address, so both families of a dual-stack host take two look-ups
+    #else
+        hints.ai_family = AF_INET; // don't even ask for IPv6 addresses
+    #endif
     hints.ai_socktype = SOCK_DGRAM;
 
     xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
         int e = getaddrinfo (pingTarget, NULL, &hints, &res);
     xSemaphoreGive (getLwIpMutex ());
-    if (e)
+    if (e) {
+        #if PING_DNS_CACHE_SIZE > 0
+            if (e == EAI_NONAME || e == EAI_FAIL) // do not cache temporary failures
+                __dnsCacheStore__ (pingTarget, family, false, "", gai_strerror (e));
+        #endif
         return gai_strerror (e);
+    }
 
     for (p = res; p != NULL; p = p->ai_next) {
         void *addr;
-        if (p->ai_family == AF_INET) {
-            __isIPv6__ = false;
+        #if PING_IPV6
+            if (p->ai_family != AF_INET) {
+                __isIPv6__ = true;
+                struct sockaddr_in6 *ipv6 = (struct sockaddr_in6 *) p->ai_addr;
+                addr = &(ipv6->sin6_addr);
+            } else
+        #endif
+        {
+            #if PING_IPV6
+                __isIPv6__ = false;
+            #endif
             struct sockaddr_in *ipv4 = (struct sockaddr_in*) p->ai_addr;
             addr = &(ipv4->sin_addr);
-        } else {
-            __isIPv6__ = true;
-            struct sockaddr_in6 *ipv6 = (struct sockaddr_in6 *) p->ai_addr;
-            addr = &(ipv6->sin6_addr);
         }
         inet_ntop (p->ai_family, addr, __pingTargetIp__, sizeof (__pingTargetIp__));
         break;
@@ -70,323 +226,1207 @@ const char *ThreadSafePing_t::__resolveTargetName__ (const char *pingTarget) {
         freeaddrinfo (res);
     xSemaphoreGive (getLwIpMutex ());
 
-    if (__isIPv6__) {
-        __target_addr_IPv6__ = {};
-        __target_addr_IPv6__.sin6_family = AF_INET6;
-        __target_addr_IPv6__.sin6_len = sizeof (__target_addr_IPv6__);
-        if (inet_pton (AF_INET6, __pingTargetIp__, &__target_addr_IPv6__.sin6_addr) <= 0)
-            return "invalid network address";
-    } else {
-        __target_addr_IPv4__ = {};
-        __target_addr_IPv4__.sin_family = AF_INET;
-        __target_addr_IPv4__.sin_len = sizeof (__target_addr_IPv4__);
-        if (inet_pton (AF_INET, __pingTargetIp__, &__target_addr_IPv4__.sin_addr) <= 0)
-            return "invalid network address";
-    }
-
+    #if PING_DNS_CACHE_SIZE > 0
+        __dnsCacheStore__ (pingTarget, family, __isIPv6__, __pingTargetIp__, NULL);
+    #endif
     return NULL; // OK
 }
 
 // returns error text or NULL if OK
-const char *ThreadSafePing_t::ping (const char *pingTarget, int count, int interval, int size, int timeout) {
+const char *ThreadSafePing_t::ping (const char *pingTarget, int count, int interval, int size, int timeout, int window) {
+    if (__session__.running)
+        return "already running";
+    __errText__ = __resolveTargetName__ (pingTarget);
+    if (__errText__)
+        return __errText__;
+    return ping (count, interval, size, timeout, window);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePing_t::ping (const IPAddress& pingTarget, int count, int interval, int size, int timeout, int window) {
+    if (__session__.running)
+        return "already running";
+    snprintf (__pingTargetIp__, sizeof (__pingTargetIp__), "%u.%u.%u.%u", pingTarget [0], pingTarget [1], pingTarget [2], pingTarget [3]);
+    __errText__ = __resolveTargetName__ (__pingTargetIp__);
+    if (__errText__)
+        return __errText__;
+    return ping (count, interval, size, timeout, window);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePing_t::ping (int count, int interval, int size, int timeout, int window) {
+    // check argument values given in seconds
+    if (interval < 1 || interval > 3600) return "invalid value";
+    if (timeout < 1 || timeout > 30) return "invalid value";
+
+    ThreadSafePingOptions_t options;
+    options.count = count;
+    options.intervalMicros = 1000000UL * interval;
+    options.size = size;
+    options.timeoutMicros = 1000000UL * timeout;
+    options.window = window;
+    return ping (options);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePing_t::ping (const char *pingTarget, const ThreadSafePingOptions_t& options) {
+    if (__session__.running)
+        return "already running";
+    __errText__ = __resolveTargetName__ (pingTarget);
+    if (__errText__)
+        return __errText__;
+    return ping (options);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePing_t::ping (const IPAddress& pingTarget, const ThreadSafePingOptions_t& options) {
+    if (__session__.running)
+        return "already running";
+    snprintf (__pingTargetIp__, sizeof (__pingTargetIp__), "%u.%u.%u.%u", pingTarget [0], pingTarget [1], pingTarget [2], pingTarget [3]);
+    __errText__ = __resolveTargetName__ (__pingTargetIp__);
+    if (__errText__)
+        return __errText__;
+    return ping (options);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePing_t::ping (const ThreadSafePingOptions_t& options) {
+    // a session that is already running keeps its target, state and errText ()
+    if (__session__.running)
+        return "already running";
+    // build the echo request only once, no memory allocation is needed while pinging (larger echo requests and replies don't fit on the stack, __begin__ allocates a buffer for them)
+    uint32_t stackPacket [(sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE + 3) / 4];
+    uint32_t stackBuf [(60 + sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE + 3) / 4]; // the longest IPv4 header
+    __errText__ = __begin__ (options, (char *) stackPacket, (char *) stackBuf, sizeof (stackBuf));
+    if (__errText__)
+        return __errText__;
+
+    __poll__ (true);
+    return __errText__; // NULL if OK
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePing_t::begin (const char *pingTarget, const ThreadSafePingOptions_t& options) {
+    if (__session__.running)
+        return "already running";
     __errText__ = __resolveTargetName__ (pingTarget);
     if (__errText__)
         return __errText__;
-    return ping (count, interval, size, timeout);
+    return begin (options);
 }
 
 // returns error text or NULL if OK
-const char *ThreadSafePing_t::ping (const IPAddress& pingTarget, int count, int interval, int size, int timeout) {
+const char *ThreadSafePing_t::begin (const IPAddress& pingTarget, const ThreadSafePingOptions_t& options) {
+    if (__session__.running)
+        return "already running";
     snprintf (__pingTargetIp__, sizeof (__pingTargetIp__), "%u.%u.%u.%u", pingTarget [0], pingTarget [1], pingTarget [2], pingTarget [3]);
     __errText__ = __resolveTargetName__ (__pingTargetIp__);
     if (__errText__)
         return __errText__;
-    return ping (count, interval, size, timeout);
+    return begin (options);
 }
 
 // returns error text or NULL if OK
-const char *ThreadSafePing_t::ping (int count, int interval, int size, int timeout) {
+const char *ThreadSafePing_t::begin (const ThreadSafePingOptions_t& options) {
+    if (__session__.running)
+        return "already running";
+    // the echo request and the reply buffer have to outlive this call, so they are allocated
+    return __errText__ = __begin__ (options, NULL, NULL, 0);
+}
+
+// returns true when the session is done (or hasn't begun), false if poll () should be called again
+bool ThreadSafePing_t::poll () {
+    if (!__session__.running)
+        return true;
+    return __poll__ (false);
+}
+
+// checks the options, takes a socket (or a dispatcher session) and builds the echo request into packet or into an allocated buffer if packet is NULL or too small, returns error text or NULL if OK
+const char *ThreadSafePing_t::__begin__ (const ThreadSafePingOptions_t& options, char *packet, char *buf, int bufSize) {
     if (!WiFi.isConnected () || WiFi.localIP () == IPAddress (0, 0, 0, 0))
         return "not connected";
 
+    __session__.options = options;
+    ThreadSafePingOptions_t *o = &__session__.options;
+
     // check argument values
-    if (count < 0) return "invalid value";
-    if (interval < 1 || interval > 3600) return "invalid value";
-    if (size < 4 || size > 256) return "invalid value";
-    if (timeout < 1 || timeout > 30) return "invalid value";
+    if (o->count < 0) return "invalid value";
+    if (o->mode == PING_MODE_FLOOD) {
+        if (o->rate < 0 || o->rate > 100000) return "invalid value";
+        o->intervalMicros = o->rate ? 1000000UL / o->rate : 0; // the gap between echo requests
+    } else {
+        if (o->mode != PING_MODE_INTERVAL && o->mode != PING_MODE_ADAPTIVE) return "invalid value";
+        if (o->intervalMicros < 1000 || o->intervalMicros > 3600000000UL) return "invalid value";
+        if (o->mode == PING_MODE_ADAPTIVE && o->minGapMicros > o->intervalMicros) return "invalid value";
+    }
+    if (o->size < 4 || o->size > PING_MAX_SIZE) return "invalid value";
+    if (o->timeoutMicros < 1000 || o->timeoutMicros > 30000000UL) return "invalid value";
+    if (o->window < 1 || o->window > PING_MAX_WINDOW) return "invalid value";
+    if (o->ttl < 0 || o->ttl > 255) return "invalid value";
+    if (o->onWaitMicros && (o->onWaitMicros < 1000 || o->onWaitMicros > 3600000000UL)) return "invalid value";
+    if (__monitor__ && __monitor__->errText ()) return "out of memory"; // its mutex couldn't be created
+
+    // stop () wakes up the waits between echo requests, forget the stop () of an earlier ping () first
+    if (!__wakeUp__ && !(__wakeUp__ = xSemaphoreCreateBinary ()))
+        return "out of memory";
+    xSemaphoreTake (__wakeUp__, 0);
 
     // initialize measuring variables
-    __size__ = size;
-    __sent__ = __received__ = __lost__ = 0;
+    __resetStatistics__ (o->size);
     __stopped__ = false;
-    __min_time__ = 1e9; // FLT_MAX;
-    __max_time__ = 0;
-    __mean_time__ = 0;
-    __var_time__ = 0;
 
-    // create socket
-    xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
-        int sockfd = __isIPv6__ ? socket (AF_INET6, SOCK_RAW, IPPROTO_ICMPV6) : socket (AF_INET, SOCK_RAW, IPPROTO_ICMP);
-        
-        if (sockfd < 0) {
-            __errText__ = strerror (errno);
-            xSemaphoreGive (getLwIpMutex ());
-            return strerror (errno);
-        }
+    // payloads of 4 - 7 bytes (that fitted the old 32-bit time stamp) are padded to hold the 64-bit one, the replies are reported with the requested size
+    __session__.padding = __paddingOf__ (o->size);
+    o->size += __session__.padding;
+    __start_time__ = __nowMicros__ ();
+    __finish_time__ = 0;
 
-        // make the socket non-blocking, so we can detect time-out later     
-        if (fcntl (sockfd, F_SETFL, O_NONBLOCK) == -1) {
-            __errText__ = strerror (errno);
-            close (sockfd);
-            xSemaphoreGive (getLwIpMutex ());
-            return __errText__;
-        }
-    xSemaphoreGive (getLwIpMutex ());
+    int sockfd = -1;
 
-    // begin ping ...
-    for (uint16_t seqno = 1; (seqno <= count || count == 0) && !__stopped__; seqno++) {
-        unsigned long sendMillis = millis ();
+    // if the dispatcher task is running, send through its socket and let it push the replies to our queue (its socket can't have our TTL though)
+    int dispatcherSession = -1;
+    if (ThreadSafePingDispatcher_t::running () && !o->ttl) {
+        sockfd = __atomic_load_n (__isIPv6__ ? &ThreadSafePingDispatcher_t::__sockfdIPv6__ : &ThreadSafePingDispatcher_t::__sockfdIPv4__, __ATOMIC_RELAXED);
+        if (sockfd >= 0)
+            dispatcherSession = ThreadSafePingDispatcher_t::__register__ (o->verify, o->size);
+    }
 
-        __errText__ = __ping_send__ (sockfd, seqno, size);
-        if (__errText__)
-            return __errText__;
+    if (dispatcherSession >= 0) {
+        __id__ = PING_DISPATCHER_ID_BASE + dispatcherSession;
+        __replies__ = ThreadSafePingDispatcher_t::__sessions__ [dispatcherSession].replies;
+        __replyQueue__ = ThreadSafePingDispatcher_t::__sessions__ [dispatcherSession].queue;
 
-        __sent__++;
+    } else {
+        // take a socket from the pool or create a new one
+        const char *errText;
+        sockfd = __takeSocket__ (__isIPv6__, &errText);
+        if (sockfd < 0)
+            return errText;
+
+        // the socket may have been used by some other task before, forget its echo requests
+        __id__ = sockfd;
+        __replies__ = __getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET];
+        __replyQueue__ = NULL;
+        for (int i = 0; i < PING_MAX_WINDOW; i++)
+            __slotClear__ (&__replies__ [i]);
+    }
+    __session__.sockfd = sockfd;
+    __session__.dispatcherSession = dispatcherSession;
+
+    // the echo request and the reply buffer get allocated if they don't fit into the caller's buffers
+    __session__.heapBuffer = NULL;
+    if (!packet || o->size > PING_STACK_MAX_SIZE) {
+        int packetWords = (sizeof (struct icmp_echo_hdr) + o->size + 3) / 4;
+        bufSize = 60 + sizeof (struct icmp_echo_hdr) + o->size;
+        __session__.heapBuffer = new (std::nothrow) uint32_t [packetWords + (bufSize + 3) / 4];
+        if (!__session__.heapBuffer) {
+            __end__ ();
+            return "out of memory";
+        }
+        packet = (char *) __session__.heapBuffer;
+        buf = (char *) (__session__.heapBuffer + packetWords);
+    }
+    __session__.packet = packet;
+    __session__.buf = buf;
+    __session__.bufSize = bufSize;
+    __buildPacket__ (packet, __isIPv6__, __id__, o->size);
+
+    // the socket goes back to the pool with its previous TTL
+    if (o->ttl) {
+        const char *errText = __setTtl__ (sockfd, __isIPv6__, o->ttl, &__session__.previousTtl);
+        if (errText) {
+            o->ttl = 0; // nothing to restore
+            __end__ ();
+            return errText;
+        }
+    }
 
-        int bytesReceived;
-        __ping_recv__ (sockfd, &bytesReceived, 1000000 * timeout);
+    __session__.nextSeqno = 1;
+    __session__.oldestSeqno = 1;
+    __session__.inFlight = 0;
+    __session__.dueMicros = micros ();
+    __session__.lastSendMicros = __session__.dueMicros;
+    __session__.waitMicros = micros ();
+    __session__.running = true;
+    return NULL; // OK
+}
 
-        if (__getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET].elapsed_time) {
-            // Update statistics
-            __received__++;
-            __elapsed_time__ = (float) __getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET].elapsed_time / 1000.0f;
+// advances the session: sends the echo requests that are due and reports the replies and time-outs, if block is true it waits for them until the session is done,
+// otherwise it only reads what has already arrived, returns true when the session is done
+bool ThreadSafePing_t::__poll__ (bool block) {
+    __session_t__ *s = &__session__;
+    const ThreadSafePingOptions_t *o = &s->options;
+    __pingReply_t__ *replies = __replies__;
+
+    // ping ...
+    //  - up to window echo requests can be in flight, each occupying its own slot in replies, until its reply or its time-out gets reported
+    //  - a new echo request is sent each interval as long as the window is not full: the window spans from the oldest unreported echo request on,
+    //    so replies that arrive out of order can't free a slot that the oldest echo request still occupies
+    //  - with window = 1 this is the classic stop-and-wait ping
+    //  - in adaptive mode each reply makes the next echo request due right away (but not sooner than minGap after the previous one),
+    //    in flood mode the echo requests are due each 1 / rate, catching up with the schedule as soon as the window lets them
+    //  - nextSeqno is 32-bit so that it doesn't wrap around in continuous mode, oldestSeqno is the sequence number of the oldest echo request still in flight (if any)
+    unsigned long intervalMicros = o->intervalMicros;
+    unsigned long timeoutMicros = o->timeoutMicros;
+    uint32_t window = o->window;
+
+    while (!__stopped__) {
+        bool moreToSend = o->count == 0 || __sent__ < (uint32_t) o->count;
+        bool slotBusy = false; // another task is just writing a reply into a slot the session needs, look at it again in a tick
+
+        // send the next echo request if it is due and if the window is not full
+        bool windowFull = s->nextSeqno - s->oldestSeqno >= window;
+        if (moreToSend && !windowFull && (long) (micros () - s->dueMicros) >= 0) {
+            // initialize the data structure where the reply information will be stored when it arrives
+            __pingReply_t__ *reply = &replies [s->nextSeqno % PING_MAX_WINDOW];
+            __harvestSlot__ (this, reply, __session__.padding); // count the duplicates and the late reply of the previous echo request in this slot
+            if (!__slotSend__ (reply, s->nextSeqno, o->verify)) {
+                slotBusy = true; // a late reply to the previous echo request is just being written into the slot, send a tick later
+
+            } else {
+                if (o->mode == PING_MODE_FLOOD)
+                    // keep the rate, unless we are so late that catching up would mean a burst longer than the window
+                    s->dueMicros = micros () - s->dueMicros < intervalMicros * window ? s->dueMicros + intervalMicros : micros () + intervalMicros;
+                else
+                    // keep the schedule, unless we are already more than an interval late (because the window was full)
+                    s->dueMicros = micros () - s->dueMicros < intervalMicros ? s->dueMicros + intervalMicros : micros () + intervalMicros;
+                s->lastSendMicros = micros ();
+
+                __errText__ = __ping_send__ (this, s->sockfd, s->packet, s->nextSeqno, o->size);
+                if (__errText__)
+                    break;
+
+                __sent__++;
+                s->nextSeqno++;
+                s->inFlight++;
+            }
+        }
+
+        // report the replies that have arrived and the echo requests that have timed out meanwhile
+        for (uint32_t seqno = s->oldestSeqno; seqno != s->nextSeqno; seqno++) {
+            __pingReply_t__ *reply = &replies [seqno % PING_MAX_WINDOW];
+            uint32_t word = __slotState__ (reply);
+            if (__slotReported__ (word))
+                continue; // already reported
+
+            int bytes;
+            if (word == __slotWord__ (seqno, __SLOT_ARRIVED__)) {
+                bytes = reply->bytes - __session__.padding;
+                __countReply__ (seqno, reply->sent_time, reply->elapsed_time, bytes);
+                __slotRelease__ (reply, word, __SLOT_REPORTED__); // the state can't change meanwhile, other tasks only count duplicates now
+
+                // in adaptive mode the reply makes the next echo request due
+                if (o->mode == PING_MODE_ADAPTIVE && (long) (s->dueMicros - (s->lastSendMicros + o->minGapMicros)) > 0)
+                    s->dueMicros = s->lastSendMicros + o->minGapMicros;
+
+            } else if (__slotStateOf__ (word) == __SLOT_CLAIMED__) {
+                // only the task that has claimed the slot moves it on, even if the time-out has passed meanwhile
+                slotBusy |= __nowMicros__ () - reply->sent_time >= (int64_t) timeoutMicros;
+                continue;
 
-            if (__elapsed_time__ < __min_time__) __min_time__ = __elapsed_time__;
-            if (__elapsed_time__ > __max_time__) __max_time__ = __elapsed_time__;
+            } else if (__nowMicros__ () - reply->sent_time >= (int64_t) timeoutMicros) {
+                if (!__slotRelease__ (reply, word, __SLOT_EXPIRED__))
+                    continue; // the reply has arrived just now, report it the next time
+                __countLoss__ (seqno, reply->sent_time);
+                bytes = -1;
 
-            __last_mean_time__ = __mean_time__;
-            __mean_time__ = (((__received__ - 1) * __mean_time__) + __elapsed_time__) / __received__;
+            } else {
+                continue; // still waiting
+            }
 
-            if (__received__ > 1)
-                __var_time__ += (__elapsed_time__ - __last_mean_time__) * (__elapsed_time__ - __mean_time__);
+            s->inFlight--;
 
-        } else {
-            __lost__++;
-            __elapsed_time__ = 0;
+            // report intermediate results 
+            __seqno__ = seqno;
+            onReceive (bytes);
         }
+        while (s->oldestSeqno != s->nextSeqno && __slotReported__ (__slotState__ (&replies [s->oldestSeqno % PING_MAX_WINDOW])))
+            s->oldestSeqno++;
+
+        if (!moreToSend && !s->inFlight)
+            break; // finished
 
-        // report intermediate results 
-        onReceive (bytesReceived);
+        // non-blocking: read the replies that have already arrived, then let the caller do something else
+        if (!block && s->inFlight && __ping_recv__ (s->sockfd, s->buf, s->bufSize, 0) == NULL)
+            continue;
 
-        if (seqno <= count || count == 0) {
-            while ((millis () - sendMillis < 1000L * interval) && !__stopped__) {
-                // report waiting 
+        // report waiting each onWaitMicros
+        unsigned long waitMicros = 0xFFFFFFFFUL;
+        if (o->onWaitMicros) {
+            if (micros () - s->waitMicros >= o->onWaitMicros) {
+                s->waitMicros = micros ();
                 onWait ();
-                delay (10);
             }
+            unsigned long sinceMicros = micros () - s->waitMicros;
+            waitMicros = sinceMicros < o->onWaitMicros ? o->onWaitMicros - sinceMicros : 0;
+        }
+        if (!block)
+            return false;
+
+        // sleep until a reply arrives, the oldest echo request times out or the next echo request is due, but not past the next report of waiting
+        if (s->inFlight) {
+            unsigned long waitingMicros = __nowMicros__ () - replies [s->oldestSeqno % PING_MAX_WINDOW].sent_time;
+            unsigned long untilTimeoutMicros = waitingMicros < timeoutMicros ? timeoutMicros - waitingMicros : 0;
+            if (waitMicros > untilTimeoutMicros) waitMicros = untilTimeoutMicros;
+        }
+        if (moreToSend && s->nextSeqno - s->oldestSeqno < window) {
+            long untilSendMicros = (long) (s->dueMicros - micros ());
+            if (untilSendMicros < 0) untilSendMicros = 0;
+            if (waitMicros > (unsigned long) untilSendMicros) waitMicros = untilSendMicros;
+        }
+        // the writer of a busy slot only needs a few instructions, but it may be a lower priority task, so let it run for a tick instead of spinning
+        if (slotBusy && waitMicros < 1000UL * portTICK_PERIOD_MS)
+            waitMicros = 1000UL * portTICK_PERIOD_MS;
+        if (s->inFlight)
+            __ping_recv__ (s->sockfd, s->buf, s->bufSize, waitMicros);
+        else
+            __sleepMicros__ (waitMicros); // nothing in flight, so the next echo request is due
+    }
+
+    // count the duplicates and the late replies that have arrived so far
+    for (int i = 0; i < PING_MAX_WINDOW; i++)
+        __harvestSlot__ (this, &replies [i], __session__.padding);
+    __finish_time__ = __nowMicros__ ();
+    __end__ ();
+    return true;
+}
+
+// gives the socket (or the dispatcher session) back and frees the buffer
+void ThreadSafePing_t::__end__ () {
+    delete [] __session__.heapBuffer;
+    __session__.heapBuffer = NULL;
+
+    if (__session__.dispatcherSession >= 0) {
+        ThreadSafePingDispatcher_t::__unregister__ (__session__.dispatcherSession);
+    } else {
+        if (__session__.options.ttl)
+            __setTtl__ (__session__.sockfd, __isIPv6__, __session__.previousTtl);
+        __releaseSocket__ (__session__.sockfd, __isIPv6__);
+    }
+    __replyQueue__ = NULL;
+    __session__.running = false;
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePing_t::discoverPathMtu (const char *pingTarget, int attempts, unsigned long timeoutMicros) {
+    if (__session__.running)
+        return "already running";
+    __path_mtu__ = 0;
+    __errText__ = __resolveTargetName__ (pingTarget);
+    if (__errText__)
+        return __errText__;
+    return discoverPathMtu (attempts, timeoutMicros);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePing_t::discoverPathMtu (int attempts, unsigned long timeoutMicros) {
+    if (__session__.running)
+        return "already running";
+    __path_mtu__ = 0;
+    if (attempts < 1 || attempts > 10) return "invalid value";
+
+    int headers = (__isIPv6__ ? 40 : 20) + sizeof (struct icmp_echo_hdr);
+    int low = sizeof (int64_t); // the largest payload known to get through
+    int high = PING_MTU - headers; // the largest payload that might get through
+    if (high > PING_MAX_SIZE)
+        high = PING_MAX_SIZE;
+
+    bool gotThrough;
+    const char *errText = __probeSize__ (low, attempts, timeoutMicros, &gotThrough);
+    if (errText)
+        return errText;
+    if (!gotThrough)
+        return "no reply";
+
+    // binary search, each step halves the sizes that haven't been tried yet
+    while (low < high) {
+        int size = (low + high + 1) / 2;
+        errText = __probeSize__ (size, attempts, timeoutMicros, &gotThrough);
+        if (errText)
+            return errText;
+        if (gotThrough)
+            low = size;
+        else
+            high = size - 1;
+    }
+
+    __path_mtu__ = low + headers;
+    return NULL; // OK
+}
+
+// sends echo requests with the payload size until one gets a reply or attempts run out, returns error text or NULL if OK
+const char *ThreadSafePing_t::__probeSize__ (int size, int attempts, unsigned long timeoutMicros, bool *gotThrough) {
+    ThreadSafePingOptions_t options;
+    options.count = 1;
+    options.size = size;
+    options.timeoutMicros = timeoutMicros;
+    options.intervalMicros = timeoutMicros;
+
+    *gotThrough = false;
+    for (int i = 0; i < attempts && !__stopped__; i++) {
+        const char *errText = ping (options);
+        if (errText)
+            return errText;
+        if (__received__) {
+            *gotThrough = true;
+            break;
         }
     }
+    return NULL; // OK
+}
+
+// pool of idle sockets, shared by all the instances, so that repeated ping () calls don't have to create and close a socket each time
+#if PING_SOCKET_POOL_SIZE > 0
+
+    struct __idleSocket_t__ {
+        int sockfd;
+        int64_t releasedMicros;
+    };
+
+    static __idleSocket_t__ __idleSockets__ [2][PING_SOCKET_POOL_SIZE]; // [isIPv6], the longest idle at the bottom
+    static int __idleSocketCount__ [2] = {};
+
+    // singleton mutex, it only guards the pool
+    static SemaphoreHandle_t __getSocketPoolMutex__ () {
+        static SemaphoreHandle_t semaphore = xSemaphoreCreateMutex ();
+        return semaphore;
+    }
+
+    // throws away the ICMP packets queued for the socket, so that their pbufs are freed - must be called with getLwIpMutex () taken
+    static void __drainIdleSocket__ (int sockfd) {
+        char buf [300];
+        while (recv (sockfd, buf, sizeof (buf), 0) > 0);
+    }
+
+    // closes the sockets that have been idle for longer than PING_SOCKET_POOL_IDLE_TIMEOUT - must be called with __getSocketPoolMutex__ () taken
+    static void __closeExpiredSockets__ (bool isIPv6) {
+        int64_t now = esp_timer_get_time ();
+        int expired = 0;
+        while (expired < __idleSocketCount__ [isIPv6] && now - __idleSockets__ [isIPv6][expired].releasedMicros > 1000000LL * PING_SOCKET_POOL_IDLE_TIMEOUT)
+            expired++;
+        if (!expired)
+            return;
+
+        xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+            for (int i = 0; i < expired; i++)
+                closesocket (__idleSockets__ [isIPv6][i].sockfd);
+        xSemaphoreGive (getLwIpMutex ());
+        __idleSocketCount__ [isIPv6] -= expired;
+        memmove (&__idleSockets__ [isIPv6][0], &__idleSockets__ [isIPv6][expired], __idleSocketCount__ [isIPv6] * sizeof (__idleSocket_t__));
+    }
+
+#endif
+
+// returns non-blocking socket or -1 (errText is set then)
+int ThreadSafePing_t::__takeSocket__ (bool isIPv6, const char **errText) {
+    int sockfd = -1;
+
+    #if PING_SOCKET_POOL_SIZE > 0
+        xSemaphoreTake (__getSocketPoolMutex__ (), portMAX_DELAY);
+            __closeExpiredSockets__ (isIPv6);
+            if (__idleSocketCount__ [isIPv6])
+                sockfd = __idleSockets__ [isIPv6][--__idleSocketCount__ [isIPv6]].sockfd;
+        xSemaphoreGive (__getSocketPoolMutex__ ());
+
+        if (sockfd >= 0) {
+            // while idle the socket was receiving copies of all the ICMP packets, throw them away
+            xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+                __drainIdleSocket__ (sockfd);
+            xSemaphoreGive (getLwIpMutex ());
+            return sockfd;
+        }
+    #endif
+
+    // create socket
+    xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+        #if PING_IPV6
+            sockfd = isIPv6 ? socket (AF_INET6, SOCK_RAW, IPPROTO_ICMPV6) : socket (AF_INET, SOCK_RAW, IPPROTO_ICMP);
+        #else
+            sockfd = socket (AF_INET, SOCK_RAW, IPPROTO_ICMP);
+        #endif
+
+        if (sockfd < 0) {
+            *errText = strerror (errno);
+
+        // make the socket non-blocking, so we can detect time-out later
+        } else if (fcntl (sockfd, F_SETFL, O_NONBLOCK) == -1) {
+            *errText = strerror (errno);
+            close (sockfd);
+            sockfd = -1;
+        }
+    xSemaphoreGive (getLwIpMutex ());
+
+    return sockfd;
+}
+
+// puts the socket back into the pool (drained, so it doesn't hold the pbufs of the late replies) or closes it if the pool is full
+void ThreadSafePing_t::__releaseSocket__ (int sockfd, bool isIPv6) {
+    #if PING_SOCKET_POOL_SIZE > 0
+        xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+            __drainIdleSocket__ (sockfd);
+        xSemaphoreGive (getLwIpMutex ());
+
+        bool pooled = false;
+        xSemaphoreTake (__getSocketPoolMutex__ (), portMAX_DELAY);
+            __closeExpiredSockets__ (isIPv6);
+            if (__idleSocketCount__ [isIPv6] < PING_SOCKET_POOL_SIZE) {
+                __idleSockets__ [isIPv6][__idleSocketCount__ [isIPv6]++] = { sockfd, esp_timer_get_time () };
+                pooled = true;
+            }
+        xSemaphoreGive (__getSocketPoolMutex__ ());
+        if (pooled)
+            return;
+    #endif
 
     xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
         closesocket (sockfd);
     xSemaphoreGive (getLwIpMutex ());
-    return NULL; // OK
 }
 
-// returns error text or NULL if OK
-const char *ThreadSafePing_t::__ping_send__ (int sockfd, uint16_t seqno, int size) {
-    int sent;
-    int ping_size;
-
-    if (__isIPv6__) {
-        struct icmp6_echo_hdr *iecho;
-        ping_size = sizeof (struct icmp6_echo_hdr) + size;
-
-        // construct ping block
-        // - first there is struct icmp_echo_hdr (https://github.com/ARMmbed/lwip/blob/master/src/include/lwip/prot/icmG.h). We'll use these fields:
-        //    - uint16_t id      - this is where we'll keep the socket number so that we would know from where ping packet has been send when we receive a reply 
-        //    - uint16_t seqno   - each packet gets it sequence number so we can distinguish one packet from another when we receive a reply
-        //    - uint16_t chksum  - needs to be calcualted
-        // - then we'll add the payload:
-        //    - unsigned long micros  - this is where we'll keep the time packet has been sent so we can calcluate round-trip time when we receive a reply
-        //    - unimportant data, just to fill the payload to the desired length
-
-        iecho = (struct icmp6_echo_hdr *) mem_malloc (ping_size);
-        if (!iecho)
-            return "out of memory";
+// sets IPv4 time-to-live or IPv6 hop limit of the socket's echo requests, returns error text or NULL if OK
+const char *ThreadSafePing_t::__setTtl__ (int sockfd, bool isIPv6, int ttl, int *previousTtl) {
+    int level = IPPROTO_IP;
+    int option = IP_TTL;
+    #if PING_IPV6
+        if (isIPv6) {
+            #ifdef IPV6_UNICAST_HOPS
+                level = IPPROTO_IPV6;
+                option = IPV6_UNICAST_HOPS;
+            #else
+                return "hop limit not supported"; // lwIP has been built without it
+            #endif
+        }
+    #endif
 
-        // initialize the data structure where the reply information will be stored when it arrives
-        __getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET] = { seqno, 0 };
+    const char *errText = NULL;
+    xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+        socklen_t len = sizeof (int);
+        if (previousTtl && getsockopt (sockfd, level, option, previousTtl, &len) < 0)
+            errText = strerror (errno);
+        else if (setsockopt (sockfd, level, option, &ttl, sizeof (ttl)) < 0)
+            errText = strerror (errno);
+    xSemaphoreGive (getLwIpMutex ());
+    return errText;
+}
 
-        // prepare echo packet
-        size_t data_len = ping_size - sizeof (struct icmp6_echo_hdr);
-        iecho->type = ICMP6_ECHO_REQUEST;
-        iecho->code = 0;
-        iecho->chksum = 0;
-        iecho->id = sockfd;
-        iecho->seqno = seqno;
+void ThreadSafePing_t::closeIdleSockets () {
+    #if PING_SOCKET_POOL_SIZE > 0
+        xSemaphoreTake (__getSocketPoolMutex__ (), portMAX_DELAY);
+            xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+                for (int f = 0; f < 2; f++)
+                    while (__idleSocketCount__ [f])
+                        closesocket (__idleSockets__ [f][--__idleSocketCount__ [f]].sockfd);
+            xSemaphoreGive (getLwIpMutex ());
+        xSemaphoreGive (__getSocketPoolMutex__ ());
+    #endif
+}
 
-        // store micros at they are at send time
-        unsigned long sendMicros = micros ();
-        *(unsigned long *) (((char *) iecho) + sizeof (struct icmp6_echo_hdr)) = sendMicros;
+ThreadSafePingCounters_t ThreadSafePing_t::__globalCounters__ = {};
 
-        // fill the additional data buffer with some data
-        for (int i = sizeof (sendMicros); i < data_len; i++)
-            ((char *) iecho) [sizeof (struct icmp6_echo_hdr) + i] = (char) i;
+// returns a snapshot of the counters of all the sessions, each counter is read atomically
+ThreadSafePingCounters_t ThreadSafePing_t::globalCounters () {
+    ThreadSafePingCounters_t counters;
+    uint32_t *from = (uint32_t *) &__globalCounters__;
+    uint32_t *to = (uint32_t *) &counters;
+    for (int i = 0; i < (int) (sizeof (counters) / sizeof (uint32_t)); i++)
+        to [i] = __atomic_load_n (&from [i], __ATOMIC_RELAXED);
+    return counters;
+}
 
-        // claculate checksum
-        iecho->chksum = inet_chksum (iecho, ping_size);
+void ThreadSafePing_t::resetGlobalCounters () {
+    uint32_t *counter = (uint32_t *) &__globalCounters__;
+    for (int i = 0; i < (int) (sizeof (__globalCounters__) / sizeof (uint32_t)); i++)
+        __atomic_store_n (&counter [i], 0, __ATOMIC_RELAXED);
+}
 
-        // send the packet
-        sent = sendto (sockfd, iecho, ping_size, 0, (struct sockaddr *) &__target_addr_IPv6__, sizeof (__target_addr_IPv6__));
+void ThreadSafePingStatistics_t::__resetStatistics__ (int size) {
+    __size__ = size;
+    __seqno__ = 0;
+    __sent__ = __received__ = __lost__ = 0;
+    __elapsed_time__ = 0;
+    __min_time__ = 1e9; // FLT_MAX;
+    __max_time__ = 0;
+    __mean_time__ = 0;
+    __var_time__ = 0;
+    __jitter__ = 0;
+    __previous_time__ = 0;
+    __highestSeqno__ = 0;
+    __highestArrival__ = 0;
+    __reordered__ = __duplicates__ = __late__ = __corrupted__ = 0;
+    __mean_late_time__ = 0;
+    __send_overhead__ = __recv_overhead__ = 0;
+    __send_overhead_count__ = __recv_overhead_count__ = 0;
+    __counters__ = {};
+    if (__histogram__)
+        __histogram__->reset ();
+}
 
-        mem_free (iecho);
+// updates statistics with the round-trip time of the reply that has just arrived
+void ThreadSafePingStatistics_t::__countReply__ (uint32_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes) {
+    __received__++;
+    __elapsed_time__ = (float) elapsedMicros / 1000.0f;
+
+    // the arrival order disagrees with the order of sequence numbers (the replies are not necessarily counted in the order of their arrival)
+    int64_t arrivalMicros = sentMicros + elapsedMicros;
+    if (__received__ == 1 || (int32_t) (seqno - __highestSeqno__) > 0) {
+        if (__received__ > 1 && arrivalMicros < __highestArrival__)
+            __reordered__++; // the reply to the previous highest sequence number arrived after this one
+        __highestSeqno__ = seqno;
+        __highestArrival__ = arrivalMicros;
+    } else if (arrivalMicros > __highestArrival__) {
+        __reordered__++; // this reply arrived after the reply to a later echo request
+    }
 
-    } else {
-        struct icmp_echo_hdr *iecho;
-        ping_size = sizeof (struct icmp_echo_hdr) + size;
-
-        // construct ping block
-        // - first there is struct icmp_echo_hdr (https://github.com/ARMmbed/lwip/blob/master/src/include/lwip/prot/icmG.h). We'll use these fields:
-        //    - uint16_t id      - this is where we'll keep the socket number so that we would know from where ping packet has been send when we receive a reply 
-        //    - uint16_t seqno   - each packet gets it sequence number so we can distinguish one packet from another when we receive a reply
-        //    - uint16_t chksum  - needs to be calcualted
-        // - then we'll add the payload:
-        //    - unsigned long micros  - this is where we'll keep the time packet has been sent so we can calcluate round-trip time when we receive a reply
-        //    - unimportant data, just to fill the payload to the desired length
-
-        iecho = (struct icmp_echo_hdr *) mem_malloc (ping_size);
-        if (!iecho)
-            return "out of memory";
+    // RFC 3550: J = J + (|D| - J) / 16, where D is the difference of the round-trip times of two consecutive replies
+    if (__received__ > 1) {
+        float d = __elapsed_time__ - __previous_time__;
+        __jitter__ += ((d < 0 ? -d : d) - __jitter__) / 16.0f;
+    }
+    __previous_time__ = __elapsed_time__;
 
-        // initialize the structure where the reply information will be stored when it arrives
-        __getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET] = { seqno, 0 };
+    if (__elapsed_time__ < __min_time__) __min_time__ = __elapsed_time__;
+    if (__elapsed_time__ > __max_time__) __max_time__ = __elapsed_time__;
 
-        // prepare echo packet
-        size_t data_len = ping_size - sizeof (struct icmp_echo_hdr);
-        iecho->type = ICMP_ECHO;
-        iecho->code = 0;
-        iecho->chksum = 0;
-        iecho->id = sockfd;
-        iecho->seqno = seqno;
+    // Welford's update, (received - 1) * mean would lose precision after a long time
+    __last_mean_time__ = __mean_time__;
+    __mean_time__ += (__elapsed_time__ - __mean_time__) / __received__;
 
-        // store micros as they are at send time
-        unsigned long sendMicros = micros ();
-        *(unsigned long *) (((char *) iecho) + sizeof (struct icmp_echo_hdr)) = sendMicros;
+    if (__received__ > 1)
+        __var_time__ += (__elapsed_time__ - __last_mean_time__) * (__elapsed_time__ - __mean_time__);
 
-        // fill the additional data buffer with some data
-        for (int i = sizeof (sendMicros); i < data_len; i++)
-            ((char *) iecho) [sizeof (struct icmp_echo_hdr) + i] = (char) i;
+    if (__histogram__)
+        __histogram__->add (elapsedMicros);
+    if (__monitor__)
+        __monitor__->addReply (seqno, elapsedMicros);
+    if (__results__ || __exporter__)
+        __pushResult__ (seqno, sentMicros, elapsedMicros, bytes, ThreadSafePingResults_t::REPLY);
+}
 
-        // claculate checksum
-        iecho->chksum = inet_chksum (iecho, ping_size);
+// updates statistics with the echo request that has just timed out
+void ThreadSafePingStatistics_t::__countLoss__ (uint32_t seqno, int64_t sentMicros) {
+    __lost__++;
+    __elapsed_time__ = 0;
+    if (__monitor__)
+        __monitor__->addLoss (seqno);
+    if (__results__ || __exporter__)
+        __pushResult__ (seqno, sentMicros, 0, -1, ThreadSafePingResults_t::LOST);
+}
 
-        // send the packet
-        xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
-            sent = sendto (sockfd, iecho, ping_size, 0, (struct sockaddr *) &__target_addr_IPv4__, sizeof (__target_addr_IPv4__));
+// updates statistics with the reply that arrived after its time-out has already been reported
+void ThreadSafePingStatistics_t::__countLate__ (uint32_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes) {
+    __late__++;
+    __mean_late_time__ += ((float) elapsedMicros / 1000.0f - __mean_late_time__) / __late__;
+    if (__results__ || __exporter__)
+        __pushResult__ (seqno, sentMicros, elapsedMicros, bytes, ThreadSafePingResults_t::LATE);
+}
+
+void ThreadSafePingStatistics_t::__pushResult__ (uint32_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes, uint8_t status) {
+    ThreadSafePingResults_t::record_t record;
+    record.sentMicros = sentMicros;
+    record.seqno = seqno;
+    record.elapsedMicros = elapsedMicros;
+    record.bytes = bytes;
+    record.status = status;
+    if (__results__) {
+        record.tag = __resultsTag__;
+        __results__->push (record);
+    }
+    if (__exporter__) {
+        record.tag = __exporterTag__;
+        __exporter__->push (record);
+    }
+}
+
+// picks up what has happened to the slot after its result has been reported, before the slot is reused (a late reply that is just being written is picked up the next time)
+void ThreadSafePing_t::__harvestSlot__ (ThreadSafePingStatistics_t *target, __pingReply_t__ *reply, int padding) {
+    uint32_t word = __slotState__ (reply);
+    if (__slotStateOf__ (word) == __SLOT_LATE__ && __slotRelease__ (reply, word, __SLOT_FREE__))
+        target->__countLate__ (target->__sent__ - (uint16_t) (target->__sent__ - __slotSeqno__ (word)), reply->sent_time, reply->elapsed_time, reply->bytes - padding); // the latest 32-bit sequence number with these lower 16 bits
+    target->__duplicates__ += __atomic_exchange_n (&reply->duplicates, 0, __ATOMIC_RELAXED);
+}
+
+// sleeps for us rounded up to whole ticks (rather than spinning for the rest), or until stop () is called, the caller checks its deadline again anyway
+void ThreadSafePing_t::__sleepMicros__ (unsigned long us) {
+    TickType_t ticks = us / (1000UL * portTICK_PERIOD_MS) + (us % (1000UL * portTICK_PERIOD_MS) != 0);
+    if (ticks)
+        xSemaphoreTake (__wakeUp__, ticks);
+}
+
+// RFC 1624 incremental checksum update when 16-bit word m changes to m_: HC' = ~(~HC + ~m + m')
+static inline uint16_t __updateChecksum__ (uint16_t hc, uint16_t m, uint16_t m_) {
+    uint32_t sum = (uint16_t) ~hc + (uint16_t) ~m + m_;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+// builds the echo request template once, __ping_send__ only patches the fields that change from one echo request to another
+void ThreadSafePing_t::__buildPacket__ (char *packet, bool isIPv6, uint16_t id, int size) {
+    // construct ping block
+    // - first there is struct icmp_echo_hdr (https://github.com/ARMmbed/lwip/blob/master/src/include/lwip/prot/icmG.h) or struct icmp6_echo_hdr which has the same layout. We'll use these fields:
+    //    - uint16_t id      - this is where we'll keep the socket number (or the dispatcher session id) so that we would know from where ping packet has been send when we receive a reply 
+    //    - uint16_t seqno   - each packet gets it sequence number so we can distinguish one packet from another when we receive a reply
+    //    - uint16_t chksum  - needs to be calcualted
+    // - then we'll add the payload:
+    //    - int64_t micros        - this is where we'll keep the time packet has been sent so we can calcluate round-trip time when we receive a reply
+    //    - unimportant data, just to fill the payload to the desired length
+    struct icmp_echo_hdr *iecho = (struct icmp_echo_hdr *) packet;
+
+    iecho->type = isIPv6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+    iecho->code = 0;
+    iecho->chksum = 0;
+    iecho->id = id;
+    iecho->seqno = 0;
+
+    // 64-bit time stamp will be stored at send time
+    memset (packet + sizeof (struct icmp_echo_hdr), 0, sizeof (int64_t));
+
+    // fill the additional data buffer with some data
+    for (int i = sizeof (int64_t); i < size; i++)
+        packet [sizeof (struct icmp_echo_hdr) + i] = (char) i;
+
+    // claculate checksum of the template (for ICMPv6 lwIP recalculates it anyway, together with the pseudo header)
+    iecho->chksum = inet_chksum (iecho, sizeof (struct icmp_echo_hdr) + size);
+}
+
+// writes the current time into the payload of the echo request and updates its checksum, returns the time written
+int64_t ThreadSafePing_t::__stampPacket__ (char *packet) {
+    struct icmp_echo_hdr *iecho = (struct icmp_echo_hdr *) packet;
+    char *payload = packet + sizeof (struct icmp_echo_hdr);
+
+    uint16_t oldWords [sizeof (int64_t) / 2];
+    uint16_t newWords [sizeof (int64_t) / 2];
+    memcpy (oldWords, payload, sizeof (int64_t));
+
+    int64_t nowMicros = __nowMicros__ ();
+    memcpy (payload, &nowMicros, sizeof (int64_t));
+    memcpy (newWords, payload, sizeof (int64_t));
+    uint16_t chksum = iecho->chksum;
+    for (int i = 0; i < (int) (sizeof (int64_t) / 2); i++)
+        chksum = __updateChecksum__ (chksum, oldWords [i], newWords [i]);
+    iecho->chksum = chksum;
+
+    return nowMicros;
+}
+
+// sends the echo request built by __buildPacket__, returns error text or NULL if OK
+const char *ThreadSafePing_t::__ping_send__ (ThreadSafePingStatistics_t *target, int sockfd, char *packet, uint16_t seqno, int size) {
+    struct icmp_echo_hdr *iecho = (struct icmp_echo_hdr *) packet;
+    int ping_size = sizeof (struct icmp_echo_hdr) + size;
+
+    // patch the sequence number and update the checksum only for the words that changed
+    iecho->chksum = __updateChecksum__ (iecho->chksum, iecho->seqno, seqno);
+    iecho->seqno = seqno;
+
+    #if PING_IPV6
+        struct sockaddr *to = target->__isIPv6__ ? (struct sockaddr *) &target->__target_addr_IPv6__ : (struct sockaddr *) &target->__target_addr_IPv4__;
+        socklen_t tolen = target->__isIPv6__ ? sizeof (target->__target_addr_IPv6__) : sizeof (target->__target_addr_IPv4__);
+    #else
+        struct sockaddr *to = (struct sockaddr *) &target->__target_addr_IPv4__;
+        socklen_t tolen = sizeof (target->__target_addr_IPv4__);
+    #endif
+
+    // send the packet
+    int sent;
+    int sendErrno;
+    int64_t sendMicros;
+    if (sockfd == PING_DISPATCHER_RAW_API) {
+        // the dispatcher uses lwIP's raw API, it time-stamps and sends the echo request from the tcpip thread
+        sent = ThreadSafePingDispatcher_t::__rawSend__ (target->__isIPv6__, packet, ping_size, to, &sendMicros, &sendErrno);
+    } else {
+        __takeLwIpMutex__ (&target->__counters__);
+            // time-stamp the echo request as late as possible, after waiting for the mutex
+            sendMicros = __stampPacket__ (packet);
+            sent = sendto (sockfd, packet, ping_size, 0, to, tolen);
+            sendErrno = errno;
         xSemaphoreGive (getLwIpMutex ());
-        
-        mem_free (iecho);
     }
 
-    if (sent != ping_size)
+    if (sent != ping_size) {
+        __count__ (&target->__counters__, &ThreadSafePingCounters_t::send_failures);
+        if (sent < 0 && (sendErrno == ENOMEM || sendErrno == ENOBUFS))
+            __count__ (&target->__counters__, &ThreadSafePingCounters_t::alloc_failures);
         return "couldn't sendto";
+    }
+
+    // the time sendto took is included in the round-trip time
+    target->__send_overhead_count__++;
+    target->__send_overhead__ += ((__nowMicros__ () - sendMicros) / 1000.0f - target->__send_overhead__) / target->__send_overhead_count__;
 
     return NULL; // OK
 }
 
-// returns error text or NULL if OK
-const char *ThreadSafePing_t::__ping_recv__ (int sockfd, int *bytes, unsigned long timeoutMicros) {
-    char buf [300];
+// waits until a reply to any of the echo requests in flight arrives (or until timeoutMicros passes) and writes it into the reply slots, returns error text or NULL if OK
+const char *ThreadSafePing_t::__ping_recv__ (int sockfd, char *buf, int bufSize, unsigned long timeoutMicros) {
+    if (__replyQueue__)
+        return __ping_recv_queue__ (timeoutMicros);
+
+    int bytes;
 
     struct sockaddr_in  from_addr_IPv4;
-    struct sockaddr_in6 from_addr_IPv6;
-    int fromlen;
+    #if PING_IPV6
+        struct sockaddr_in6 from_addr_IPv6;
+    #endif
+    socklen_t fromlen;
+
+    __pingReply_t__ *replies = __replies__;
 
     unsigned long startMicros = micros ();
 
     // receive the echo packet
     while (true) {
 
-        // did some other process poick up our echo reply and already done the job for us? 
-        if (__getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET].elapsed_time)
-            return NULL; // OK
+        // did some other process pick up one of our echo replies and already done the job for us? 
+        for (int i = 0; i < PING_MAX_WINDOW; i++)
+            if (__slotStateOf__ (__slotState__ (&replies [i])) == __SLOT_ARRIVED__)
+                return NULL; // OK
 
         // read echo packet without waiting
-        xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
-             *bytes = __isIPv6__ ? recvfrom (sockfd, buf, sizeof (buf), 0, (struct sockaddr *) &from_addr_IPv6, (socklen_t *) &fromlen) : recvfrom (sockfd, buf, sizeof (buf), 0, (struct sockaddr *) &from_addr_IPv4, (socklen_t *) &fromlen);
+        int64_t readMicros = __nowMicros__ ();
+        int64_t receivedMicros;
+        __takeLwIpMutex__ (&__counters__);
+            #if PING_IPV6
+                if (__isIPv6__) {
+                    fromlen = sizeof (from_addr_IPv6);
+                    bytes = recvfrom (sockfd, buf, bufSize, 0, (struct sockaddr *) &from_addr_IPv6, &fromlen);
+                } else
+            #endif
+            {
+                fromlen = sizeof (from_addr_IPv4);
+                bytes = recvfrom (sockfd, buf, bufSize, 0, (struct sockaddr *) &from_addr_IPv4, &fromlen);
+            }
+            receivedMicros = __nowMicros__ (); // time-stamp the reply as soon as possible
         xSemaphoreGive (getLwIpMutex ());
-
-        if (*bytes <= 0) {
-            if ((errno == EAGAIN || errno == ENAVAIL) && (micros () - startMicros < timeoutMicros)) {
-                delay (1);
-                continue;
+        __count__ (&__counters__, &ThreadSafePingCounters_t::recvfrom_calls);
+
+        if (bytes <= 0) {
+            if (errno == EAGAIN || errno == ENAVAIL) {
+                __count__ (&__counters__, &ThreadSafePingCounters_t::empty_reads);
+                unsigned long waitedMicros = micros () - startMicros;
+                if (waitedMicros < timeoutMicros) {
+                    // sleep until the next packet arrives on the socket (or until the time-out) instead of polling
+                    __waitForPacket__ (sockfd, -1, timeoutMicros - waitedMicros);
+                    continue;
+                }
             }
             return "timeout";
         }
 
-        // did we get at least all the data that we need?
-        byte type;
-        int id;
+        int received = bytes; // __parseEchoReply__ replaces bytes with the payload length
+        uint16_t id;
         uint16_t seqno;
-        unsigned long sentMicros;
+        int64_t sentMicros;
+        if (!__parseEchoReply__ (__isIPv6__, buf, &bytes, &id, &seqno, &sentMicros)) {
+            __count__ (&__counters__, &ThreadSafePingCounters_t::skipped);
+            continue;
+        }
 
-        if (__isIPv6__) {
-            if (*bytes < (int) (40 + sizeof (struct icmp6_echo_hdr) + sizeof (unsigned long)))
-                continue;
+        // the echo packet may have been sent through socket sockfd or through some other socket, either way it belongs to the slot of its sequence number
+        bool own = id == __id__;
+        if (own && __session__.options.verify && !__verifyEchoReply__ (__isIPv6__, buf, received, __session__.options.size)) {
+            __corrupted__++;
+            continue; // the echo request times out, unless another copy of the reply is good
+        }
+        int recorded = __recordReply__ (id, seqno, sentMicros, receivedMicros - sentMicros, bytes, own);
+        if (recorded == __REPLY_RECORDED__) {
+            if (own) {
+                __recv_overhead_count__++;
+                __recv_overhead__ += ((receivedMicros - readMicros) / 1000.0f - __recv_overhead__) / __recv_overhead_count__;
+                return NULL; // OK
+            }
+            __count__ (&__counters__, &ThreadSafePingCounters_t::cross_delivered);
+        } else if (own && recorded == __REPLY_STALE__) {
+            __count__ (&__counters__, &ThreadSafePingCounters_t::stale);
+        }
+        // else we picked up an echo packet that was sent from another socket or the sequence numbers do not match (its time-out has probably already been reported), continue waiting for our own echo packet
+    }
+}
 
-            // get the echo
-            struct icmp6_echo_hdr *iecho = (struct icmp6_echo_hdr *) (buf + 40);
+// the same as __ping_recv__, but the replies are picked up by the dispatcher task and pushed to the session's queue
+const char *ThreadSafePing_t::__ping_recv_queue__ (unsigned long timeoutMicros) {
+    unsigned long startMicros = micros ();
 
-            type = iecho->type;
-            id = iecho->id;
-            seqno = iecho->seqno;
-            sentMicros = *(unsigned long *) (((char *) iecho) + sizeof (struct icmp6_echo_hdr));
+    while (true) {
+        // sleep until the dispatcher pushes a reply (round the remaining time up to whole ticks), after the time-out only pick up the replies that are already waiting
+        unsigned long waitedMicros = micros () - startMicros;
+        TickType_t ticks = waitedMicros < timeoutMicros ? (timeoutMicros - waitedMicros + 1000UL * portTICK_PERIOD_MS - 1) / (1000UL * portTICK_PERIOD_MS) : 0;
+        __pingReply_t__ r;
+        if (xQueueReceive (__replyQueue__, &r, ticks) != pdTRUE)
+            return "timeout";
+        if (r.bytes < 0) {
+            __corrupted__++; // the dispatcher has verified it for us
+            continue;
+        }
 
-            // subtract IPv6 internet header and struct icmp6_echo_hdr header from *bytes
-            *bytes -= (40 + sizeof (struct icmp6_echo_hdr));
+        // is this echo request still in flight?
+        uint16_t seqno = __slotSeqno__ (r.state);
+        int recorded = __slotRecord__ (&__replies__ [seqno % PING_MAX_WINDOW], seqno, r.sent_time, r.elapsed_time, r.bytes, true);
+        if (recorded == __REPLY_RECORDED__)
+            return NULL; // OK
+        // else its time-out has probably already been reported
+        if (recorded == __REPLY_STALE__)
+            __count__ (&__counters__, &ThreadSafePingCounters_t::stale);
+    }
+}
 
-        } else {
-            struct ip_hdr *iphdr = (struct ip_hdr*) buf;
-            int iphdr_len = IPH_HL (iphdr) * 4;
+// the receive loop of the sessions that read their sockets without blocking: ThreadSafeMultiPing_t, ThreadSafePingSweep_t, ThreadSafePingHealthCheck_t, ThreadSafePingTraceroute_t and the dispatcher
+void ThreadSafePing_t::__drainSocket__ (int sockfd, bool isIPv6, char *buf, int bufSize, uint16_t firstId, int ids, ThreadSafePingCounters_t *counters, bool (*match) (void *context, const __packet_t__ *packet), void *context) {
+    struct sockaddr_in  from_addr_IPv4;
+    #if PING_IPV6
+        struct sockaddr_in6 from_addr_IPv6;
+    #endif
+    socklen_t fromlen;
+
+    __packet_t__ packet;
+    packet.sockfd = sockfd;
+    packet.isIPv6 = isIPv6;
+    packet.buf = buf;
+    #if PING_IPV6
+        packet.from = isIPv6 ? (struct sockaddr *) &from_addr_IPv6 : (struct sockaddr *) &from_addr_IPv4;
+    #else
+        packet.from = (struct sockaddr *) &from_addr_IPv4;
+    #endif
 
-            if (*bytes < (int) (iphdr_len + sizeof (struct icmp_echo_hdr) + sizeof (unsigned long)))
-                continue;
+    while (true) {
+        // read echo packet without waiting
+        __takeLwIpMutex__ (counters);
+            #if PING_IPV6
+                if (isIPv6) {
+                    fromlen = sizeof (from_addr_IPv6);
+                    packet.size = recvfrom (sockfd, buf, bufSize, 0, (struct sockaddr *) &from_addr_IPv6, &fromlen);
+                } else
+            #endif
+            {
+                fromlen = sizeof (from_addr_IPv4);
+                packet.size = recvfrom (sockfd, buf, bufSize, 0, (struct sockaddr *) &from_addr_IPv4, &fromlen);
+            }
+            packet.receivedMicros = __nowMicros__ (); // time-stamp the reply as soon as possible
+        xSemaphoreGive (getLwIpMutex ());
+        __count__ (counters, &ThreadSafePingCounters_t::recvfrom_calls);
+        if (packet.size <= 0) {
+            __count__ (counters, &ThreadSafePingCounters_t::empty_reads);
+            return; // nothing more is waiting
+        }
 
-            // get the echo
-            struct icmp_echo_hdr *iecho = (struct icmp_echo_hdr *) (buf + iphdr_len);
+        packet.bytes = packet.size; // __parseEchoReply__ replaces it with the payload length
+        packet.isEcho = __parseEchoReply__ (isIPv6, buf, &packet.bytes, &packet.id, &packet.seqno, &packet.sentMicros);
+        if (packet.isEcho && (packet.id < firstId || packet.id >= firstId + ids)) {
+            // we picked up an echo packet that was sent from another socket, write it where its owner will find it
+            if (__recordReply__ (packet.id, packet.seqno, packet.sentMicros, packet.receivedMicros - packet.sentMicros, packet.bytes, false) == __REPLY_RECORDED__)
+                __count__ (counters, &ThreadSafePingCounters_t::cross_delivered);
+            continue;
+        }
 
-            type = iecho->type;
-            id = iecho->id;
-            seqno = iecho->seqno;
-            sentMicros = *(unsigned long *) (((char *) iecho) + sizeof (struct icmp_echo_hdr));
+        if (!match (context, &packet))
+            __count__ (counters, &ThreadSafePingCounters_t::skipped);
+    }
+}
 
-            // subtract IPv4 internet header and icmp_echo_hdr from *bytes
-            *bytes -= (iphdr_len + sizeof (struct icmp_echo_hdr));
-        }
+// blocks until a packet is waiting on any of the sockets (-1 if not used) or until timeoutMicros passes, returns false on time-out
+bool ThreadSafePing_t::__waitForPacket__ (int sockfd1, int sockfd2, unsigned long timeoutMicros) {
+    fd_set readfds;
+    FD_ZERO (&readfds);
+    if (sockfd1 >= 0) FD_SET (sockfd1, &readfds);
+    if (sockfd2 >= 0) FD_SET (sockfd2, &readfds);
+
+    struct timeval tv;
+    tv.tv_sec = timeoutMicros / 1000000;
+    tv.tv_usec = timeoutMicros % 1000000;
+
+    // select doesn't need the lwIP mutex, other tasks can use lwIP meanwhile
+    int r = select ((sockfd1 > sockfd2 ? sockfd1 : sockfd2) + 1, &readfds, NULL, NULL, &tv);
+    if (r < 0) {
+        delay (1); // fall back to polling
+        return false;
+    }
+    return r > 0;
+}
 
-        // check if this is a reply we expected
-        if (id < LWIP_SOCKET_OFFSET || id >= LWIP_SOCKET_OFFSET + MEMP_NUM_NETCONN || !(type == ICMP_ER || type == ICMP6_ECHO_REPLY))
-            continue;
+// checks if buf contains an echo reply, extracts its id, sequence number and send time and subtracts the headers from *bytes, returns false if buf should be ignored
+bool ThreadSafePing_t::__parseEchoReply__ (bool isIPv6, char *buf, int *bytes, uint16_t *id, uint16_t *seqno, int64_t *sentMicros) {
+    // did we get at least all the data that we need?
+    byte type;
 
-        // now we should consider several options:
+    #if PING_IPV6
+    if (isIPv6) {
+        if (*bytes < (int) (40 + sizeof (struct icmp6_echo_hdr) + sizeof (int64_t)))
+            return false;
 
-        // did we pick up the echo packet that was send through the socket sockfd?
-        if (id == sockfd) {
+        // get the echo
+        struct icmp6_echo_hdr *iecho = (struct icmp6_echo_hdr *) (buf + 40);
 
-            // did we pick up the echo packet with the latest sequence number?
-            if (__getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET].seqno == seqno) {
-                // write information about the reply in the data structure
-                __getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET].elapsed_time = micros () - sentMicros;
-                return NULL; // OK
-            } // else the sequence numbers do not match, ignore this echo packet, its time-out has probably already been reported
-        } else {    // we picked up an echo packet that was sent from another socket
-            // did we pick up the echo packet with the latest sequence number?
-            if (__getPingReplies__ () [id - LWIP_SOCKET_OFFSET].seqno == seqno) {
-                // write information about the reply in the data structure
-                __getPingReplies__ () [id - LWIP_SOCKET_OFFSET].elapsed_time = micros () - sentMicros;
-                // do not return now, continue waiting for the right echo packet
-            } // else the sequence numbers do not match, ignore this echo packet, its time-out has probably already been reported
+        type = iecho->type;
+        *id = iecho->id;
+        *seqno = iecho->seqno;
+        memcpy (sentMicros, ((char *) iecho) + sizeof (struct icmp6_echo_hdr), sizeof (int64_t));
+
+        // the payload length is taken from the IPv6 header, so that it is right even if the reply has been truncated to fit into buf
+        *bytes = ((uint8_t) buf [4] << 8 | (uint8_t) buf [5]) - sizeof (struct icmp6_echo_hdr);
+
+    } else
+    #endif
+    {
+        struct ip_hdr *iphdr = (struct ip_hdr*) buf;
+        int iphdr_len = IPH_HL (iphdr) * 4;
+
+        if (*bytes < (int) (iphdr_len + sizeof (struct icmp_echo_hdr) + sizeof (int64_t)))
+            return false;
+
+        // get the echo
+        struct icmp_echo_hdr *iecho = (struct icmp_echo_hdr *) (buf + iphdr_len);
+
+        type = iecho->type;
+        *id = iecho->id;
+        *seqno = iecho->seqno;
+        memcpy (sentMicros, ((char *) iecho) + sizeof (struct icmp_echo_hdr), sizeof (int64_t));
+
+        // the total length is taken from the IPv4 header, so that the payload length is right even if the reply has been truncated to fit into buf
+        *bytes = ntohs (IPH_LEN (iphdr)) - (iphdr_len + sizeof (struct icmp_echo_hdr));
+    }
+
+    // check if this is a reply we expected
+    return type == ICMP_ER || type == ICMP6_ECHO_REPLY;
+}
+
+// the payload after the time stamp is (char) i at offset i, that is these 64 words over and over - Meyers singleton
+static const uint32_t *__patternWords__ () {
+    static union { uint32_t words [64]; uint8_t bytes [256]; } pattern = [] {
+        decltype (pattern) p;
+        for (int i = 0; i < 256; i++)
+            p.bytes [i] = (uint8_t) i;
+        return p;
+    } ();
+    return pattern.words;
+}
+
+// checks the length, the ICMP checksum and the payload of an echo reply of size bytes of payload, bytes is the number of bytes read into buf, returns true if the reply is intact
+bool ThreadSafePing_t::__verifyEchoReply__ (bool isIPv6, const char *buf, int bytes, int size) {
+    const char *icmp;
+    int icmpLen;
+    uint32_t sum;
+
+    #if PING_IPV6
+    if (isIPv6) {
+        icmp = buf + 40;
+        icmpLen = (uint8_t) buf [4] << 8 | (uint8_t) buf [5];
+        if (icmpLen != (int) sizeof (struct icmp6_echo_hdr) + size || bytes < 40 + icmpLen)
+            return false; // truncated, or not the size we sent
+
+        // the ICMPv6 checksum covers the pseudo header: the addresses, the length and the next header
+        uint8_t pseudo [8] = { 0, 0, (uint8_t) (icmpLen >> 8), (uint8_t) icmpLen, 0, 0, 0, IPPROTO_ICMPV6 };
+        sum = (uint16_t) ~inet_chksum (buf + 8, 32);
+        sum += (uint16_t) ~inet_chksum (pseudo, sizeof (pseudo));
+        sum += (uint16_t) ~inet_chksum (icmp, icmpLen);
+
+    } else
+    #endif
+    {
+        int iphdr_len = IPH_HL ((struct ip_hdr *) buf) * 4;
+        icmp = buf + iphdr_len;
+        icmpLen = ntohs (IPH_LEN ((struct ip_hdr *) buf)) - iphdr_len;
+        if (icmpLen != (int) sizeof (struct icmp_echo_hdr) + size || bytes < iphdr_len + icmpLen)
+            return false; // truncated, or not the size we sent
+
+        sum = (uint16_t) ~inet_chksum (icmp, icmpLen);
+    }
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    if (sum != 0xffff)
+        return false;
+
+    // compare the payload after the time stamp 32 bits at a time (the headers are multiples of 4 bytes long, so the words are aligned), without branches
+    const char *payload = icmp + sizeof (struct icmp_echo_hdr);
+    const uint32_t *words = (const uint32_t *) (payload + sizeof (int64_t));
+    const uint32_t *pattern = __patternWords__ ();
+    int n = (size - (int) sizeof (int64_t)) / 4;
+    uint32_t diff = 0;
+    for (int i = 0; i < n; i++)
+        diff |= words [i] ^ pattern [(sizeof (int64_t) / 4 + i) & 63];
+    for (int i = sizeof (int64_t) + 4 * n; i < size; i++)
+        diff |= (uint8_t) payload [i] ^ (uint8_t) i;
+    return diff == 0;
+}
+
+// writes the reply information into the slot of the echo request it belongs to, returns __REPLY_RECORDED__ if it was still in flight
+int ThreadSafePing_t::__recordReply__ (uint16_t id, uint16_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes, bool own) {
+    if (id < LWIP_SOCKET_OFFSET || id >= LWIP_SOCKET_OFFSET + MEMP_NUM_NETCONN)
+        return __REPLY_STALE__; // not sent by this library
+
+    return __slotRecord__ (&__getPingReplies__ () [id - LWIP_SOCKET_OFFSET][seqno % PING_MAX_WINDOW], seqno, sentMicros, elapsedMicros, bytes, own);
+}
+
+// prepares the slot for the echo request that is about to be sent, only the owner of the slot calls this, returns false if another task is just writing a late reply into it
+bool ThreadSafePing_t::__slotSend__ (__pingReply_t__ *reply, uint16_t seqno, bool verify) {
+    // take the slot away from late replies before touching it, they can only claim slots that are pending or expired
+    if (!__slotClear__ (reply))
+        return false;
+    reply->bytes = 0;
+    reply->verify = verify;
+    reply->elapsed_time = 0;
+    __atomic_store_n (&reply->copies, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&reply->duplicates, 0, __ATOMIC_RELAXED);
+    reply->sent_time = __nowMicros__ ();
+    __atomic_store_n (&reply->state, __slotWord__ (seqno, __SLOT_PENDING__), __ATOMIC_RELEASE);
+    return true;
+}
+
+// moves the slot into __SLOT_FREE__, unless some other task is just writing a reply into it (only the writer moves a slot out of __SLOT_CLAIMED__), returns false then
+bool ThreadSafePing_t::__slotClear__ (__pingReply_t__ *reply) {
+    uint32_t word = __atomic_load_n (&reply->state, __ATOMIC_RELAXED);
+    do {
+        if (__slotStateOf__ (word) == __SLOT_CLAIMED__)
+            return false;
+    } while (!__atomic_compare_exchange_n (&reply->state, &word, __slotWord__ (0, __SLOT_FREE__), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    return true;
+}
+
+// writes the reply information into the slot if its echo request is still in flight, returns __REPLY_RECORDED__ if it was
+// (if it is not and the copy has been read from the owner's socket, the reply is recorded as late or duplicate, so that the owner can count it)
+int ThreadSafePing_t::__slotRecord__ (__pingReply_t__ *reply, uint16_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes, bool own) {
+    uint32_t expected = __slotWord__ (seqno, __SLOT_PENDING__);
+    uint32_t state = __SLOT_ARRIVED__;
+    if (!__atomic_compare_exchange_n (&reply->state, &expected, __slotWord__ (seqno, __SLOT_CLAIMED__), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        // expected now holds the current state of the slot
+        if (!own)
+            return __REPLY_COPY__; // the owner will read its own copy of the reply
+        if (expected == __slotWord__ (seqno, __SLOT_CLAIMED__) || expected == __slotWord__ (seqno, __SLOT_ARRIVED__) || expected == __slotWord__ (seqno, __SLOT_REPORTED__) || expected == __slotWord__ (seqno, __SLOT_LATE__)) {
+            // the first copy may have been delivered (or may just be being delivered) by another task
+            if (__atomic_fetch_add (&reply->copies, 1, __ATOMIC_RELAXED) > 0)
+                __atomic_fetch_add (&reply->duplicates, 1, __ATOMIC_RELAXED);
+            return __REPLY_COPY__;
         }
+        if (expected != __slotWord__ (seqno, __SLOT_EXPIRED__) || !__atomic_compare_exchange_n (&reply->state, &expected, __slotWord__ (seqno, __SLOT_CLAIMED__), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return __REPLY_STALE__; // the slot has already been reused for another echo request
+        state = __SLOT_LATE__;
+    }
+
+    // each ping () begins with sequence number 1, so a reply to an echo request of an earlier ping () (through the same socket) may find the slot pending,
+    // it gives itself away by being sent before the slot has been prepared
+    if (sentMicros < reply->sent_time) {
+        expected = __slotWord__ (seqno, __SLOT_CLAIMED__);
+        __atomic_compare_exchange_n (&reply->state, &expected, __slotWord__ (seqno, state == __SLOT_ARRIVED__ ? __SLOT_PENDING__ : __SLOT_EXPIRED__), false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        return __REPLY_STALE__;
+    }
+    // an owner that verifies the replies only takes its own copy, the one it has checked
+    if (!own && reply->verify) {
+        expected = __slotWord__ (seqno, __SLOT_CLAIMED__);
+        __atomic_compare_exchange_n (&reply->state, &expected, __slotWord__ (seqno, __SLOT_PENDING__), false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        return __REPLY_COPY__;
     }
+    if (own)
+        __atomic_fetch_add (&reply->copies, 1, __ATOMIC_RELAXED);
+
+    reply->elapsed_time = elapsedMicros;
+    reply->bytes = bytes;
+
+    // publish the reply, unless the owner has reinitialized the slot meanwhile
+    expected = __slotWord__ (seqno, __SLOT_CLAIMED__);
+    if (!__atomic_compare_exchange_n (&reply->state, &expected, __slotWord__ (seqno, state), false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        return __REPLY_STALE__;
+    return state == __SLOT_ARRIVED__ ? __REPLY_RECORDED__ : __REPLY_STALE__;
+}
+
+// moves the slot into the new state (keeping its sequence number) if it is still in the state the owner has seen (word), returns false if the state has changed meanwhile
+bool ThreadSafePing_t::__slotRelease__ (__pingReply_t__ *reply, uint32_t word, uint32_t state) {
+    return __atomic_compare_exchange_n (&reply->state, &word, __slotWord__ (__slotSeqno__ (word), state), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
 }
@@ -25,12 +25,17 @@
 
 
     #include <WiFi.h>
+    #include <esp_timer.h>
     #include <lwip/netdb.h>
     #include <lwip/inet_chksum.h>
     #include <lwip/ip.h>
     #include <lwip/icmp.h>
     #include <LwIpMutex.h>
     #include <gai_strerror.h>
+    #include "ThreadSafePingHistogram.h"
+    #include "ThreadSafePingMonitor.h"
+    #include "ThreadSafePingResults.h"
+    #include "ThreadSafePingExporter.h"
 
 
     #ifndef ICMP6_TYPES_H
@@ -54,24 +59,139 @@
     #ifndef PING_DEFAULT_TIMEOUT
         #define PING_DEFAULT_TIMEOUT   1
     #endif
+    #ifndef PING_MTU
+        #define PING_MTU            1500    // MTU of the local interface, path MTU discovery doesn't look beyond it
+    #endif
+    #ifndef PING_MAX_SIZE
+        #define PING_MAX_SIZE       (PING_MTU - 28) // the largest payload that fits into a single IPv4 packet
+    #endif
+    #ifndef PING_STACK_MAX_SIZE
+        #define PING_STACK_MAX_SIZE  256    // echo requests and replies with payloads up to this size are built and received in stack buffers, larger ones in a buffer allocated by ping ()
+    #endif
+    #ifndef PING_DEFAULT_ON_WAIT
+        #define PING_DEFAULT_ON_WAIT   10000 // us, how often onWait () is called while waiting, 0 = never
+    #endif
+    #ifndef PING_DEFAULT_WINDOW
+        #define PING_DEFAULT_WINDOW    1    // the number of echo requests that can be in flight at the same time, 1 means stop-and-wait
+    #endif
+    #ifndef PING_MAX_WINDOW
+        #define PING_MAX_WINDOW        8
+    #endif
+    #if PING_MAX_WINDOW & (PING_MAX_WINDOW - 1)
+        #error "PING_MAX_WINDOW must be a power of 2, so that the slot of a sequence number doesn't change when its 16 bits wrap around"
+    #endif
+    #ifndef PING_DNS_CACHE_SIZE
+        #define PING_DNS_CACHE_SIZE    8    // the number of names kept in the DNS cache, 0 disables the cache
+    #endif
+    #ifndef PING_DNS_CACHE_TTL
+        #define PING_DNS_CACHE_TTL     300  // s
+    #endif
+    #ifndef PING_DNS_CACHE_NEGATIVE_TTL
+        #define PING_DNS_CACHE_NEGATIVE_TTL 30 // s, for names that could not be resolved
+    #endif
+    #ifndef PING_DNS_CACHE_NAME_LENGTH
+        #define PING_DNS_CACHE_NAME_LENGTH  64 // longer names are not cached
+    #endif
+    #ifndef PING_SOCKET_POOL_SIZE
+        #define PING_SOCKET_POOL_SIZE  2    // idle sockets kept open per address family for the following ping () calls, 0 closes them right away
+    #endif
+    // lwIP keeps delivering copies of all the ICMP packets to an idle raw socket, each holding a pbuf, up to the socket's receive mailbox
+    // size (DEFAULT_RAW_RECVMBOX_SIZE) - the pooled sockets are drained when released and taken, and closed by the next ping () when idle for longer than this
+    #ifndef PING_SOCKET_POOL_IDLE_TIMEOUT
+        #define PING_SOCKET_POOL_IDLE_TIMEOUT 10 // s
+    #endif
+    #ifndef PING_COUNTERS
+        #define PING_COUNTERS          1    // 0 compiles the instrumentation counters out of the send/receive path, they stay 0 then
+    #endif
+    #ifndef PING_IPV6
+        #define PING_IPV6              1    // 0 compiles IPv6 out: smaller instances and no address family branches on the send/receive path
+    #endif
+    #ifndef PING_TCPIP_CORE
+        #ifdef CONFIG_LWIP_TCPIP_TASK_AFFINITY
+            #define PING_TCPIP_CORE    CONFIG_LWIP_TCPIP_TASK_AFFINITY // the core lwIP's tcpip task is pinned to, tasks that probe are best pinned to it too
+        #else
+            #define PING_TCPIP_CORE    tskNO_AFFINITY
+        #endif
+    #endif
+    #if PING_IPV6
+        #define PING_ADDRSTRLEN        INET6_ADDRSTRLEN
+    #else
+        #define PING_ADDRSTRLEN        INET_ADDRSTRLEN
+    #endif
+
 
+    // how echo requests are scheduled
+    enum ThreadSafePingMode_t {
+        PING_MODE_INTERVAL = 0,     // an echo request each interval (as long as the window is not full)
+        PING_MODE_ADAPTIVE = 1,     // the next echo request as soon as a reply arrives, but not sooner than minGapMicros after the previous one and not later than interval (ping -A)
+        PING_MODE_FLOOD = 2         // keep window echo requests in flight, at rate echo requests per second at most (ping -f)
+    };
+
+    // all ping parameters in one place, interval and timeout with sub-second resolution
+    struct ThreadSafePingOptions_t {
+        int count = PING_DEFAULT_COUNT;                                     // 0 = ping until stop () is called
+        unsigned long intervalMicros = 1000000UL * PING_DEFAULT_INTERVAL;  // 1 ms - 3600 s, not used in PING_MODE_FLOOD
+        int size = PING_DEFAULT_SIZE;                                       // 4 - PING_MAX_SIZE bytes of payload, 4 - 7 are sent padded to the 8-byte time stamp but reported as requested
+        unsigned long timeoutMicros = 1000000UL * PING_DEFAULT_TIMEOUT;    // 1 ms - 30 s
+        int window = PING_DEFAULT_WINDOW;
+        ThreadSafePingMode_t mode = PING_MODE_INTERVAL;
+        unsigned long minGapMicros = 1000;                                  // PING_MODE_ADAPTIVE: 0 - interval
+        int rate = 0;                                                       // PING_MODE_FLOOD: 0 - 100000 echo requests per second, 0 = as fast as replies arrive
+        int ttl = 0;                                                        // 1 - 255 IPv4 time-to-live or IPv6 hop limit, 0 = lwIP default (routers' time exceeded messages are not replies, see ThreadSafePingTraceroute_t)
+        unsigned long onWaitMicros = PING_DEFAULT_ON_WAIT;                  // 1 ms - 3600 s between onWait () calls, 0 = never: each gap is then a single timed wait, so the core can idle (or light sleep) through it
+        bool verify = false;                                                // check the ICMP checksum, the length and the payload of each reply, corrupted ones count as corrupted () instead of received
+    };
 
-    class ThreadSafePing_t {
+
+    // instrumentation of the send/receive path, kept for each session and for all the sessions together
+    struct ThreadSafePingCounters_t {
+        uint32_t recvfrom_calls;
+        uint32_t empty_reads;                   // recvfrom calls that found nothing waiting (EAGAIN)
+        uint32_t skipped;                       // short packets and packets that are not echo replies
+        uint32_t cross_delivered;               // echo replies of other sockets, read from this socket and delivered to their owners before they read their own copies
+        uint32_t stale;                         // echo replies whose echo request was no longer in flight (late or slot already reused)
+        uint32_t send_failures;                 // sendto failures
+        uint32_t alloc_failures;                // ... of which lwIP couldn't allocate memory for the packet (ENOMEM, ENOBUFS)
+        uint32_t mutex_takes;                   // how many times the lwIP mutex was taken on the send/receive path
+        uint32_t mutex_wait_micros;             // ... and the total time spent waiting for it (wraps around after ~71 minutes, use differences)
+    };
+
+
+    // the target address and the statistics of pinging it: ThreadSafePing_t keeps them for its session, ThreadSafeMultiPing_t for each of its targets
+    class ThreadSafePingStatistics_t {
+
+        friend class ThreadSafePing_t;
+        friend class ThreadSafeMultiPing_t;
+        friend class ThreadSafePingDispatcher_t;
+        friend class ThreadSafePingHealthCheck_t;
+        friend class ThreadSafePingSweep_t;
+        friend class ThreadSafePingTraceroute_t;
+        #ifdef PING_HOST_BENCHMARK
+            friend class ThreadSafePingBenchmark_t; // only defined by the host build of extras/host/benchmark.cpp
+        #endif
 
         private:
-            bool __isIPv6__ = false;
-            char __pingTargetIp__ [INET6_ADDRSTRLEN] = "";
+            #if PING_IPV6
+                bool __isIPv6__ = false;
+            #else
+                static constexpr bool __isIPv6__ = false; // the branches that depend on it fold away
+            #endif
+            char __pingTargetIp__ [PING_ADDRSTRLEN] = "";
 
             struct sockaddr_in  __target_addr_IPv4__ = {};
-            struct sockaddr_in6 __target_addr_IPv6__ = {};
+            #if PING_IPV6
+                struct sockaddr_in6 __target_addr_IPv6__ = {};
+            #endif
 
             const char *__errText__ = nullptr;
 
             int __size__;
+            uint32_t __seqno__;                         // 32-bit, only its lower 16 bits are sent in echo requests
             uint32_t __sent__;
+            int64_t __start_time__ = 0;                 // when ping () started and finished (0 while it is still running), for the achieved rate
+            int64_t __finish_time__ = 0;
             uint32_t __received__;
             uint32_t __lost__;
-            bool __stopped__;
 
             float __elapsed_time__;
             float __min_time__;
@@ -80,21 +200,231 @@
             float __var_time__;
             float __last_mean_time__;
 
+            float __jitter__;                           // RFC 3550 interarrival jitter, in ms
+            float __previous_time__;                    // round-trip time of the previous reply, for jitter
+            uint32_t __highestSeqno__;                  // the highest sequence number that has been answered so far ...
+            int64_t __highestArrival__;                 // ... and when its reply arrived, for reordering detection
+            uint32_t __reordered__;
+            uint32_t __duplicates__;
+            uint32_t __late__;
+            uint32_t __corrupted__;
+            float __mean_late_time__;
+            ThreadSafePingCounters_t __counters__ = {};
+
+            float __send_overhead__;                    // mean time (in ms) between time-stamping an echo request and sendto returning
+            uint32_t __send_overhead_count__;
+            float __recv_overhead__;                    // mean time (in ms) between trying to read a reply and recvfrom returning (time-stamping it)
+            uint32_t __recv_overhead_count__;
+            ThreadSafePingHistogram_t *__histogram__ = nullptr; // optional, attached by setHistogram ()
+            ThreadSafePingMonitor_t *__monitor__ = nullptr;     // optional, attached by setMonitor ()
+            ThreadSafePingResults_t *__results__ = nullptr;     // optional, attached by setResults ()
+            uint8_t __resultsTag__ = 0;
+            ThreadSafePingExporter_t *__exporter__ = nullptr;   // optional, attached by setExporter ()
+            uint8_t __exporterTag__ = 0;
+
+            // 64-bit monotonic time base of round-trip times, it doesn't wrap around like 32-bit micros () does after ~71 minutes
+            static inline int64_t __nowMicros__ () { return esp_timer_get_time (); }
+
+            const char *__resolveTargetName__ (const char *pingTarget, int family = AF_UNSPEC);
+            const char *__resolveByDns__ (const char *pingTarget, int family);
+
+            void __resetStatistics__ (int size);
+            void __countReply__ (uint32_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes);
+            void __countLate__ (uint32_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes);
+            void __countLoss__ (uint32_t seqno, int64_t sentMicros);
+            void __pushResult__ (uint32_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes, uint8_t status);
+
+        public:
+            inline char *target () { return __pingTargetIp__; }
+            inline int size () { return __size__; }
+            inline uint32_t seqno () { return __seqno__; }
+
+            inline uint32_t sent () { return __sent__; }
+            inline uint32_t received () { return __received__; }
+            inline uint32_t lost () { return __lost__; }
+            inline float sent_rate () { int64_t d = (__finish_time__ ? __finish_time__ : __nowMicros__ ()) - __start_time__; return __start_time__ && d > 0 ? __sent__ * 1000000.0f / d : 0; } // achieved echo requests per second
+            inline float elapsed_time () { return __elapsed_time__; }
+            inline float min_time () { return __min_time__; }
+            inline float max_time () { return __max_time__; }
+            inline float mean_time () { return __mean_time__; }
+            inline float var_time () { return __var_time__; }
+
+            inline float jitter () { return __jitter__; }               // RFC 3550 interarrival jitter of round-trip times, in ms
+            inline uint32_t reordered () { return __reordered__; }      // replies that arrived after the reply to a later echo request
+            inline uint32_t duplicates () { return __duplicates__; }    // extra copies of replies
+            inline uint32_t late () { return __late__; }                // replies that arrived after their time-out (they are also counted as lost)
+            inline uint32_t corrupted () { return __corrupted__; }      // replies that failed verification (options.verify), their echo requests count as lost unless a good copy arrives
+            inline float mean_late_time () { return __mean_late_time__; }
+            inline float overhead_time () { return __send_overhead__ + __recv_overhead__; } // estimated time (in ms) the library itself adds to each round-trip time (sendto and recvfrom calls, including waiting for the lwIP mutex)
+
+            // percentiles are only available if a histogram is attached, it is reset by each ping () call and then updated with each reply
+            inline void setHistogram (ThreadSafePingHistogram_t *histogram) { __histogram__ = histogram; }
+            inline ThreadSafePingHistogram_t *histogram () { return __histogram__; }
+            inline float percentile_time (float percentile) { return __histogram__ ? __histogram__->percentile (percentile) : 0; } // in ms, for example percentile_time (99)
+
+            // sliding-window statistics for long-running pings (count = 0), the monitor is not reset by ping () and can be read from other tasks
+            inline void setMonitor (ThreadSafePingMonitor_t *monitor) { __monitor__ = monitor; }
+            inline ThreadSafePingMonitor_t *monitor () { return __monitor__; }
+
+            // a record of each reply, loss and late reply is pushed into the results queue, to be drained by another task, instead of (or besides) calling onReceive
+            inline void setResults (ThreadSafePingResults_t *results, uint8_t tag = 0) { __results__ = results; __resultsTag__ = tag; }
+            inline ThreadSafePingResults_t *results () { return __results__; }
+
+            // streams the same records to Serial, a LittleFS file or a UDP collector, the exporter can be shared by many sessions too
+            inline void setExporter (ThreadSafePingExporter_t *exporter, uint8_t tag = 0) { __exporter__ = exporter; __exporterTag__ = tag; }
+            inline ThreadSafePingExporter_t *exporter () { return __exporter__; }
+
+            inline const char *errText () { return __errText__; }
+
+            inline const ThreadSafePingCounters_t& counters () { return __counters__; } // reset by each ping () call
+
+            static void clearDnsCache ();
+    };
+
+
+    class ThreadSafePing_t : public ThreadSafePingStatistics_t {
+
+        friend class ThreadSafeMultiPing_t;
+        friend class ThreadSafePingDispatcher_t;
+        friend class ThreadSafePingHealthCheck_t;
+        friend class ThreadSafePingSweep_t;
+        friend class ThreadSafePingTraceroute_t;
+        #ifdef PING_HOST_BENCHMARK
+            friend class ThreadSafePingBenchmark_t; // only defined by the host build of extras/host/benchmark.cpp
+        #endif
+
+        private:
+            bool __stopped__;
+            SemaphoreHandle_t __wakeUp__ = NULL;        // given by stop (), created by the first ping ()
+            static ThreadSafePingCounters_t __globalCounters__;
+
+            // counts the event for the session (if not NULL, only the session's own task may pass it) and globally
+            static inline void __count__ (ThreadSafePingCounters_t *counters, uint32_t ThreadSafePingCounters_t::*counter, uint32_t n = 1) {
+                #if PING_COUNTERS
+                    if (counters) counters->*counter += n;
+                    __atomic_fetch_add (&(__globalCounters__.*counter), n, __ATOMIC_RELAXED);
+                #endif
+            }
+            static inline void __takeLwIpMutex__ (ThreadSafePingCounters_t *counters) {
+                #if PING_COUNTERS
+                    int64_t startMicros = __nowMicros__ ();
+                    xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+                    __count__ (counters, &ThreadSafePingCounters_t::mutex_takes);
+                    __count__ (counters, &ThreadSafePingCounters_t::mutex_wait_micros, __nowMicros__ () - startMicros);
+                #else
+                    xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+                #endif
+            }
+
+            // a slot can be written by any task that happens to receive the reply, so its state only changes atomically:
+            //   __SLOT_FREE__ -> __SLOT_PENDING__        the owner sends the echo request
+            //   __SLOT_PENDING__ -> __SLOT_CLAIMED__     a receiving task has claimed the slot and is writing the reply into it
+            //   __SLOT_CLAIMED__ -> __SLOT_ARRIVED__     the reply has been written, the owner can read bytes and elapsed_time now
+            //   __SLOT_ARRIVED__ -> __SLOT_REPORTED__    the owner has reported the reply
+            //   __SLOT_PENDING__ -> __SLOT_EXPIRED__     the owner has reported the time-out
+            //   __SLOT_EXPIRED__ -> __SLOT_CLAIMED__ -> __SLOT_LATE__    the reply arrived after its time-out has been reported
+            // the slot keeps its last state until the owner reuses it for another echo request
+            // only the task that has claimed a slot moves it out of __SLOT_CLAIMED__, the owner doesn't wait for it, it looks at the slot again later
+            // each raw socket gets its own copy of each reply, so only the copies read from the owner's socket count as duplicates and late replies,
+            // the other tasks only write the reply into the slot while it is still pending, to deliver it sooner
+            enum { __SLOT_FREE__ = 0, __SLOT_PENDING__ = 1, __SLOT_CLAIMED__ = 2, __SLOT_ARRIVED__ = 3, __SLOT_REPORTED__ = 4, __SLOT_EXPIRED__ = 5, __SLOT_LATE__ = 6 };
+            enum { __REPLY_RECORDED__ = 0, __REPLY_COPY__ = 1, __REPLY_STALE__ = 2 }; // results of recording a reply: in time, another copy of a recorded reply, late or slot already reused
+
             struct __pingReply_t__ {
-                uint16_t seqno;
-                unsigned long elapsed_time;
+                uint32_t state;                 // sequence number << 16 | slot state, packed so that both change with a single compare-and-swap
+                int bytes;
+                int64_t sent_time;              // __nowMicros__ () just before sending, needed to detect the time-out and the replies to earlier echo requests with the same sequence number
+                unsigned long elapsed_time;     // valid only in __SLOT_ARRIVED__ and __SLOT_LATE__ states, 0 is a valid round-trip time
+                uint32_t copies;                // copies of the reply read from the owner's socket, incremented atomically
+                uint32_t duplicates;            // ... after the first one
+                bool verify;                    // the owner verifies its own copy of the reply, other tasks don't deliver theirs
             };
 
+            static inline uint32_t __slotWord__ (uint16_t seqno, uint32_t state) { return ((uint32_t) seqno << 16) | state; }
+            static inline uint16_t __slotSeqno__ (uint32_t word) { return (uint16_t) (word >> 16); }
+            static inline uint32_t __slotStateOf__ (uint32_t word) { return word & 0x7; }
+            static inline bool __slotReported__ (uint32_t word) { return __slotStateOf__ (word) == __SLOT_FREE__ || __slotStateOf__ (word) >= __SLOT_REPORTED__; }
+
+            static bool __slotClear__ (__pingReply_t__ *reply);
+            static bool __slotSend__ (__pingReply_t__ *reply, uint16_t seqno, bool verify = false);
+            static inline uint32_t __slotState__ (__pingReply_t__ *reply) { return __atomic_load_n (&reply->state, __ATOMIC_ACQUIRE); } // __SLOT_CLAIMED__ while another task is writing the reply
+            static int __slotRecord__ (__pingReply_t__ *reply, uint16_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes, bool own);
+            static bool __slotRelease__ (__pingReply_t__ *reply, uint32_t word, uint32_t state);
+            static void __harvestSlot__ (ThreadSafePingStatistics_t *target, __pingReply_t__ *reply, int padding);
 
-            // internal data structure - one record per each available socket - Meyers singleton
-            inline __pingReply_t__* __getPingReplies__ () {
-                static __pingReply_t__ pingReplies [MEMP_NUM_NETCONN] = {};
+
+            // internal data structure - one record per each available socket and each echo request in flight (a slot is selected by seqno % PING_MAX_WINDOW) - Meyers singleton
+            static inline __pingReply_t__ (*__getPingReplies__ ()) [PING_MAX_WINDOW] {
+                static __pingReply_t__ pingReplies [MEMP_NUM_NETCONN][PING_MAX_WINDOW] = {};
                 return pingReplies;
             }
 
-            const char *__resolveTargetName__ (const char *pingTarget);
-            const char *__ping_send__ (int sockfd, uint16_t seqno, int size);
-            const char *__ping_recv__ (int sockfd, int *bytes, unsigned long timeoutMicros);
+            uint16_t __id__;                            // id of echo requests: the socket number or the dispatcher session id
+            __pingReply_t__ *__replies__ = nullptr;     // slots of the echo requests in flight
+            QueueHandle_t __replyQueue__ = NULL;        // replies pushed by the dispatcher task, NULL when the session uses its own socket
+
+            static inline int __paddingOf__ (int size) { return size < (int) sizeof (int64_t) ? (int) sizeof (int64_t) - size : 0; } // payloads of 4 - 7 bytes are padded to hold the 64-bit time stamp
+            static void __buildPacket__ (char *packet, bool isIPv6, uint16_t id, int size);
+            static int64_t __stampPacket__ (char *packet);
+            static const char *__ping_send__ (ThreadSafePingStatistics_t *target, int sockfd, char *packet, uint16_t seqno, int size);
+            const char *__ping_recv__ (int sockfd, char *buf, int bufSize, unsigned long timeoutMicros);
+            const char *__ping_recv_queue__ (unsigned long timeoutMicros);
+
+            // a packet read by __drainSocket__
+            struct __packet_t__ {
+                int sockfd;                             // the socket it has been read from
+                bool isIPv6;
+                const char *buf;                        // the whole packet, including the IP header (for verification and for ICMP errors)
+                int size;                               // its length
+                const struct sockaddr *from;            // struct sockaddr_in or struct sockaddr_in6
+                int64_t receivedMicros;
+                bool isEcho;                            // an echo reply, the fields below are valid
+                uint16_t id;
+                uint16_t seqno;
+                int64_t sentMicros;
+                int bytes;                              // payload length
+            };
+            // reads the packets waiting on a non-blocking socket, writes the echo replies with ids outside [firstId, firstId + ids) where their owners will find them and passes the others to match, which returns false if a packet is none of its business
+            static void __drainSocket__ (int sockfd, bool isIPv6, char *buf, int bufSize, uint16_t firstId, int ids, ThreadSafePingCounters_t *counters, bool (*match) (void *context, const __packet_t__ *packet), void *context);
+
+            void __sleepMicros__ (unsigned long us);
+            static bool __waitForPacket__ (int sockfd1, int sockfd2, unsigned long timeoutMicros);
+            static int __takeSocket__ (bool isIPv6, const char **errText); // returns non-blocking socket or -1 (errText is set then)
+            static void __releaseSocket__ (int sockfd, bool isIPv6);
+            static const char *__setTtl__ (int sockfd, bool isIPv6, int ttl, int *previousTtl = NULL); // returns error text or NULL if OK
+            static bool __parseEchoReply__ (bool isIPv6, char *buf, int *bytes, uint16_t *id, uint16_t *seqno, int64_t *sentMicros);
+            static bool __verifyEchoReply__ (bool isIPv6, const char *buf, int bytes, int size); // buf must be 32-bit aligned
+
+            static int __recordReply__ (uint16_t id, uint16_t seqno, int64_t sentMicros, unsigned long elapsedMicros, int bytes, bool own);
+
+            const char *__probeSize__ (int size, int attempts, unsigned long timeoutMicros, bool *gotThrough);
+
+            // the state of a running session, kept between poll () calls
+            struct __session_t__ {
+                ThreadSafePingOptions_t options;        // checked, in PING_MODE_FLOOD intervalMicros is the gap between echo requests, size includes the padding
+                int padding;                            // bytes added to payloads too short for the time stamp, not reported
+                int sockfd;
+                int dispatcherSession;                  // -1 if the session uses its own socket
+                int previousTtl;                        // restored when the socket goes back to the pool
+                char *packet;                           // the echo request template
+                char *buf;                              // for the replies
+                int bufSize;
+                uint32_t *heapBuffer;                   // packet and buf, if they are not on the caller's stack
+                uint32_t nextSeqno;                     // the sequence number of the next echo request, 32-bit so that it doesn't wrap around in continuous mode
+                uint32_t oldestSeqno;                   // the sequence number of the oldest echo request still in flight (if any)
+                int inFlight;
+                unsigned long dueMicros;                // when the next echo request is due
+                unsigned long lastSendMicros;
+                unsigned long waitMicros;               // when onWait () has been called the last time
+                bool running;
+            };
+            __session_t__ __session__ = {};
+
+            const char *__begin__ (const ThreadSafePingOptions_t& options, char *packet, char *buf, int bufSize);
+            bool __poll__ (bool block);
+            void __end__ ();
+
+            int __path_mtu__ = 0;
 
             err_t __errno__ = ERR_OK;
 
@@ -102,37 +432,52 @@
             ThreadSafePing_t () {}
             ThreadSafePing_t (const char *pingTarget);
             ThreadSafePing_t (const IPAddress& pingTarget);
+            virtual ~ThreadSafePing_t () { if (__wakeUp__) vSemaphoreDelete (__wakeUp__); }
 
             const char *ping (const char *pingTarget, int count = PING_DEFAULT_COUNT,
                               int interval = PING_DEFAULT_INTERVAL,
                               int size = PING_DEFAULT_SIZE,
-                              int timeout = PING_DEFAULT_TIMEOUT);
+                              int timeout = PING_DEFAULT_TIMEOUT,
+                              int window = PING_DEFAULT_WINDOW);
 
             const char *ping (const IPAddress& pingTarget, int count = PING_DEFAULT_COUNT,
                               int interval = PING_DEFAULT_INTERVAL,
                               int size = PING_DEFAULT_SIZE,
-                              int timeout = PING_DEFAULT_TIMEOUT);
+                              int timeout = PING_DEFAULT_TIMEOUT,
+                              int window = PING_DEFAULT_WINDOW);
 
             // if the target is set by constructor
             const char *ping (int count = PING_DEFAULT_COUNT,
                               int interval = PING_DEFAULT_INTERVAL,
                               int size = PING_DEFAULT_SIZE,
-                              int timeout = PING_DEFAULT_TIMEOUT);
-
-            inline char *target () { return __pingTargetIp__; }
-            inline int size () { return __size__; }
-            inline void stop () { __stopped__ = true; }
-
-            inline uint32_t sent () { return __sent__; }
-            inline uint32_t received () { return __received__; }
-            inline uint32_t lost () { return __lost__; }
-            inline float elapsed_time () { return __elapsed_time__; }
-            inline float min_time () { return __min_time__; }
-            inline float max_time () { return __max_time__; }
-            inline float mean_time () { return __mean_time__; }
-            inline float var_time () { return __var_time__; }
-
-            inline const char *errText () { return __errText__; }
+                              int timeout = PING_DEFAULT_TIMEOUT,
+                              int window = PING_DEFAULT_WINDOW);
+
+            const char *ping (const char *pingTarget, const ThreadSafePingOptions_t& options);
+            const char *ping (const IPAddress& pingTarget, const ThreadSafePingOptions_t& options);
+            const char *ping (const ThreadSafePingOptions_t& options); // if the target is set by constructor
+
+            // the same as ping (), but without blocking: begin () starts the session and each poll () call sends the echo requests that are due and reports
+            // the replies and time-outs (through onReceive and onWait) that have arrived meanwhile, so a single task (or loop ()) can drive many sessions,
+            // a reply is time-stamped when poll () reads it, so poll often (or start ThreadSafePingDispatcher_t, whose task time-stamps the replies as they arrive)
+            const char *begin (const char *pingTarget, const ThreadSafePingOptions_t& options = ThreadSafePingOptions_t ());
+            const char *begin (const IPAddress& pingTarget, const ThreadSafePingOptions_t& options = ThreadSafePingOptions_t ());
+            const char *begin (const ThreadSafePingOptions_t& options = ThreadSafePingOptions_t ()); // if the target is set by constructor
+            bool poll ();                                                   // returns true when the session is done, errText () tells if it has failed
+            inline bool isDone () { return !__session__.running; }
+
+            // finds the largest echo request that gets to the target and back with a binary search among the payload sizes up to PING_MTU,
+            // each size is tried up to attempts times, returns error text or NULL if OK (lwIP can't set the Don't-Fragment bit,
+            // so the result is the largest packet that gets through, it is reliable when the path drops fragments, as tunnels usually do)
+            const char *discoverPathMtu (const char *pingTarget, int attempts = 3, unsigned long timeoutMicros = 1000000UL * PING_DEFAULT_TIMEOUT);
+            const char *discoverPathMtu (int attempts = 3, unsigned long timeoutMicros = 1000000UL * PING_DEFAULT_TIMEOUT); // if the target is set by constructor
+            inline int path_mtu () { return __path_mtu__; } // the size of the largest IP packet that got through, 0 if none did
+
+            inline void stop () { __stopped__ = true; if (__wakeUp__) xSemaphoreGive (__wakeUp__); } // a session waiting for the next echo request stops right away
+            static ThreadSafePingCounters_t globalCounters ();
+            static void resetGlobalCounters ();
+
+            static void closeIdleSockets (); // closes the sockets kept in the pool
 
             virtual void onReceive (int bytes) {}
             virtual void onWait () {}
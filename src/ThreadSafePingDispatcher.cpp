@@ -0,0 +1,397 @@
+/*
+    ThreadSafePingDispatcher.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafePingDispatcher.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <lwip/tcpip.h>
+#include <lwip/pbuf.h>
+#include <lwip/inet_chksum.h>
+
+
+ThreadSafePingDispatcher_t::__session_t__ ThreadSafePingDispatcher_t::__sessions__ [PING_DISPATCHER_MAX_SESSIONS] = {};
+int ThreadSafePingDispatcher_t::__sockfdIPv4__ = -1;
+int ThreadSafePingDispatcher_t::__sockfdIPv6__ = -1;
+TaskHandle_t ThreadSafePingDispatcher_t::__task__ = NULL;
+struct raw_pcb *ThreadSafePingDispatcher_t::__pcbIPv4__ = NULL;
+struct raw_pcb *ThreadSafePingDispatcher_t::__pcbIPv6__ = NULL;
+bool ThreadSafePingDispatcher_t::__ending__ = false;
+SemaphoreHandle_t ThreadSafePingDispatcher_t::__done__ = NULL;
+
+
+struct __rawPcbs_t__ {
+    struct tcpip_api_call_data call;    // first, tcpip_api_call passes a pointer to it
+    struct raw_pcb *pcbIPv4;
+    struct raw_pcb *pcbIPv6;
+};
+
+// singleton mutex, it only guards begin () and end (), so that the lwIP mutex is not held while creating the task and the queues
+static SemaphoreHandle_t __getBeginMutex__ () {
+    static SemaphoreHandle_t semaphore = xSemaphoreCreateMutex ();
+    return semaphore;
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingDispatcher_t::begin (const ThreadSafePingDispatcherOptions_t& options) {
+    const char *errText = NULL;
+
+    if (!options.rawApi && (((options.core < 0 || options.core >= portNUM_PROCESSORS) && options.core != tskNO_AFFINITY) ||
+                            options.priority < 1 || options.priority >= configMAX_PRIORITIES ||
+                            options.stackSize < 2 * 1024 || options.stackSize > 64 * 1024))
+        return "invalid value";
+
+    xSemaphoreTake (__getBeginMutex__ (), portMAX_DELAY);
+        if (running ()) {
+            xSemaphoreGive (__getBeginMutex__ ());
+            return NULL; // already running
+        }
+
+        if (options.rawApi) {
+            for (int i = 0; i < PING_DISPATCHER_MAX_SESSIONS && !errText; i++)
+                if (!(__sessions__ [i].queue = xQueueCreate (2 * PING_MAX_WINDOW, sizeof (ThreadSafePing_t::__pingReply_t__))))
+                    errText = "out of memory";
+
+            // the raw_pcbs can only be created in the tcpip thread, sessions start using them as soon as __pcbIPv4__ is set
+            __rawPcbs_t__ b = { {}, NULL, NULL };
+            if (!errText && tcpip_api_call (__rawBegin__, &b.call) != ERR_OK)
+                errText = "couldn't create raw_pcb"; // lwIP is out of raw_pcbs (MEMP_NUM_RAW_PCB)
+            if (!errText) {
+                __atomic_store_n (&__sockfdIPv4__, PING_DISPATCHER_RAW_API, __ATOMIC_RELAXED);
+                __atomic_store_n (&__sockfdIPv6__, b.pcbIPv6 ? PING_DISPATCHER_RAW_API : -1, __ATOMIC_RELAXED);
+                __atomic_store_n (&__pcbIPv6__, b.pcbIPv6, __ATOMIC_RELAXED);
+                __freeSessions__ ();
+                __atomic_store_n (&__pcbIPv4__, b.pcbIPv4, __ATOMIC_RELEASE);
+            }
+        } else {
+            xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+                __sockfdIPv4__ = socket (AF_INET, SOCK_RAW, IPPROTO_ICMP);
+                if (__sockfdIPv4__ < 0 || fcntl (__sockfdIPv4__, F_SETFL, O_NONBLOCK) == -1)
+                    errText = strerror (errno);
+
+                // IPv6 is optional, if it is not available IPv6 sessions will just use their own sockets
+                #if PING_IPV6
+                    __sockfdIPv6__ = socket (AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
+                    if (__sockfdIPv6__ >= 0 && fcntl (__sockfdIPv6__, F_SETFL, O_NONBLOCK) == -1) {
+                        close (__sockfdIPv6__);
+                        __sockfdIPv6__ = -1;
+                    }
+                #endif
+            xSemaphoreGive (getLwIpMutex ());
+
+            if (!errText)
+                for (int i = 0; i < PING_DISPATCHER_MAX_SESSIONS && !errText; i++)
+                    if (!(__sessions__ [i].queue = xQueueCreate (2 * PING_MAX_WINDOW, sizeof (ThreadSafePing_t::__pingReply_t__))))
+                        errText = "out of memory";
+            if (!errText && !(__done__ = xSemaphoreCreateBinary ()))
+                errText = "out of memory";
+
+            // sessions start using the dispatcher's sockets as soon as __task__ is set
+            TaskHandle_t task = NULL;
+            __ending__ = false;
+            if (!errText && (xTaskCreatePinnedToCore (__dispatcherTask__, "ping_dispatcher", options.stackSize, NULL, options.priority, &task, options.core) != pdPASS))
+                errText = "out of memory";
+            if (!errText) {
+                __freeSessions__ ();
+                __atomic_store_n (&__task__, task, __ATOMIC_RELEASE);
+            }
+
+            if (errText) {
+                xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+                    if (__sockfdIPv4__ >= 0) close (__sockfdIPv4__);
+                    if (__sockfdIPv6__ >= 0) close (__sockfdIPv6__);
+                xSemaphoreGive (getLwIpMutex ());
+                if (__done__) vSemaphoreDelete (__done__);
+                __done__ = NULL;
+            }
+        }
+
+        if (errText) {
+            __sockfdIPv4__ = __sockfdIPv6__ = -1;
+            __deleteQueues__ ();
+        }
+    xSemaphoreGive (__getBeginMutex__ ());
+
+    return errText;
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingDispatcher_t::end () {
+    xSemaphoreTake (__getBeginMutex__ (), portMAX_DELAY);
+        if (!running ()) {
+            xSemaphoreGive (__getBeginMutex__ ());
+            return NULL; // not running
+        }
+
+        // claim all the sessions, so that nobody can register any more, unless some are still in use
+        int claimed = 0;
+        for (uint32_t expected = __SESSION_FREE__; claimed < PING_DISPATCHER_MAX_SESSIONS; claimed++, expected = __SESSION_FREE__)
+            if (!__atomic_compare_exchange_n (&__sessions__ [claimed].state, &expected, __SESSION_CLAIMED__, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                break;
+        if (claimed < PING_DISPATCHER_MAX_SESSIONS) {
+            while (claimed--)
+                __atomic_store_n (&__sessions__ [claimed].state, __SESSION_FREE__, __ATOMIC_RELEASE);
+            xSemaphoreGive (__getBeginMutex__ ());
+            return "sessions still running";
+        }
+        // the sessions stay claimed until the next begin (), so that a session that has just seen the dispatcher running can't register and uses its own socket
+
+        if (rawApi ()) {
+            // after the raw_pcbs are removed in the tcpip thread __rawRecv__ is not called any more
+            __rawPcbs_t__ b = { {}, __pcbIPv4__, __pcbIPv6__ };
+            __atomic_store_n (&__pcbIPv4__, (struct raw_pcb *) NULL, __ATOMIC_RELEASE);
+            __atomic_store_n (&__pcbIPv6__, (struct raw_pcb *) NULL, __ATOMIC_RELAXED);
+            tcpip_api_call (__rawEnd__, &b.call);
+        } else {
+            // the dispatcher task notices __ending__ when __waitForPacket__ times out at the latest
+            __atomic_store_n (&__task__, (TaskHandle_t) NULL, __ATOMIC_RELEASE);
+            __atomic_store_n (&__ending__, true, __ATOMIC_RELEASE);
+            xSemaphoreTake (__done__, portMAX_DELAY);
+            vSemaphoreDelete (__done__);
+            __done__ = NULL;
+
+            xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+                close (__sockfdIPv4__);
+                if (__sockfdIPv6__ >= 0) close (__sockfdIPv6__);
+            xSemaphoreGive (getLwIpMutex ());
+        }
+
+        __atomic_store_n (&__sockfdIPv4__, -1, __ATOMIC_RELAXED);
+        __atomic_store_n (&__sockfdIPv6__, -1, __ATOMIC_RELAXED);
+        __deleteQueues__ ();
+    xSemaphoreGive (__getBeginMutex__ ());
+
+    return NULL;
+}
+
+// makes the sessions available for registering, after begin () has created their queues
+void ThreadSafePingDispatcher_t::__freeSessions__ () {
+    for (int i = 0; i < PING_DISPATCHER_MAX_SESSIONS; i++)
+        __atomic_store_n (&__sessions__ [i].state, __SESSION_FREE__, __ATOMIC_RELEASE);
+}
+
+void ThreadSafePingDispatcher_t::__deleteQueues__ () {
+    for (int i = 0; i < PING_DISPATCHER_MAX_SESSIONS; i++)
+        if (__sessions__ [i].queue) {
+            vQueueDelete (__sessions__ [i].queue);
+            __sessions__ [i].queue = NULL;
+        }
+}
+
+void ThreadSafePingDispatcher_t::__dispatcherTask__ (void *param) {
+    while (!__atomic_load_n (&__ending__, __ATOMIC_ACQUIRE)) {
+        // sleep until a packet arrives
+        ThreadSafePing_t::__waitForPacket__ (__sockfdIPv4__, __sockfdIPv6__, 1000000);
+
+        __dispatch__ (__sockfdIPv4__, false);
+        if (__sockfdIPv6__ >= 0)
+            __dispatch__ (__sockfdIPv6__, true);
+    }
+
+    xSemaphoreGive (__done__);
+    vTaskDelete (NULL);
+}
+
+// reads all the packets waiting on the socket and pushes the echo replies to the sessions they belong to
+void ThreadSafePingDispatcher_t::__dispatch__ (int sockfd, bool isIPv6) {
+    static char buf [60 + sizeof (struct icmp_echo_hdr) + PING_MAX_SIZE] __attribute__ ((aligned (4))); // the longest IPv4 header, static since only the dispatcher task uses it
+    ThreadSafePing_t::__drainSocket__ (sockfd, isIPv6, buf, sizeof (buf), PING_DISPATCHER_ID_BASE, PING_DISPATCHER_MAX_SESSIONS, NULL, __match__, NULL);
+}
+
+// pushes an echo reply to the dispatcher session it belongs to
+bool ThreadSafePingDispatcher_t::__match__ (void *context, const ThreadSafePing_t::__packet_t__ *packet) {
+    if (!packet->isEcho)
+        return false;
+
+    uint32_t state = __sessionState__ (packet->id);
+    if (!(state & __SESSION_OPEN__))
+        return true; // the session has already ended
+
+    ThreadSafePing_t::__pingReply_t__ reply = { ThreadSafePing_t::__slotWord__ (packet->seqno, ThreadSafePing_t::__SLOT_ARRIVED__), packet->bytes, packet->sentMicros, (unsigned long) (packet->receivedMicros - packet->sentMicros), 0, 0, false };
+    if ((state & __SESSION_VERIFY__) && !ThreadSafePing_t::__verifyEchoReply__ (packet->isIPv6, packet->buf, packet->size, state >> 16))
+        reply.bytes = -1; // for the session to count as corrupted
+    __deliver__ (packet->id, &reply);
+    return true;
+}
+
+// wakes up the session, it will check itself if the echo request is still in flight - never waits, if the queue is full the reply is lost, like on a full socket
+void ThreadSafePingDispatcher_t::__deliver__ (uint16_t id, const ThreadSafePing_t::__pingReply_t__ *reply) {
+    xQueueSend (__sessions__ [id - PING_DISPATCHER_ID_BASE].queue, reply, 0);
+}
+
+// creates the raw_pcbs
+err_t ThreadSafePingDispatcher_t::__rawBegin__ (struct tcpip_api_call_data *call) {
+    __rawPcbs_t__ *b = (__rawPcbs_t__ *) call;
+
+    b->pcbIPv4 = raw_new (IPPROTO_ICMP);
+    if (!b->pcbIPv4)
+        return ERR_MEM; // before the IPv6 one is created, so that there is nothing to free
+    raw_recv (b->pcbIPv4, __rawRecv__, (void *) 0);
+
+    // IPv6 is optional, if it is not available IPv6 sessions will just use their own sockets
+    #if PING_IPV6
+        b->pcbIPv6 = raw_new_ip_type (IPADDR_TYPE_V6, IPPROTO_ICMPV6);
+        if (b->pcbIPv6) {
+            b->pcbIPv6->chksum_reqd = 1; // lwIP calculates the ICMPv6 checksum together with the pseudo header
+            b->pcbIPv6->chksum_offset = 2;
+            raw_recv (b->pcbIPv6, __rawRecv__, (void *) 1);
+        }
+    #endif
+    return ERR_OK;
+}
+
+// removes the raw_pcbs
+err_t ThreadSafePingDispatcher_t::__rawEnd__ (struct tcpip_api_call_data *call) {
+    __rawPcbs_t__ *b = (__rawPcbs_t__ *) call;
+
+    raw_remove (b->pcbIPv4);
+    if (b->pcbIPv6)
+        raw_remove (b->pcbIPv6);
+    return ERR_OK;
+}
+
+// ThreadSafePing_t::__verifyEchoReply__ in place, over the pbuf chain, header is the copy of the reply's headers that __rawRecv__ has parsed
+static bool __verifyPbuf__ (bool isIPv6, const struct pbuf *p, const char *header, int size) {
+    int icmpStart;
+    int icmpLen;
+    uint32_t sum = 0;
+
+    #if PING_IPV6
+    if (isIPv6) {
+        icmpStart = 40;
+        icmpLen = (uint8_t) header [4] << 8 | (uint8_t) header [5];
+        if (icmpLen != (int) sizeof (struct icmp6_echo_hdr) + size || p->tot_len < icmpStart + icmpLen)
+            return false; // truncated, or not the size we sent
+
+        // the ICMPv6 checksum covers the pseudo header: the addresses, the length and the next header
+        uint8_t pseudo [8] = { 0, 0, (uint8_t) (icmpLen >> 8), (uint8_t) icmpLen, 0, 0, 0, IPPROTO_ICMPV6 };
+        sum = (uint16_t) ~inet_chksum (header + 8, 32);
+        sum += (uint16_t) ~inet_chksum (pseudo, sizeof (pseudo));
+
+    } else
+    #endif
+    {
+        icmpStart = IPH_HL ((const struct ip_hdr *) header) * 4;
+        icmpLen = ntohs (IPH_LEN ((const struct ip_hdr *) header)) - icmpStart;
+        if (icmpLen != (int) sizeof (struct icmp_echo_hdr) + size || p->tot_len < icmpStart + icmpLen)
+            return false; // truncated, or not the size we sent
+    }
+
+    // a single pass over the segments: add up the ICMP checksum and compare the payload after the time stamp with what __buildPacket__ has filled it with
+    int payloadStart = icmpStart + (int) sizeof (struct icmp_echo_hdr);
+    int end = icmpStart + icmpLen;
+    uint32_t diff = 0;
+    int offset = 0; // of segment q in the packet
+    for (const struct pbuf *q = p; q && offset < end; offset += q->len, q = q->next) {
+        const uint8_t *data = (const uint8_t *) q->payload;
+        int from = icmpStart > offset ? icmpStart - offset : 0;
+        int to = end - offset < q->len ? end - offset : q->len;
+        if (from >= to)
+            continue;
+
+        uint32_t s = (uint16_t) ~inet_chksum (data + from, to - from);
+        sum += (offset + from - icmpStart) & 1 ? ((s << 8) | (s >> 8)) & 0xffff : s; // the 16-bit words of a segment that starts at an odd offset have their bytes swapped
+
+        int i = payloadStart + (int) sizeof (int64_t) - offset;
+        for (i = i > from ? i : from; i < to; i++)
+            diff |= data [i] ^ (uint8_t) (offset + i - payloadStart);
+    }
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return sum == 0xffff && diff == 0;
+}
+
+// called by lwIP in the tcpip thread for each ICMP packet that arrives, before the raw sockets get their copies of it
+u8_t ThreadSafePingDispatcher_t::__rawRecv__ (void *arg, struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *addr) {
+    int64_t receivedMicros = ThreadSafePing_t::__nowMicros__ (); // time-stamp the reply right where it arrives
+    bool isIPv6 = arg != NULL;
+
+    // look only at the headers and the time stamp, leave the payload in the pbuf
+    char buf [60 + sizeof (struct icmp_echo_hdr) + sizeof (int64_t)];
+    int bytes = pbuf_copy_partial (p, buf, sizeof (buf), 0);
+
+    uint16_t id;
+    uint16_t seqno;
+    int64_t sentMicros;
+    if (!ThreadSafePing_t::__parseEchoReply__ (isIPv6, buf, &bytes, &id, &seqno, &sentMicros) || id < PING_DISPATCHER_ID_BASE || id >= PING_DISPATCHER_ID_BASE + PING_DISPATCHER_MAX_SESSIONS)
+        return 0; // not ours, let the raw sockets have it
+
+    uint32_t state = __sessionState__ (id);
+    if (state & __SESSION_OPEN__) {
+        ThreadSafePing_t::__pingReply_t__ reply = { ThreadSafePing_t::__slotWord__ (seqno, ThreadSafePing_t::__SLOT_ARRIVED__), bytes, sentMicros, (unsigned long) (receivedMicros - sentMicros), 0, 0, false };
+        if ((state & __SESSION_VERIFY__) && !__verifyPbuf__ (isIPv6, p, buf, state >> 16))
+            reply.bytes = -1; // for the session to count as corrupted
+        __deliver__ (id, &reply);
+    }
+
+    pbuf_free (p);
+    return 1; // eaten, nobody else needs it
+}
+
+struct __rawSend_t__ {
+    struct tcpip_api_call_data call;    // first, tcpip_api_call passes a pointer to it
+    struct raw_pcb *pcb;
+    char *packet;
+    int size;
+    ip_addr_t to;
+    int64_t sendMicros;
+};
+
+err_t ThreadSafePingDispatcher_t::__rawSendInTcpipThread__ (struct tcpip_api_call_data *call) {
+    __rawSend_t__ *r = (__rawSend_t__ *) call;
+
+    // time-stamp the echo request right before it is handed over to IP
+    r->sendMicros = ThreadSafePing_t::__stampPacket__ (r->packet);
+
+    struct pbuf *p = pbuf_alloc (PBUF_IP, r->size, PBUF_RAM);
+    if (!p)
+        return ERR_MEM;
+    pbuf_take (p, r->packet, r->size);
+    err_t err = raw_sendto (r->pcb, p, &r->to);
+    pbuf_free (p);
+    return err;
+}
+
+// sends the echo request through the raw_pcb, returns bytes sent or -1
+int ThreadSafePingDispatcher_t::__rawSend__ (bool isIPv6, char *packet, int size, const struct sockaddr *to, int64_t *sendMicros, int *sendErrno) {
+    __rawSend_t__ r = { {}, __atomic_load_n (isIPv6 ? &__pcbIPv6__ : &__pcbIPv4__, __ATOMIC_ACQUIRE), packet, size, {}, 0 };
+    #if PING_IPV6
+        if (isIPv6) {
+            u32_t a [4];
+            memcpy (a, &((const struct sockaddr_in6 *) to)->sin6_addr, sizeof (a));
+            IP_ADDR6 (&r.to, a [0], a [1], a [2], a [3]);
+        } else
+    #endif
+    ip_addr_set_ip4_u32 (&r.to, ((const struct sockaddr_in *) to)->sin_addr.s_addr);
+
+    // tcpip_api_call waits for the tcpip thread on a semaphore of the calling task (or calls right away under lwIP's core lock), the senders don't queue up behind the lwIP mutex
+    err_t err = tcpip_api_call (__rawSendInTcpipThread__, &r.call);
+
+    *sendMicros = r.sendMicros;
+    *sendErrno = err == ERR_MEM ? ENOMEM : EIO;
+    return err == ERR_OK ? size : -1;
+}
+
+// returns session number or -1 if there is no free slot
+int ThreadSafePingDispatcher_t::__register__ (bool verify, int size) {
+    for (int i = 0; i < PING_DISPATCHER_MAX_SESSIONS; i++) {
+        uint32_t expected = __SESSION_FREE__;
+        if (__atomic_compare_exchange_n (&__sessions__ [i].state, &expected, __SESSION_CLAIMED__, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            // nothing is delivered to a claimed session, so its queue and its slots can be reset, a reply of the previous session that is just being pushed is then filtered out by the slot states as stale
+            xQueueReset (__sessions__ [i].queue);
+            for (int j = 0; j < PING_MAX_WINDOW; j++)
+                ThreadSafePing_t::__slotClear__ (&__sessions__ [i].replies [j]);
+            __atomic_store_n (&__sessions__ [i].state, __SESSION_OPEN__ | (verify ? __SESSION_VERIFY__ : 0) | (uint32_t) size << 16, __ATOMIC_RELEASE);
+            return i;
+        }
+    }
+    return -1;
+}
+
+void ThreadSafePingDispatcher_t::__unregister__ (int session) {
+    __atomic_store_n (&__sessions__ [session].state, __SESSION_FREE__, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,119 @@
+/*
+    ThreadSafePingDispatcher.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Optional central ICMP dispatcher. Once ThreadSafePingDispatcher_t::begin () is called, a single task owns one raw socket
+    per address family, receives all the echo replies, demultiplexes them by id and pushes them to the reply queue of the
+    ping session they belong to. ThreadSafePing_t sessions then send through the dispatcher's sockets and sleep on their
+    queues instead of each polling a socket of its own.
+
+    With begin (true) the dispatcher uses lwIP's raw API instead: there is no task and no socket, a raw_pcb per address family
+    gets the echo replies right in the tcpip thread, where they are time-stamped and matched by looking only at their headers,
+    the payload is never copied (the replies of sessions that verify them are checked in place, in the pbuf). The echo requests
+    are time-stamped and sent from the tcpip thread as well. Nothing in the tcpip thread ever waits for a mutex or for a queue.
+
+    ThreadSafePingDispatcher_t::end () stops the dispatcher once no session is using it, the following sessions use their own
+    sockets again.
+
+*/
+
+
+#ifndef __ThreadSafePingDispatcher_H__
+    #define __ThreadSafePingDispatcher_H__
+
+
+    #include "ThreadSafePing.h"
+    #include <lwip/raw.h>
+    #include <lwip/priv/tcpip_priv.h> // tcpip_api_call
+
+
+    #ifndef PING_DISPATCHER_MAX_SESSIONS
+        #define PING_DISPATCHER_MAX_SESSIONS    16   // sessions that don't get a dispatcher slot fall back to their own sockets
+    #endif
+    #ifndef PING_DISPATCHER_STACK_SIZE
+        #define PING_DISPATCHER_STACK_SIZE      3 * 1024
+    #endif
+    #ifndef PING_DISPATCHER_PRIORITY
+        #define PING_DISPATCHER_PRIORITY        2
+    #endif
+    #ifndef PING_DISPATCHER_CORE
+        #define PING_DISPATCHER_CORE            PING_TCPIP_CORE // next to lwIP's tcpip task, so the replies don't have to wait for the other core
+    #endif
+
+    #define PING_DISPATCHER_ID_BASE 0x8000  // ids of echo requests sent by dispatcher sessions, they never collide with socket numbers
+    #define PING_DISPATCHER_RAW_API 0x7fff  // the "socket" of sessions when the dispatcher uses lwIP's raw API
+
+
+    struct ThreadSafePingDispatcherOptions_t {
+        bool rawApi = false;                                // use lwIP's raw API instead of a task, the rest of the options are not used then
+        BaseType_t core = PING_DISPATCHER_CORE;             // 0 - portNUM_PROCESSORS - 1 or tskNO_AFFINITY
+        UBaseType_t priority = PING_DISPATCHER_PRIORITY;    // 1 - configMAX_PRIORITIES - 1, above the tasks that could delay the time-stamping of the replies
+        uint32_t stackSize = PING_DISPATCHER_STACK_SIZE;    // 2 KB - 64 KB
+    };
+
+
+    class ThreadSafePingDispatcher_t {
+
+        friend class ThreadSafePing_t;
+
+        private:
+            // the state of a session is a single word, so that the tcpip thread and the dispatcher task can read it atomically, without a mutex
+            enum {
+                __SESSION_FREE__ = 0,
+                __SESSION_CLAIMED__ = 1,                                    // being registered, nothing is delivered to it yet (or the dispatcher has ended and its queue is gone)
+                __SESSION_OPEN__ = 2,
+                __SESSION_VERIFY__ = 4                                      // verify the replies (ThreadSafePingOptions_t::verify), the payload size is in the upper 16 bits
+            };
+
+            struct __session_t__ {
+                uint32_t state;                                             // __SESSION_FREE__, __SESSION_CLAIMED__ or __SESSION_OPEN__ (| __SESSION_VERIFY__ | size << 16)
+                QueueHandle_t queue;                                        // created by begin () and deleted by end (), replies with bytes = -1 failed verification
+                ThreadSafePing_t::__pingReply_t__ replies [PING_MAX_WINDOW]; // echo requests in flight, accessed only by the session's own task
+            };
+
+            static __session_t__ __sessions__ [PING_DISPATCHER_MAX_SESSIONS];
+            static int __sockfdIPv4__;
+            static int __sockfdIPv6__;
+            static TaskHandle_t __task__;
+            static struct raw_pcb *__pcbIPv4__;
+            static struct raw_pcb *__pcbIPv6__;
+            static bool __ending__;                                         // tells the dispatcher task to stop
+            static SemaphoreHandle_t __done__;                              // given by the dispatcher task when it stops
+
+            static void __dispatcherTask__ (void *param);
+            static void __dispatch__ (int sockfd, bool isIPv6);
+            static bool __match__ (void *context, const ThreadSafePing_t::__packet_t__ *packet);
+            static inline uint32_t __sessionState__ (uint16_t id) { return id >= PING_DISPATCHER_ID_BASE && id < PING_DISPATCHER_ID_BASE + PING_DISPATCHER_MAX_SESSIONS ? __atomic_load_n (&__sessions__ [id - PING_DISPATCHER_ID_BASE].state, __ATOMIC_ACQUIRE) : (uint32_t) __SESSION_FREE__; }
+            static void __deliver__ (uint16_t id, const ThreadSafePing_t::__pingReply_t__ *reply);
+
+            // lwIP's raw API, __rawBegin__, __rawSendInTcpipThread__ and __rawRecv__ run in the tcpip thread (or under lwIP's core lock)
+            static err_t __rawBegin__ (struct tcpip_api_call_data *call);
+            static err_t __rawEnd__ (struct tcpip_api_call_data *call);
+            static err_t __rawSendInTcpipThread__ (struct tcpip_api_call_data *call);
+            static u8_t __rawRecv__ (void *arg, struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *addr);
+            static int __rawSend__ (bool isIPv6, char *packet, int size, const struct sockaddr *to, int64_t *sendMicros, int *sendErrno); // returns bytes sent or -1
+
+            static void __freeSessions__ ();
+            static void __deleteQueues__ ();
+            static int __register__ (bool verify, int size); // returns session number or -1 if there is no free slot
+            static void __unregister__ (int session);
+
+        public:
+            // starts the dispatcher task, or with rawApi = true the raw_pcbs of lwIP's raw API, returns error text or NULL if OK
+            static const char *begin (const ThreadSafePingDispatcherOptions_t& options);
+            static inline const char *begin (bool rawApi = false) {
+                ThreadSafePingDispatcherOptions_t options;
+                options.rawApi = rawApi;
+                return begin (options);
+            }
+
+            // stops the dispatcher task (within a second) or removes the raw_pcbs and frees the queues, returns error text or NULL if OK - it is refused while sessions are still using the dispatcher
+            static const char *end ();
+
+            // the state is read atomically, since the other tasks check it while begin () or end () may be changing it
+            static inline bool running () { return __atomic_load_n (&__task__, __ATOMIC_ACQUIRE) != NULL || __atomic_load_n (&__pcbIPv4__, __ATOMIC_ACQUIRE) != NULL; }
+            static inline bool rawApi () { return __atomic_load_n (&__pcbIPv4__, __ATOMIC_ACQUIRE) != NULL; }
+    };
+
+#endif
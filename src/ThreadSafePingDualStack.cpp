@@ -0,0 +1,52 @@
+/*
+    ThreadSafePingDualStack.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafePingDualStack.h"
+
+
+// returns error text or NULL if OK
+const char *ThreadSafePingDualStack_t::ping (const char *pingTarget, const ThreadSafePingOptions_t& options) {
+    // lwIP resolves a single address at a time, so ask for each family separately
+    __multiPing__.clearTargets ();
+    __IPv4__ = __IPv6__ = -1;
+    __errTextIPv4__ = __multiPing__.addTarget (pingTarget, AF_INET);
+    if (!__errTextIPv4__) {
+        __IPv4__ = __multiPing__.targets () - 1;
+        __family__ [__IPv4__] = AF_INET;
+    }
+    __errTextIPv6__ = __multiPing__.addTarget (pingTarget, AF_INET6);
+    if (!__errTextIPv6__) {
+        __IPv6__ = __multiPing__.targets () - 1;
+        __family__ [__IPv6__] = AF_INET6;
+    }
+    if (__IPv4__ < 0 && __IPv6__ < 0)
+        return __errText__ = __errTextIPv4__;
+
+    // both addresses get their echo requests in the same rounds, through the IPv4 and the IPv6 socket
+    return __errText__ = __multiPing__.ping (options);
+}
+
+// returns AF_INET, AF_INET6 or AF_UNSPEC if neither family has answered
+int ThreadSafePingDualStack_t::fastestFamily () {
+    ThreadSafePingStatistics_t *v4 = IPv4 ();
+    ThreadSafePingStatistics_t *v6 = IPv6 ();
+    bool answered4 = v4 && v4->received ();
+    bool answered6 = v6 && v6->received ();
+
+    if (!answered4)
+        return answered6 ? AF_INET6 : AF_UNSPEC;
+    if (!answered6)
+        return AF_INET;
+
+    // both have answered: the one with less loss, then the faster one, but IPv6 gets a head start
+    float loss4 = (float) v4->lost () / v4->sent ();
+    float loss6 = (float) v6->lost () / v6->sent ();
+    if (loss4 != loss6)
+        return loss4 < loss6 ? AF_INET : AF_INET6;
+    return v4->mean_time () + PING_DUAL_STACK_IPV6_PREFERENCE < v6->mean_time () ? AF_INET : AF_INET6;
+}
@@ -0,0 +1,72 @@
+/*
+    ThreadSafePingDualStack.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Pings both the IPv4 and the IPv6 address of a dual-stack host at the same time (each round sends an echo request to each of
+    them through the IPv4 and the IPv6 socket), keeps the statistics of each family separately and tells which family is the
+    better one to connect with, in the spirit of happy eyeballs (RFC 8305): the one that answers, with less loss, IPv6 if both
+    are about equally fast.
+
+*/
+
+
+#ifndef __ThreadSafePingDualStack_H__
+    #define __ThreadSafePingDualStack_H__
+
+
+    #include "ThreadSafeMultiPing.h"
+
+
+    #ifndef PING_DUAL_STACK_IPV6_PREFERENCE
+        #define PING_DUAL_STACK_IPV6_PREFERENCE 10.0f  // ms, IPv6 is preferred unless IPv4 is faster by more than this
+    #endif
+
+
+    class ThreadSafePingDualStack_t {
+
+        private:
+            // pings the addresses of both families and passes its callbacks on, with the family instead of the target
+            class __multiPing_t__ : public ThreadSafeMultiPing_t {
+                public:
+                    ThreadSafePingDualStack_t *__owner__;
+
+                    __multiPing_t__ (ThreadSafePingDualStack_t *owner) : ThreadSafeMultiPing_t (2), __owner__ (owner) {}
+
+                    void onReceive (int target, int bytes) override { __owner__->onReceive (__owner__->__family__ [target], bytes); }
+                    void onWait () override { __owner__->onWait (); }
+            };
+            __multiPing_t__ __multiPing__;
+
+            int __family__ [2];                         // AF_INET or AF_INET6 of each target of __multiPing__
+            int __IPv4__ = -1;                          // the target of __multiPing__ with the IPv4 address, -1 if the host has none
+            int __IPv6__ = -1;                          // the target of __multiPing__ with the IPv6 address, -1 if the host has none
+
+            const char *__errText__ = nullptr;
+            const char *__errTextIPv4__ = nullptr;
+            const char *__errTextIPv6__ = nullptr;
+
+        public:
+            ThreadSafePingDualStack_t () : __multiPing__ (this) {}
+
+            // resolves both the A and the AAAA record of pingTarget and pings the addresses found, returns error text or NULL if OK
+            const char *ping (const char *pingTarget, const ThreadSafePingOptions_t& options = ThreadSafePingOptions_t ()); // window and mode are not used, verify is not supported (invalid value), timeout must not be longer than interval
+
+            inline void stop () { __multiPing__.stop (); }
+
+            // the statistics of each family: target (), sent (), received (), mean_time (), ..., NULL if the host has no address of the family
+            inline ThreadSafePingStatistics_t *IPv4 () { return __IPv4__ >= 0 ? &__multiPing__ [__IPv4__] : NULL; }
+            inline ThreadSafePingStatistics_t *IPv6 () { return __IPv6__ >= 0 ? &__multiPing__ [__IPv6__] : NULL; }
+            inline const char *errTextIPv4 () { return __errTextIPv4__; }   // why the host has no IPv4 address
+            inline const char *errTextIPv6 () { return __errTextIPv6__; }   // why the host has no IPv6 address
+
+            // the family to connect with: AF_INET or AF_INET6, AF_UNSPEC if neither has answered
+            int fastestFamily ();
+
+            inline const char *errText () { return __errText__; }
+
+            virtual void onReceive (int family, int bytes) {}  // called for each echo request, family is AF_INET or AF_INET6
+            virtual void onWait () {}
+    };
+
+#endif
@@ -0,0 +1,392 @@
+/*
+    ThreadSafePingExporter.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafePingExporter.h"
+#include <LwIpMutex.h>
+#include <new>
+
+
+static inline uint64_t __zigzag__ (int64_t v) { return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63); }
+static inline int64_t __unzigzag__ (uint64_t v) { return (int64_t) (v >> 1) ^ -(int64_t) (v & 1); }
+
+// little endian base-128, 7 bits per byte, the top bit tells that more bytes follow
+static inline uint8_t *__writeVarint__ (uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t) v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t) v;
+    return p;
+}
+
+// returns the position after the varint or NULL if it doesn't end before end
+static inline const uint8_t *__readVarint__ (const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        *v |= (uint64_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+// writes v in decimal, without snprintf, since it runs inside the critical section
+static inline char *__writeDecimal__ (char *p, int64_t v) {
+    uint64_t u = v < 0 ? -(uint64_t) v : v;
+    if (v < 0)
+        *p++ = '-';
+    char digits [20];
+    int n = 0;
+    do {
+        digits [n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    while (n)
+        *p++ = digits [--n];
+    return p;
+}
+
+
+// returns error text or NULL if OK
+const char *ThreadSafePingExporter_t::begin (Print& sink, const ThreadSafePingExporterOptions_t& options) {
+    if (running ())
+        return "already running";
+    __sink__ = &sink;
+    __sockfd__ = -1;
+    return __begin__ (options);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingExporter_t::begin (const ThreadSafePingExporterOptions_t& options) {
+    if (running ())
+        return "already running";
+    __sink__ = NULL;
+    __sockfd__ = -1;
+    return __begin__ (options);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingExporter_t::begin (const IPAddress& collector, uint16_t port, const ThreadSafePingExporterOptions_t& options) {
+    if (running ())
+        return "already running";
+    if (options.bufferSize > PING_EXPORTER_MAX_DATAGRAM || !port)
+        return "invalid value";
+
+    memset (&__collector__, 0, sizeof (__collector__));
+    __collector__.sin_family = AF_INET;
+    __collector__.sin_port = htons (port);
+    __collector__.sin_addr.s_addr = (uint32_t) collector;
+
+    const char *errText = NULL;
+    xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+        __sockfd__ = socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (__sockfd__ < 0)
+            errText = strerror (errno);
+    xSemaphoreGive (getLwIpMutex ());
+    if (errText)
+        return errText;
+
+    __sink__ = NULL;
+    errText = __begin__ (options);
+    if (errText) {
+        xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+            close (__sockfd__);
+        xSemaphoreGive (getLwIpMutex ());
+        __sockfd__ = -1;
+    }
+    return errText;
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingExporter_t::__begin__ (const ThreadSafePingExporterOptions_t& options) {
+    if ((options.format != PING_EXPORT_BINARY && options.format != PING_EXPORT_CSV) ||
+        options.bufferSize < 128 || options.bufferSize > 65536 ||
+        options.flushMicros < 1000 || options.flushMicros > 3600000000UL ||
+        ((options.core < 0 || options.core >= portNUM_PROCESSORS) && options.core != tskNO_AFFINITY) ||
+        options.priority < 1 || options.priority >= configMAX_PRIORITIES ||
+        options.stackSize < 2 * 1024 || options.stackSize > 64 * 1024)
+        return "invalid value";
+    __options__ = options;
+
+    // both buffers in a single allocation, nothing is allocated after this
+    __buffer__ [0] = new (std::nothrow) uint8_t [2 * options.bufferSize];
+    __buffer__ [1] = __buffer__ [0] ? __buffer__ [0] + options.bufferSize : NULL;
+    __done__ = xSemaphoreCreateBinary ();
+
+    __exported__ = __chunks__ = __dropped__ = __failed__ = 0;
+    __chunk__ = 0;
+    __active__ = 0;
+    __full__ = false;
+    if (!__buffer__ [0] || !__done__) {
+        delete [] __buffer__ [0];
+        __buffer__ [0] = __buffer__ [1] = NULL;
+        if (__done__) vSemaphoreDelete (__done__);
+        __done__ = NULL;
+        return "out of memory";
+    }
+    __startChunk__ ();
+
+    // records are accepted from now on, the exporter task must not see __ending__ still set when it starts
+    portENTER_CRITICAL (&__lock__);
+        __ending__ = false;
+    portEXIT_CRITICAL (&__lock__);
+
+    TaskHandle_t task = NULL;
+    if (xTaskCreatePinnedToCore (__exporterTask__, "ping_exporter", options.stackSize, this, options.priority, &task, options.core) != pdPASS) {
+        portENTER_CRITICAL (&__lock__);
+            __ending__ = true;
+        portEXIT_CRITICAL (&__lock__);
+        delete [] __buffer__ [0];
+        __buffer__ [0] = __buffer__ [1] = NULL;
+        if (__done__) vSemaphoreDelete (__done__);
+        __done__ = NULL;
+        return "out of memory";
+    }
+
+    // until then push () doesn't notify the task, which writes the records out after flushMicros anyway
+    portENTER_CRITICAL (&__lock__);
+        __task__ = task;
+    portEXIT_CRITICAL (&__lock__);
+    return NULL;
+}
+
+void ThreadSafePingExporter_t::end () {
+    if (!__task__)
+        return;
+
+    // the records pushed from now on are dropped, the exporter task writes out the ones already in the buffers
+    portENTER_CRITICAL (&__lock__);
+        __ending__ = true;
+    portEXIT_CRITICAL (&__lock__);
+    // a producer that has swapped the buffers just before may still be about to notify the exporter task, which must not have finished by then
+    while (__atomic_load_n (&__notifying__, __ATOMIC_ACQUIRE))
+        vTaskDelay (1);
+    xTaskNotifyGive (__task__);
+    xSemaphoreTake (__done__, portMAX_DELAY);
+    __task__ = NULL;
+
+    if (__sockfd__ >= 0) {
+        xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+            close (__sockfd__);
+        xSemaphoreGive (getLwIpMutex ());
+        __sockfd__ = -1;
+    }
+    delete [] __buffer__ [0];
+    __buffer__ [0] = __buffer__ [1] = NULL;
+    vSemaphoreDelete (__done__);
+    __done__ = NULL;
+}
+
+// starts a new chunk in the active buffer - must be called inside the __lock__ critical section
+void ThreadSafePingExporter_t::__startChunk__ () {
+    uint8_t *p = __buffer__ [__active__];
+    if (__options__.format == PING_EXPORT_BINARY) {
+        *p++ = 'P';
+        *p++ = 1;
+        *p++ = (uint8_t) __chunk__;
+        *p++ = (uint8_t) (__chunk__ >> 8);
+    } else {
+        *p++ = '#';
+        p = (uint8_t *) __writeDecimal__ ((char *) p, __chunk__);
+        *p++ = '\n';
+    }
+    __chunk__++;
+    __length__ [__active__] = p - __buffer__ [__active__];
+    __records__ [__active__] = 0;
+
+    // each chunk is decoded on its own
+    __seqno__ = 0;
+    __sentMicros__ = 0;
+    __tag__ = -1;
+}
+
+// hands the active buffer over to the exporter task and starts a new chunk in the other one - must be called inside the __lock__ critical section and the other buffer written out
+void ThreadSafePingExporter_t::__swap__ () {
+    __full__ = true;
+    __active__ ^= 1;
+    __startChunk__ ();
+}
+
+// appends the record to the active chunk, there must be PING_EXPORTER_MAX_RECORD bytes free - must be called inside the __lock__ critical section
+void ThreadSafePingExporter_t::__encode__ (const ThreadSafePingResults_t::record_t& record) {
+    uint8_t *start = __buffer__ [__active__] + __length__ [__active__];
+    uint8_t *p = start;
+    int32_t seqnoDelta = (int32_t) (record.seqno - __seqno__); // wraps around together with the 32-bit seqno
+    int64_t sentDelta = record.sentMicros - __sentMicros__;
+
+    if (__options__.format == PING_EXPORT_BINARY) {
+        bool newTag = record.tag != __tag__;
+        *p++ = (record.status & 0x03) | (newTag ? 0x80 : 0);
+        if (newTag)
+            *p++ = record.tag;
+        p = __writeVarint__ (p, __zigzag__ (seqnoDelta));
+        p = __writeVarint__ (p, __zigzag__ (sentDelta));
+        if (record.status != ThreadSafePingResults_t::LOST) {
+            p = __writeVarint__ (p, record.elapsedMicros);
+            p = __writeVarint__ (p, (uint16_t) record.bytes);
+        }
+    } else {
+        char *c = (char *) p;
+        c = __writeDecimal__ (c, record.tag);
+        *c++ = ',';
+        c = __writeDecimal__ (c, record.status);
+        *c++ = ',';
+        c = __writeDecimal__ (c, seqnoDelta);
+        *c++ = ',';
+        c = __writeDecimal__ (c, sentDelta);
+        *c++ = ',';
+        c = __writeDecimal__ (c, record.elapsedMicros);
+        *c++ = ',';
+        c = __writeDecimal__ (c, record.bytes);
+        *c++ = '\n';
+        p = (uint8_t *) c;
+    }
+
+    __seqno__ = record.seqno;
+    __sentMicros__ = record.sentMicros;
+    __tag__ = record.tag;
+    __length__ [__active__] += p - start;
+    __records__ [__active__]++;
+}
+
+bool ThreadSafePingExporter_t::push (const ThreadSafePingResults_t::record_t& record) {
+    bool pushed = false;
+    TaskHandle_t notify = NULL;
+
+    bool full = false;
+
+    // pushing never sleeps: other tasks (on the other core) only hold the lock for as long as encoding a record or swapping the buffers takes
+    portENTER_CRITICAL (&__lock__);
+        if (!__ending__) {
+            if (__length__ [__active__] + PING_EXPORTER_MAX_RECORD > __options__.bufferSize && !__full__) {
+                __swap__ ();
+                notify = __task__;
+                if (notify)
+                    __atomic_add_fetch (&__notifying__, 1, __ATOMIC_RELAXED); // end () doesn't let the exporter task finish until the notification below is given
+            }
+            if (__length__ [__active__] + PING_EXPORTER_MAX_RECORD <= __options__.bufferSize) {
+                __encode__ (record);
+                pushed = true;
+            } else {
+                full = true; // and the other buffer is still being written out
+            }
+        }
+    portEXIT_CRITICAL (&__lock__);
+
+    if (notify) {
+        xTaskNotifyGive (notify);
+        __atomic_sub_fetch (&__notifying__, 1, __ATOMIC_RELEASE);
+    }
+    if (full)
+        __atomic_fetch_add (&__dropped__, 1, __ATOMIC_RELAXED);
+    return pushed;
+}
+
+void ThreadSafePingExporter_t::__exporterTask__ (void *param) {
+    ThreadSafePingExporter_t *exporter = (ThreadSafePingExporter_t *) param;
+    TickType_t ticks = pdMS_TO_TICKS (exporter->__options__.flushMicros / 1000);
+    if (!ticks)
+        ticks = 1;
+
+    while (true) {
+        // woken up when a buffer is full or by end (), otherwise the records that are waiting are written out after flushMicros
+        bool flush = exporter->__ending__ || !ulTaskNotifyTake (pdTRUE, ticks) || exporter->__ending__;
+
+        portENTER_CRITICAL (&exporter->__lock__);
+            if (flush && !exporter->__full__ && exporter->__records__ [exporter->__active__])
+                exporter->__swap__ ();
+            bool full = exporter->__full__;
+            bool ending = exporter->__ending__;
+        portEXIT_CRITICAL (&exporter->__lock__);
+
+        if (full) {
+            // while the buffer is full the producers don't swap, so it stays the inactive one
+            int b = exporter->__active__ ^ 1;
+            if (exporter->onChunk (exporter->__buffer__ [b], exporter->__length__ [b])) {
+                __atomic_add_fetch (&exporter->__exported__, exporter->__records__ [b], __ATOMIC_RELAXED);
+                __atomic_add_fetch (&exporter->__chunks__, 1, __ATOMIC_RELAXED);
+            } else {
+                __atomic_add_fetch (&exporter->__failed__, 1, __ATOMIC_RELAXED);
+            }
+            portENTER_CRITICAL (&exporter->__lock__);
+                exporter->__full__ = false;
+            portEXIT_CRITICAL (&exporter->__lock__);
+        } else if (ending) {
+            break; // everything has been written out
+        }
+    }
+
+    xSemaphoreGive (exporter->__done__);
+    vTaskDelete (NULL);
+}
+
+// returns false if the sink didn't take the whole chunk
+bool ThreadSafePingExporter_t::onChunk (const uint8_t *chunk, int size) {
+    if (__sink__) {
+        bool written = __sink__->write (chunk, size) == (size_t) size;
+        __sink__->flush ();
+        return written;
+    }
+    if (__sockfd__ < 0)
+        return false; // onChunk () should have been overridden
+
+    xSemaphoreTake (getLwIpMutex (), portMAX_DELAY);
+        int sent = sendto (__sockfd__, chunk, size, 0, (struct sockaddr *) &__collector__, sizeof (__collector__));
+    xSemaphoreGive (getLwIpMutex ());
+    return sent == size;
+}
+
+// returns the number of records decoded (up to maxRecords) or -1 if the chunk is not valid
+int ThreadSafePingExporter_t::decode (const uint8_t *chunk, int size, ThreadSafePingResults_t::record_t *records, int maxRecords, uint16_t *chunkNumber) {
+    if (size < 4 || chunk [0] != 'P' || chunk [1] != 1)
+        return -1;
+    if (chunkNumber)
+        *chunkNumber = chunk [2] | chunk [3] << 8;
+
+    const uint8_t *p = chunk + 4;
+    const uint8_t *end = chunk + size;
+    uint32_t seqno = 0;
+    int64_t sentMicros = 0;
+    uint8_t tag = 0;
+    int n = 0;
+    while (p < end && n < maxRecords) {
+        uint8_t head = *p++;
+        if (head & 0x7c)
+            return -1;
+        if (head & 0x80) {
+            if (p == end)
+                return -1;
+            tag = *p++;
+        }
+        uint64_t v;
+        if (!(p = __readVarint__ (p, end, &v)))
+            return -1;
+        seqno += (uint32_t) __unzigzag__ (v);
+        if (!(p = __readVarint__ (p, end, &v)))
+            return -1;
+        sentMicros += __unzigzag__ (v);
+
+        ThreadSafePingResults_t::record_t *r = &records [n++];
+        r->sentMicros = sentMicros;
+        r->seqno = seqno;
+        r->status = head & 0x03;
+        r->tag = tag;
+        if (r->status == ThreadSafePingResults_t::LOST) {
+            r->elapsedMicros = 0;
+            r->bytes = -1;
+        } else {
+            if (!(p = __readVarint__ (p, end, &v)))
+                return -1;
+            r->elapsedMicros = (uint32_t) v;
+            if (!(p = __readVarint__ (p, end, &v)))
+                return -1;
+            r->bytes = (int16_t) v;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,138 @@
+/*
+    ThreadSafePingExporter.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Streams a record of each echo request (the same records ThreadSafePingResults_t queues) to Serial, a LittleFS file or a UDP
+    collector, for soak tests that log every round-trip time. The pinging tasks only encode the records into one of two fixed
+    buffers, a background task writes the other one out in a single chunk, so the sink never delays the echo requests and RAM
+    stays bounded. Pushing never blocks or sleeps: the encoding is guarded by a short spinlock critical section, when both buffers
+    are full the record is dropped and counted, nothing is allocated per record.
+
+    The records are delta-encoded against the previous record of the same chunk, each chunk starts from zero, so it can be
+    decoded on its own (a lost UDP datagram only loses its own records):
+
+      PING_EXPORT_BINARY    chunk header: 'P', 1 (format version), 16-bit chunk number (little endian), then for each record:
+                            a byte with status in bits 0 - 1 and bit 7 set if a tag byte follows (the tag has changed),
+                            zigzag varints of the seqno and the sentMicros differences,
+                            varints of elapsedMicros and bytes, unless the status is LOST, 6 - 12 bytes for a typical record
+      PING_EXPORT_CSV       chunk header: a #<chunk number> line, then a tag,status,seqno difference,sentMicros difference,
+                            elapsedMicros,bytes line for each record
+
+*/
+
+
+#ifndef __ThreadSafePingExporter_H__
+    #define __ThreadSafePingExporter_H__
+
+
+    #include <Arduino.h>
+    #include <lwip/sockets.h>
+    #include "ThreadSafePingResults.h"
+
+
+    #ifndef PING_EXPORTER_DEFAULT_BUFFER
+        #define PING_EXPORTER_DEFAULT_BUFFER    1024    // bytes of each of the two buffers, the size of the chunks
+    #endif
+    #ifndef PING_EXPORTER_MAX_DATAGRAM
+        #define PING_EXPORTER_MAX_DATAGRAM      1472    // the largest chunk sent to a UDP collector, so that it is not fragmented
+    #endif
+    #ifndef PING_EXPORTER_DEFAULT_FLUSH
+        #define PING_EXPORTER_DEFAULT_FLUSH     1       // s, the longest a record waits in a buffer that is not full
+    #endif
+    #ifndef PING_EXPORTER_STACK_SIZE
+        #define PING_EXPORTER_STACK_SIZE        3 * 1024
+    #endif
+    #ifndef PING_EXPORTER_PRIORITY
+        #define PING_EXPORTER_PRIORITY          1       // below the pinging tasks
+    #endif
+    #ifndef PING_EXPORTER_CORE
+        #define PING_EXPORTER_CORE              tskNO_AFFINITY
+    #endif
+
+    #define PING_EXPORTER_MAX_RECORD 64 // the longest encoded record (a CSV line)
+
+
+    enum ThreadSafePingExportFormat_t {
+        PING_EXPORT_BINARY = 0,
+        PING_EXPORT_CSV = 1
+    };
+
+    struct ThreadSafePingExporterOptions_t {
+        ThreadSafePingExportFormat_t format = PING_EXPORT_BINARY;
+        int bufferSize = PING_EXPORTER_DEFAULT_BUFFER;                      // 128 - 65536 bytes, up to PING_EXPORTER_MAX_DATAGRAM for a UDP collector, allocated twice by begin ()
+        unsigned long flushMicros = 1000000UL * PING_EXPORTER_DEFAULT_FLUSH; // 1 ms - 3600 s, a buffer that is not full is written out after this long
+        BaseType_t core = PING_EXPORTER_CORE;                               // 0 - portNUM_PROCESSORS - 1 or tskNO_AFFINITY
+        UBaseType_t priority = PING_EXPORTER_PRIORITY;                      // 1 - configMAX_PRIORITIES - 1
+        uint32_t stackSize = PING_EXPORTER_STACK_SIZE;                      // 2 KB - 64 KB
+    };
+
+
+    class ThreadSafePingExporter_t {
+
+        private:
+            portMUX_TYPE __lock__ = portMUX_INITIALIZER_UNLOCKED; // guards the buffers and the delta state, held only while a record is encoded or the buffers are swapped
+            SemaphoreHandle_t __done__ = NULL;          // given by the exporter task when it has written everything out and finished
+            TaskHandle_t __task__ = NULL;
+
+            uint8_t *__buffer__ [2] = {};
+            int __length__ [2];                         // bytes in each buffer
+            int __records__ [2];                        // records in each buffer
+            int __active__;                             // the buffer the records are encoded into
+            volatile bool __full__;                     // the other buffer waits to be written out (or is being written out)
+            volatile bool __ending__ = true;            // also while the exporter is not running, records are not accepted then
+            int __notifying__ = 0;                      // producers that have swapped the buffers and are about to notify the exporter task, end () waits for them
+
+            // the delta state of the active chunk
+            uint32_t __seqno__;
+            int64_t __sentMicros__;
+            int __tag__;
+
+            uint16_t __chunk__;
+            uint32_t __exported__ = 0;
+            uint32_t __chunks__ = 0;
+            uint32_t __dropped__ = 0;
+            uint32_t __failed__ = 0;
+
+            ThreadSafePingExporterOptions_t __options__;
+            Print *__sink__ = NULL;
+            int __sockfd__ = -1;
+            struct sockaddr_in __collector__;
+
+            const char *__begin__ (const ThreadSafePingExporterOptions_t& options);
+            void __startChunk__ ();
+            void __swap__ ();
+            void __encode__ (const ThreadSafePingResults_t::record_t& record);
+            static void __exporterTask__ (void *param);
+
+        protected:
+            // writes a chunk to the sink, returns false if it failed, runs in the exporter task - it can be overridden for other sinks (then the destructor of the derived class has to call end ())
+            virtual bool onChunk (const uint8_t *chunk, int size);
+
+        public:
+            ThreadSafePingExporter_t () {}
+            virtual ~ThreadSafePingExporter_t () { end (); }
+
+            // starts the exporter task, returns error text or NULL if OK
+            const char *begin (Print& sink, const ThreadSafePingExporterOptions_t& options = ThreadSafePingExporterOptions_t ()); // Serial, a LittleFS File, ...
+            const char *begin (const IPAddress& collector, uint16_t port, const ThreadSafePingExporterOptions_t& options = ThreadSafePingExporterOptions_t ()); // each chunk is a UDP datagram
+            const char *begin (const ThreadSafePingExporterOptions_t& options = ThreadSafePingExporterOptions_t ()); // onChunk () writes the chunks
+
+            // writes out the records that are still in the buffers and stops the exporter task
+            void end ();
+
+            inline bool running () { return __task__ != NULL; }
+
+            // encodes the record into the active buffer, doesn't wait for the sink or sleep, returns false if both buffers are full (then the record is counted as dropped) or the exporter isn't running
+            bool push (const ThreadSafePingResults_t::record_t& record);
+
+            // decodes a PING_EXPORT_BINARY chunk, returns the number of records or -1 if the chunk is not valid, chunkNumber can be NULL
+            static int decode (const uint8_t *chunk, int size, ThreadSafePingResults_t::record_t *records, int maxRecords, uint16_t *chunkNumber = NULL);
+
+            inline uint32_t exported () { return __atomic_load_n (&__exported__, __ATOMIC_RELAXED); } // records written out
+            inline uint32_t chunks () { return __atomic_load_n (&__chunks__, __ATOMIC_RELAXED); }     // chunks written out
+            inline uint32_t dropped () { return __atomic_load_n (&__dropped__, __ATOMIC_RELAXED); }   // records that found both buffers full
+            inline uint32_t failed () { return __atomic_load_n (&__failed__, __ATOMIC_RELAXED); }     // chunks that the sink didn't take, their records are lost
+    };
+
+#endif
@@ -0,0 +1,312 @@
+/*
+    ThreadSafePingHealthCheck.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafePingHealthCheck.h"
+#include <new>
+
+
+ThreadSafePingHealthCheck_t::ThreadSafePingHealthCheck_t (int maxTargets) {
+    if (maxTargets < 1 || maxTargets > 0x10000) { // the target number is the sequence number of its echo requests
+        __errText__ = "invalid value";
+        return;
+    }
+    __targets__ = new (std::nothrow) __target_t__ [maxTargets];
+    __heap__ = new (std::nothrow) uint16_t [maxTargets];
+    if (!__targets__ || !__heap__) {
+        __errText__ = "out of memory";
+        return;
+    }
+    __maxTargets__ = maxTargets;
+}
+
+ThreadSafePingHealthCheck_t::~ThreadSafePingHealthCheck_t () {
+    delete [] __targets__;
+    delete [] __heap__;
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingHealthCheck_t::addTarget (const char *pingTarget, unsigned long periodMicros) {
+    if (!__targets__ || !__heap__)
+        return "out of memory"; // the constructor couldn't allocate them
+    if (__targetCount__ >= __maxTargets__)
+        return "too many targets";
+    if (periodMicros < 1000 || periodMicros > 3600000000UL)
+        return "invalid value";
+    const char *e = __probe__.__resolveTargetName__ (pingTarget);
+    if (e)
+        return e;
+    if (__probe__.__isIPv6__)
+        return "IPv6 not supported";
+
+    __target_t__ *t = &__targets__ [__targetCount__++];
+    *t = {};
+    t->address = __probe__.__target_addr_IPv4__.sin_addr.s_addr;
+    t->periodMicros = periodMicros;
+    return NULL; // OK
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingHealthCheck_t::addTarget (const IPAddress& pingTarget, unsigned long periodMicros) {
+    char s [INET_ADDRSTRLEN];
+    snprintf (s, sizeof (s), "%u.%u.%u.%u", pingTarget [0], pingTarget [1], pingTarget [2], pingTarget [3]);
+    return addTarget (s, periodMicros);
+}
+
+IPAddress ThreadSafePingHealthCheck_t::address (int target) {
+    uint32_t a = ntohl (__targets__ [target].address);
+    return IPAddress ((a >> 24) & 0xFF, (a >> 16) & 0xFF, (a >> 8) & 0xFF, a & 0xFF);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingHealthCheck_t::run (const ThreadSafePingHealthCheckOptions_t& options) {
+    if (!WiFi.isConnected () || WiFi.localIP () == IPAddress (0, 0, 0, 0))
+        return __errText__ = "not connected";
+
+    // check argument values
+    if (options.rate < 1 || options.rate > 10000) return __errText__ = "invalid value";
+    if (options.window < 1 || options.window > PING_HEALTH_MAX_WINDOW) return __errText__ = "invalid value";
+    if (options.timeoutMicros < 1000 || options.timeoutMicros > 30000000UL) return __errText__ = "invalid value";
+    if (options.size < 4 || options.size > PING_STACK_MAX_SIZE) return __errText__ = "invalid value";
+    if (options.jitter < 0 || options.jitter > 50) return __errText__ = "invalid value";
+    if (options.downAfter < 1 || options.downAfter > 100 || options.upAfter < 1 || options.upAfter > 100) return __errText__ = "invalid value";
+    if (!(options.lossWeight >= 0 && options.lossWeight <= 1)) return __errText__ = "invalid value";
+    if (options.onWaitMicros && (options.onWaitMicros < 1000 || options.onWaitMicros > 3600000000UL)) return __errText__ = "invalid value";
+    if (!__targetCount__) return __errText__ = "no targets";
+
+    // initialize measuring variables, spread the first echo requests randomly over the periods
+    __options__ = options;
+    __probe__.__resetStatistics__ (options.size);
+    #if PING_IPV6
+        __probe__.__isIPv6__ = false;
+    #endif
+    __probe__.__target_addr_IPv4__ = {};
+    __probe__.__target_addr_IPv4__.sin_family = AF_INET;
+    __probe__.__target_addr_IPv4__.sin_len = sizeof (__probe__.__target_addr_IPv4__);
+    int64_t nowMicros = ThreadSafePing_t::__nowMicros__ ();
+    __heapCount__ = __upCount__ = 0;
+    for (int i = 0; i < __targetCount__; i++) {
+        __target_t__ *t = &__targets__ [i];
+        t->sent = t->received = 0;
+        t->lastTime = t->loss = 0;
+        t->streak = 0;
+        t->state = UNKNOWN;
+        t->inFlight = false;
+        t->dueMicros = nowMicros + esp_random () % t->periodMicros;
+        __heapPush__ (i);
+    }
+    __inFlightCount__ = 0;
+    __stopped__ = false;
+    __errText__ = NULL;
+
+    // payloads of 4 - 7 bytes are padded to hold the 64-bit time stamp, like ThreadSafePing_t does, the replies are reported with the requested size
+    __padding__ = ThreadSafePing_t::__paddingOf__ (options.size);
+    int size = options.size + __padding__;
+
+    int sockfd = ThreadSafePing_t::__takeSocket__ (false, &__errText__);
+    if (sockfd < 0)
+        return __errText__;
+
+    // the socket may have been used by other pings before, make sure their echo requests in flight are forgotten
+    for (int i = 0; i < PING_MAX_WINDOW; i++)
+        ThreadSafePing_t::__slotClear__ (&ThreadSafePing_t::__getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET][i]);
+
+    // build the echo request only once, the sequence number of each echo request is the target number
+    uint32_t packet [(sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE + 3) / 4];
+    ThreadSafePing_t::__buildPacket__ ((char *) packet, false, sockfd, size);
+
+    // begin probing ...
+    //  - the target with the earliest deadline gets the next echo request, no more often than the rate allows and only while the window isn't full
+    //  - a target leaves the heap while its echo request is in flight and returns with its next deadline when the reply arrives or the echo request times out,
+    //    the window counts the echo requests in flight exactly, so a target that doesn't answer doesn't hold back the others
+    unsigned long gapMicros = 1000000UL / options.rate;
+    int64_t nextSendMicros = nowMicros;
+    unsigned long lastWaitMicros = micros (); // when onWait () has been called the last time
+
+    while (!__stopped__) {
+        nowMicros = ThreadSafePing_t::__nowMicros__ ();
+
+        // send the next echo request if it is due and the window isn't full
+        if (__heapCount__ && __inFlightCount__ < options.window && __targets__ [__heap__ [0]].dueMicros <= nowMicros && nextSendMicros <= nowMicros) {
+            nextSendMicros = nowMicros - nextSendMicros < (int64_t) gapMicros ? nextSendMicros + gapMicros : nowMicros + gapMicros;
+
+            int target = __heapPop__ ();
+            __target_t__ *t = &__targets__ [target];
+            __schedule__ (target, nowMicros);
+
+            __probe__.__target_addr_IPv4__.sin_addr.s_addr = t->address;
+            __probe__.__sent__++;
+            t->sent++;
+            t->sentMicros = nowMicros; // the reply carries the exact send time, which can't be earlier
+            if (ThreadSafePing_t::__ping_send__ (&__probe__, sockfd, (char *) packet, (uint16_t) target, size) == NULL) {
+                t->inFlight = true;
+                t->slot = __inFlightCount__;
+                __inFlight__ [__inFlightCount__++] = target;
+            } else {
+                __heapPush__ (target);
+                __probe__.__lost__++;
+                __report__ (target, -1);
+            }
+            continue;
+        }
+
+        // pick up all the replies that are waiting
+        __receive__ (sockfd);
+
+        // report the echo requests that have timed out
+        unsigned long waitMicros = 1000000; // the deadlines are checked again by then anyway
+        nowMicros = ThreadSafePing_t::__nowMicros__ ();
+        for (int i = 0; i < __inFlightCount__; ) {
+            int target = __inFlight__ [i];
+            unsigned long waitingMicros = nowMicros - __targets__ [target].sentMicros;
+            if (waitingMicros < options.timeoutMicros) {
+                if (waitMicros > options.timeoutMicros - waitingMicros) waitMicros = options.timeoutMicros - waitingMicros;
+                i++;
+                continue;
+            }
+            __landed__ (target); // moves the last target in flight to position i
+            __probe__.__lost__++;
+            __report__ (target, -1);
+        }
+
+        // report waiting each onWaitMicros
+        if (options.onWaitMicros) {
+            if (micros () - lastWaitMicros >= options.onWaitMicros) {
+                lastWaitMicros = micros ();
+                onWait ();
+            }
+            unsigned long sinceMicros = micros () - lastWaitMicros;
+            unsigned long untilWaitMicros = sinceMicros < options.onWaitMicros ? options.onWaitMicros - sinceMicros : 0;
+            if (waitMicros > untilWaitMicros) waitMicros = untilWaitMicros;
+        }
+
+        // sleep until a reply arrives, the oldest echo request times out or the next echo request is due
+        if (__heapCount__ && __inFlightCount__ < options.window) {
+            int64_t dueMicros = __targets__ [__heap__ [0]].dueMicros;
+            if (dueMicros < nextSendMicros) dueMicros = nextSendMicros;
+            int64_t untilSendMicros = dueMicros - ThreadSafePing_t::__nowMicros__ ();
+            if (untilSendMicros < 0) untilSendMicros = 0;
+            if (waitMicros > (uint64_t) untilSendMicros) waitMicros = untilSendMicros;
+        }
+        ThreadSafePing_t::__waitForPacket__ (sockfd, -1, waitMicros);
+    }
+
+    // pick up the replies that have arrived meanwhile
+    __receive__ (sockfd);
+
+    ThreadSafePing_t::__releaseSocket__ (sockfd, false);
+    return NULL; // OK
+}
+
+// sets the next deadline of the target: one period after the previous one (or after now, if it is already more than a period late), moved randomly by up to jitter % of the period
+void ThreadSafePingHealthCheck_t::__schedule__ (int target, int64_t nowMicros) {
+    __target_t__ *t = &__targets__ [target];
+    t->dueMicros = nowMicros - t->dueMicros < t->periodMicros ? t->dueMicros + t->periodMicros : nowMicros + t->periodMicros;
+    if (__options__.jitter) {
+        uint64_t j = (uint64_t) t->periodMicros * __options__.jitter / 100;
+        t->dueMicros += (int64_t) (esp_random () % (2 * j + 1)) - (int64_t) j;
+    }
+}
+
+// the echo request of the target is no longer in flight (answered or timed out), the target waits in the heap for its next one
+void ThreadSafePingHealthCheck_t::__landed__ (int target) {
+    __target_t__ *t = &__targets__ [target];
+    int last = __inFlight__ [--__inFlightCount__];
+    __inFlight__ [t->slot] = last;
+    __targets__ [last].slot = t->slot;
+    t->inFlight = false;
+    __heapPush__ (target);
+}
+
+void ThreadSafePingHealthCheck_t::__heapPush__ (int target) {
+    int64_t dueMicros = __targets__ [target].dueMicros;
+    int i = __heapCount__++;
+    while (i) {
+        int parent = (i - 1) / 2;
+        if (__targets__ [__heap__ [parent]].dueMicros <= dueMicros)
+            break;
+        __heap__ [i] = __heap__ [parent];
+        i = parent;
+    }
+    __heap__ [i] = target;
+}
+
+int ThreadSafePingHealthCheck_t::__heapPop__ () {
+    int top = __heap__ [0];
+    int last = __heap__ [--__heapCount__];
+    int64_t dueMicros = __targets__ [last].dueMicros;
+    int i = 0;
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= __heapCount__)
+            break;
+        if (child + 1 < __heapCount__ && __targets__ [__heap__ [child + 1]].dueMicros < __targets__ [__heap__ [child]].dueMicros)
+            child++;
+        if (dueMicros <= __targets__ [__heap__ [child]].dueMicros)
+            break;
+        __heap__ [i] = __heap__ [child];
+        i = child;
+    }
+    if (__heapCount__)
+        __heap__ [i] = last;
+    return top;
+}
+
+// reads all the packets waiting on the socket and reports the targets that replied
+void ThreadSafePingHealthCheck_t::__receive__ (int sockfd) {
+    char buf [60 + sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE]; // the longest IPv4 header, longer replies of other sessions get truncated, but their length is still known
+    ThreadSafePing_t::__drainSocket__ (sockfd, false, buf, sizeof (buf), sockfd, 1, &__probe__.__counters__,
+                                       [] (void *context, const ThreadSafePing_t::__packet_t__ *packet) {
+                                           return ((ThreadSafePingHealthCheck_t *) context)->__match__ (packet);
+                                       }, this);
+}
+
+// reports the target that answered its echo request in flight
+bool ThreadSafePingHealthCheck_t::__match__ (const ThreadSafePing_t::__packet_t__ *packet) {
+    if (!packet->isEcho)
+        return false;
+
+    // the sequence number is the target number, the reply must come from that target and answer its echo request in flight, not an earlier one
+    uint16_t seqno = packet->seqno;
+    __target_t__ *t = &__targets__ [seqno < __targetCount__ ? seqno : 0];
+    if (seqno >= __targetCount__ || t->address != ((const struct sockaddr_in *) packet->from)->sin_addr.s_addr || !t->inFlight || packet->sentMicros < t->sentMicros) {
+        ThreadSafePing_t::__count__ (&__probe__.__counters__, &ThreadSafePingCounters_t::stale);
+        return true;
+    }
+
+    t->received++;
+    t->lastTime = (packet->receivedMicros - packet->sentMicros) / 1000.0f;
+    __probe__.__received__++;
+    __landed__ (seqno);
+    __report__ (seqno, packet->bytes - __padding__);
+    return true;
+}
+
+// updates the loss average and the state of the target and reports them
+void ThreadSafePingHealthCheck_t::__report__ (int target, int bytes) {
+    __target_t__ *t = &__targets__ [target];
+    bool lost = bytes < 0;
+    t->loss += __options__.lossWeight * ((lost ? 1.0f : 0.0f) - t->loss);
+    if (lost)
+        t->streak = t->streak < 0 ? (t->streak > -100 ? t->streak - 1 : t->streak) : -1;
+    else
+        t->streak = t->streak > 0 ? (t->streak < 100 ? t->streak + 1 : t->streak) : 1;
+
+    onReceive (target, bytes);
+
+    int state = t->state;
+    if (lost && -t->streak >= __options__.downAfter)
+        state = DOWN;
+    else if (!lost && t->streak >= __options__.upAfter)
+        state = UP;
+    if (state != t->state) {
+        if (t->state == UP) __upCount__--;
+        if (state == UP) __upCount__++;
+        t->state = state;
+        onStateChange (target, state);
+    }
+}
@@ -0,0 +1,125 @@
+/*
+    ThreadSafePingHealthCheck.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Keeps probing many IPv4 targets, each at its own period, from a single task through a single raw socket. The next echo
+    requests are kept in a min-heap of deadlines, initial deadlines are spread randomly over the period and each following one
+    is jittered, so the probes don't come in bursts. A rate cap and a global limit of echo requests in flight bound the load.
+    The state of each target (up/down, the last round-trip time and the loss average) is kept in a compact contiguous array.
+
+*/
+
+
+#ifndef __ThreadSafePingHealthCheck_H__
+    #define __ThreadSafePingHealthCheck_H__
+
+
+    #include "ThreadSafePing.h"
+
+
+    #ifndef PING_HEALTH_DEFAULT_MAX_TARGETS
+        #define PING_HEALTH_DEFAULT_MAX_TARGETS 256
+    #endif
+    #ifndef PING_HEALTH_MAX_WINDOW
+        #define PING_HEALTH_MAX_WINDOW          64
+    #endif
+    #ifndef PING_HEALTH_DEFAULT_WINDOW
+        #define PING_HEALTH_DEFAULT_WINDOW      16
+    #endif
+    #ifndef PING_HEALTH_DEFAULT_RATE
+        #define PING_HEALTH_DEFAULT_RATE        50      // echo requests per second
+    #endif
+
+
+    struct ThreadSafePingHealthCheckOptions_t {
+        int rate = PING_HEALTH_DEFAULT_RATE;                                // 1 - 10000 echo requests per second, to all the targets together
+        int window = PING_HEALTH_DEFAULT_WINDOW;                            // 1 - PING_HEALTH_MAX_WINDOW echo requests in flight at the same time
+        unsigned long timeoutMicros = 1000000UL * PING_DEFAULT_TIMEOUT;    // 1 ms - 30 s
+        int size = PING_DEFAULT_SIZE;                                       // 4 - PING_STACK_MAX_SIZE bytes of payload, 4 - 7 are sent padded to the 8-byte time stamp but reported as requested
+        int jitter = 10;                                                    // 0 - 50 % of the period, each deadline is moved randomly by up to this much
+        int downAfter = 3;                                                  // 1 - 100 consecutive losses mark a target down
+        int upAfter = 1;                                                    // 1 - 100 consecutive replies mark a target up
+        float lossWeight = 0.125f;                                          // 0 - 1, the weight of the latest echo request in the loss average
+        unsigned long onWaitMicros = PING_DEFAULT_ON_WAIT;                  // 1 ms - 3600 s between onWait () calls, 0 = never
+    };
+
+
+    class ThreadSafePingHealthCheck_t {
+
+        public:
+            enum { UNKNOWN = 0, UP = 1, DOWN = 2 };
+
+        private:
+            ThreadSafePingStatistics_t __probe__;       // resolves the targets and sends the echo requests, its target address changes with each of them
+
+            struct __target_t__ {
+                uint32_t address;                       // IPv4 address in network byte order
+                uint32_t periodMicros;
+                int64_t dueMicros;                      // when the next echo request is due
+                int64_t sentMicros;                     // when the echo request in flight has been sent
+                uint32_t sent;
+                uint32_t received;
+                float lastTime;                         // ms, the round-trip time of the last reply
+                float loss;                             // average loss, 0 - 1
+                int8_t streak;                          // > 0 consecutive replies, < 0 consecutive losses
+                uint8_t state;
+                bool inFlight;
+                uint8_t slot;                           // its position in __inFlight__ while its echo request is in flight
+            };
+            __target_t__ *__targets__ = nullptr;
+            uint16_t *__heap__ = nullptr;               // min-heap of the targets waiting for their next echo request, ordered by dueMicros, the targets in flight are not in it
+            int __heapCount__ = 0;
+            int __maxTargets__ = 0;
+            int __targetCount__ = 0;
+            int __upCount__ = 0;
+
+            uint16_t __inFlight__ [PING_HEALTH_MAX_WINDOW];        // the targets with an echo request in flight, in no particular order
+            int __inFlightCount__;
+
+            ThreadSafePingHealthCheckOptions_t __options__;
+            int __padding__;                            // bytes added to payloads too short for the time stamp, not reported
+            const char *__errText__ = nullptr;
+            bool __stopped__;
+
+            void __heapPush__ (int target);
+            int __heapPop__ ();
+            void __schedule__ (int target, int64_t nowMicros);
+            void __landed__ (int target);
+            void __receive__ (int sockfd);
+            bool __match__ (const ThreadSafePing_t::__packet_t__ *packet);
+            void __report__ (int target, int bytes);
+
+        public:
+            ThreadSafePingHealthCheck_t (int maxTargets = PING_HEALTH_DEFAULT_MAX_TARGETS);
+            ~ThreadSafePingHealthCheck_t ();
+
+            // adds a target probed each periodMicros (1 ms - 3600 s), returns error text or NULL if OK
+            const char *addTarget (const char *pingTarget, unsigned long periodMicros);
+            const char *addTarget (const IPAddress& pingTarget, unsigned long periodMicros);
+            inline void clearTargets () { __targetCount__ = __upCount__ = 0; }
+
+            // probes the targets until stop () is called, returns error text or NULL if OK
+            const char *run (const ThreadSafePingHealthCheckOptions_t& options = ThreadSafePingHealthCheckOptions_t ());
+
+            inline void stop () { __stopped__ = true; }
+
+            inline int targets () { return __targetCount__; }
+            inline int upCount () { return __upCount__; }
+            IPAddress address (int target);
+            inline int state (int target) { return __targets__ [target].state; }           // UNKNOWN, UP or DOWN
+            inline bool isUp (int target) { return __targets__ [target].state == UP; }
+            inline float last_time (int target) { return __targets__ [target].lastTime; }   // ms, of the last reply
+            inline float loss (int target) { return __targets__ [target].loss; }            // average loss, 0 - 1
+            inline uint32_t sent (int target) { return __targets__ [target].sent; }
+            inline uint32_t received (int target) { return __targets__ [target].received; }
+
+            inline const ThreadSafePingCounters_t& counters () { return __probe__.counters (); }
+            inline const char *errText () { return __errText__; }
+
+            virtual void onReceive (int target, int bytes) {}          // called for each echo request, bytes = -1 if it has been lost
+            virtual void onStateChange (int target, int state) {}     // called when a target goes UP or DOWN
+            virtual void onWait () {}
+    };
+
+#endif
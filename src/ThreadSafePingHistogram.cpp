@@ -0,0 +1,92 @@
+/*
+    ThreadSafePingHistogram.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafePingHistogram.h"
+
+
+#define __SUB_BUCKETS__ (1 << PING_HISTOGRAM_SUB_BUCKET_BITS)
+
+
+// values below __SUB_BUCKETS__ each have their own bucket, above that each power of two is split into __SUB_BUCKETS__ buckets
+int ThreadSafePingHistogram_t::__bucketOf__ (unsigned long elapsedMicros) {
+    if (elapsedMicros < __SUB_BUCKETS__)
+        return (int) elapsedMicros;
+
+    int exponent = 31 - __builtin_clz ((uint32_t) elapsedMicros); // >= PING_HISTOGRAM_SUB_BUCKET_BITS
+    int shift = exponent - PING_HISTOGRAM_SUB_BUCKET_BITS;
+    int bucket = (shift + 1) * __SUB_BUCKETS__ + (int) ((elapsedMicros >> shift) - __SUB_BUCKETS__);
+    return bucket < PING_HISTOGRAM_BUCKETS ? bucket : PING_HISTOGRAM_BUCKETS - 1;
+}
+
+// the lowest value that falls into the bucket
+unsigned long ThreadSafePingHistogram_t::__lowestOf__ (int bucket) {
+    if (bucket < __SUB_BUCKETS__)
+        return bucket;
+
+    int shift = bucket / __SUB_BUCKETS__ - 1;
+    return (unsigned long) (__SUB_BUCKETS__ + bucket % __SUB_BUCKETS__) << shift;
+}
+
+void ThreadSafePingHistogram_t::__halve__ () {
+    __count__ = 0;
+    for (int i = 0; i < PING_HISTOGRAM_BUCKETS; i++)
+        __count__ += (__buckets__ [i] >>= 1);
+}
+
+void ThreadSafePingHistogram_t::reset () {
+    memset (__buckets__, 0, sizeof (__buckets__));
+    __count__ = 0;
+}
+
+void ThreadSafePingHistogram_t::add (unsigned long elapsedMicros) {
+    int bucket = __bucketOf__ (elapsedMicros);
+    if (__buckets__ [bucket] == UINT16_MAX)
+        __halve__ ();
+    __buckets__ [bucket]++;
+    __count__++;
+}
+
+void ThreadSafePingHistogram_t::merge (const ThreadSafePingHistogram_t& other) {
+    // if any of the sums would overflow, halve both histograms (the sum of two halved buckets always fits)
+    int shift = 0;
+    for (int i = 0; i < PING_HISTOGRAM_BUCKETS; i++)
+        if ((uint32_t) __buckets__ [i] + other.__buckets__ [i] > UINT16_MAX)
+            shift = 1;
+    if (shift)
+        __halve__ ();
+
+    for (int i = 0; i < PING_HISTOGRAM_BUCKETS; i++) {
+        __buckets__ [i] += other.__buckets__ [i] >> shift;
+        __count__ += other.__buckets__ [i] >> shift;
+    }
+}
+
+// returns the round-trip time (in ms) below which percentile % of samples fall, or 0 if there are no samples
+float ThreadSafePingHistogram_t::percentile (float percentile) {
+    if (!__count__)
+        return 0;
+    if (percentile < 0) percentile = 0;
+    if (percentile > 100) percentile = 100;
+
+    // the rank of the sample we are looking for
+    uint32_t rank = (uint32_t) (percentile / 100.0f * __count__ + 0.5f);
+    if (rank < 1) rank = 1;
+
+    uint32_t seen = 0;
+    int i;
+    for (i = 0; i < PING_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += __buckets__ [i];
+        if (seen >= rank)
+            break;
+    }
+
+    // report the middle of the bucket
+    unsigned long lowest = __lowestOf__ (i);
+    unsigned long width = i + 1 < PING_HISTOGRAM_BUCKETS ? __lowestOf__ (i + 1) - lowest : 1;
+    return (lowest + (width - 1) / 2.0f) / 1000.0f;
+}
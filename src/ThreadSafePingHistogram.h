@@ -0,0 +1,51 @@
+/*
+    ThreadSafePingHistogram.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Fixed-memory log-linear (HDR-style) histogram of round-trip times. Each power of two is split into
+    2 ^ PING_HISTOGRAM_SUB_BUCKET_BITS linear sub-buckets, so the relative error of percentiles stays the same
+    (12.5 % with 3 bits) from microseconds up to seconds, while adding a sample takes O(1) time.
+
+*/
+
+
+#ifndef __ThreadSafePingHistogram_H__
+    #define __ThreadSafePingHistogram_H__
+
+
+    #include <Arduino.h>
+
+
+    #ifndef PING_HISTOGRAM_SUB_BUCKET_BITS
+        #define PING_HISTOGRAM_SUB_BUCKET_BITS  3
+    #endif
+    #ifndef PING_HISTOGRAM_BUCKETS
+        #define PING_HISTOGRAM_BUCKETS          184 // with 3 sub-bucket bits the last bucket starts at ~ 31.5 s, longer times are counted there as well
+    #endif
+
+
+    class ThreadSafePingHistogram_t {
+
+        private:
+            uint16_t __buckets__ [PING_HISTOGRAM_BUCKETS]; // when a bucket would overflow all the buckets are halved, which keeps the shape of the distribution
+            uint32_t __count__;
+
+            static int __bucketOf__ (unsigned long elapsedMicros);
+            static unsigned long __lowestOf__ (int bucket);
+            void __halve__ ();
+
+        public:
+            ThreadSafePingHistogram_t () { reset (); }
+
+            void reset ();
+            void add (unsigned long elapsedMicros);
+            void merge (const ThreadSafePingHistogram_t& other);
+
+            inline uint32_t count () { return __count__; } // the number of samples (after halving it is only approximate)
+
+            // returns the round-trip time (in ms) below which percentile % of samples fall, or 0 if there are no samples
+            float percentile (float percentile);
+    };
+
+#endif
@@ -0,0 +1,149 @@
+/*
+    ThreadSafePingMonitor.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafePingMonitor.h"
+#include <math.h>
+
+
+ThreadSafePingMonitor_t::ThreadSafePingMonitor_t () {
+    __sampleCount__ = 0;
+    __newestSample__ = -1;
+    memset (__windows__, 0, sizeof (__windows__));
+    __mutex__ = xSemaphoreCreateMutex ();
+}
+
+ThreadSafePingMonitor_t::~ThreadSafePingMonitor_t () {
+    if (__mutex__)
+        vSemaphoreDelete (__mutex__);
+}
+
+void ThreadSafePingMonitor_t::reset () {
+    if (!__mutex__)
+        return;
+    xSemaphoreTake (__mutex__, portMAX_DELAY);
+        __sampleCount__ = 0;
+        __newestSample__ = -1;
+        memset (__windows__, 0, sizeof (__windows__));
+    xSemaphoreGive (__mutex__);
+}
+
+unsigned long ThreadSafePingMonitor_t::__windowMillis__ (int window) {
+    switch (window) {
+        case LAST_MINUTE:       return 60000UL;
+        case LAST_5_MINUTES:    return 300000UL;
+        default:                return 3600000UL;
+    }
+}
+
+// subtracts the buckets that are not inside the window any more from the window totals (when millis () wraps around after 49 days all of them expire)
+void ThreadSafePingMonitor_t::__expire__ (__window_t__ *window, unsigned long bucketMillis, unsigned long now) {
+    uint32_t index = now / bucketMillis;
+    for (int i = 0; i < PING_MONITOR_WINDOW_BUCKETS; i++) {
+        __bucket_t__ *b = &window->buckets [i];
+        if (b->sent && index - b->index >= PING_MONITOR_WINDOW_BUCKETS) {
+            window->sent -= b->sent;
+            window->received -= b->received;
+            window->sumMicros -= b->sumMicros;
+            window->sumSquaredMicros -= b->sumSquaredMicros;
+            *b = {};
+        }
+    }
+}
+
+void ThreadSafePingMonitor_t::__add__ (uint32_t seqno, long elapsedMicros) {
+    if (!__mutex__)
+        return;
+    unsigned long now = millis ();
+
+    xSemaphoreTake (__mutex__, portMAX_DELAY);
+        // ring buffer of the recent samples
+        __newestSample__ = (__newestSample__ + 1) % PING_MONITOR_SAMPLES;
+        __samples__ [__newestSample__] = { seqno, now, elapsedMicros };
+        if (__sampleCount__ < PING_MONITOR_SAMPLES)
+            __sampleCount__++;
+
+        // sliding windows
+        for (int w = 0; w < 3; w++) {
+            __window_t__ *window = &__windows__ [w];
+            unsigned long bucketMillis = __windowMillis__ (w) / PING_MONITOR_WINDOW_BUCKETS;
+            __expire__ (window, bucketMillis, now);
+
+            uint32_t index = now / bucketMillis;
+            __bucket_t__ *b = &window->buckets [index % PING_MONITOR_WINDOW_BUCKETS];
+            if (b->index != index) // the bucket is empty (expired) or it belongs to a period that has passed
+                *b = { index, 0, 0, 0, 0, 0, 0 };
+
+            b->sent++;
+            window->sent++;
+            if (elapsedMicros >= 0) {
+                uint64_t us = elapsedMicros;
+                if (!b->received || (unsigned long) elapsedMicros < b->minMicros) b->minMicros = elapsedMicros;
+                if ((unsigned long) elapsedMicros > b->maxMicros) b->maxMicros = elapsedMicros;
+                b->received++;
+                b->sumMicros += us;
+                b->sumSquaredMicros += us * us;
+                window->received++;
+                window->sumMicros += us;
+                window->sumSquaredMicros += us * us;
+            }
+        }
+    xSemaphoreGive (__mutex__);
+}
+
+// returns the number of samples in the ring buffer, sample (0) is the most recent one
+int ThreadSafePingMonitor_t::samples () {
+    if (!__mutex__)
+        return 0;
+    xSemaphoreTake (__mutex__, portMAX_DELAY);
+        int n = __sampleCount__;
+    xSemaphoreGive (__mutex__);
+    return n;
+}
+
+ThreadSafePingMonitor_t::sample_t ThreadSafePingMonitor_t::sample (int i) {
+    sample_t s = { 0, 0, -1 };
+    if (!__mutex__)
+        return s;
+    xSemaphoreTake (__mutex__, portMAX_DELAY);
+        if (i >= 0 && i < __sampleCount__)
+            s = __samples__ [(__newestSample__ - i + PING_MONITOR_SAMPLES) % PING_MONITOR_SAMPLES];
+    xSemaphoreGive (__mutex__);
+    return s;
+}
+
+// returns statistics of LAST_MINUTE, LAST_5_MINUTES or LAST_HOUR
+ThreadSafePingMonitor_t::windowStatistics_t ThreadSafePingMonitor_t::statistics (int window) {
+    windowStatistics_t s = {};
+    if (window < LAST_MINUTE || window > LAST_HOUR || !__mutex__)
+        return s;
+
+    xSemaphoreTake (__mutex__, portMAX_DELAY);
+        __window_t__ *w = &__windows__ [window];
+        __expire__ (w, __windowMillis__ (window) / PING_MONITOR_WINDOW_BUCKETS, millis ());
+
+        s.sent = w->sent;
+        s.received = w->received;
+        s.lost = w->sent - w->received;
+        if (w->received) {
+            // min and max can't be subtracted when a bucket expires, so they are picked from the buckets
+            unsigned long minMicros = 0xFFFFFFFF, maxMicros = 0;
+            for (int i = 0; i < PING_MONITOR_WINDOW_BUCKETS; i++)
+                if (w->buckets [i].received) {
+                    if (w->buckets [i].minMicros < minMicros) minMicros = w->buckets [i].minMicros;
+                    if (w->buckets [i].maxMicros > maxMicros) maxMicros = w->buckets [i].maxMicros;
+                }
+            double mean = (double) w->sumMicros / w->received;
+            double variance = (double) w->sumSquaredMicros / w->received - mean * mean;
+            s.min_time = minMicros / 1000.0f;
+            s.max_time = maxMicros / 1000.0f;
+            s.mean_time = mean / 1000.0;
+            s.stddev_time = variance > 0 ? sqrt (variance) / 1000.0 : 0;
+        }
+    xSemaphoreGive (__mutex__);
+    return s;
+}
@@ -0,0 +1,101 @@
+/*
+    ThreadSafePingMonitor.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Statistics for long-running (count = 0) pings. The monitor keeps a ring buffer of the most recent samples and
+    sliding-window statistics of the last minute, 5 minutes and hour. Each window is divided into
+    PING_MONITOR_WINDOW_BUCKETS buckets of integer sums, so the window totals are updated incrementally (adding the
+    new sample and subtracting the expired bucket) in fixed memory and without loss of precision, however long the
+    monitor runs. The monitor can be read from other tasks while ping () is running.
+
+*/
+
+
+#ifndef __ThreadSafePingMonitor_H__
+    #define __ThreadSafePingMonitor_H__
+
+
+    #include <Arduino.h>
+
+
+    #ifndef PING_MONITOR_SAMPLES
+        #define PING_MONITOR_SAMPLES        32  // the most recent samples kept in the ring buffer
+    #endif
+    #ifndef PING_MONITOR_WINDOW_BUCKETS
+        #define PING_MONITOR_WINDOW_BUCKETS 12  // the resolution of sliding windows: the last minute is kept in 5 s buckets, ...
+    #endif
+
+
+    class ThreadSafePingMonitor_t {
+
+        public:
+            enum { LAST_MINUTE = 0, LAST_5_MINUTES = 1, LAST_HOUR = 2 };
+
+            struct sample_t {
+                uint32_t seqno;             // 32-bit sequence number, it doesn't wrap around when the 16-bit sequence number of echo requests does
+                unsigned long millis;       // when the sample was taken
+                long elapsedMicros;         // round-trip time or -1 if the echo request was lost
+            };
+
+            struct windowStatistics_t {
+                uint32_t sent;
+                uint32_t received;
+                uint32_t lost;
+                float min_time;             // ms
+                float max_time;
+                float mean_time;
+                float stddev_time;
+            };
+
+        private:
+            struct __bucket_t__ {
+                uint32_t index;             // millis () / bucket duration, identifies the period the bucket belongs to
+                uint32_t sent;
+                uint32_t received;
+                uint64_t sumMicros;
+                uint64_t sumSquaredMicros;
+                unsigned long minMicros;
+                unsigned long maxMicros;
+            };
+
+            struct __window_t__ {
+                __bucket_t__ buckets [PING_MONITOR_WINDOW_BUCKETS];
+                uint32_t sent;              // totals of all the buckets in the window
+                uint32_t received;
+                uint64_t sumMicros;
+                uint64_t sumSquaredMicros;
+            };
+
+            sample_t __samples__ [PING_MONITOR_SAMPLES];
+            int __sampleCount__;
+            int __newestSample__;
+
+            __window_t__ __windows__ [3];
+
+            SemaphoreHandle_t __mutex__;                // NULL if it couldn't be created, the monitor then stays empty
+
+            static unsigned long __windowMillis__ (int window);
+            void __expire__ (__window_t__ *window, unsigned long bucketMillis, unsigned long now);
+            void __add__ (uint32_t seqno, long elapsedMicros);
+
+        public:
+            ThreadSafePingMonitor_t ();
+            ~ThreadSafePingMonitor_t ();
+
+            void reset ();
+
+            inline const char *errText () { return __mutex__ ? NULL : "out of memory"; } // ping () refuses to start with a monitor that couldn't be created
+
+            inline void addReply (uint32_t seqno, unsigned long elapsedMicros) { __add__ (seqno, (long) elapsedMicros); }
+            inline void addLoss (uint32_t seqno) { __add__ (seqno, -1); }
+
+            // returns the number of samples in the ring buffer, sample (0) is the most recent one
+            int samples ();
+            sample_t sample (int i);
+
+            // returns statistics of LAST_MINUTE, LAST_5_MINUTES or LAST_HOUR
+            windowStatistics_t statistics (int window);
+    };
+
+#endif
@@ -0,0 +1,35 @@
+/*
+    ThreadSafePingResults.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafePingResults.h"
+
+
+ThreadSafePingResults_t::ThreadSafePingResults_t (int length) {
+    __queue__ = xQueueCreate (length, sizeof (record_t));
+}
+
+ThreadSafePingResults_t::~ThreadSafePingResults_t () {
+    if (__queue__)
+        vQueueDelete (__queue__);
+}
+
+bool ThreadSafePingResults_t::push (const record_t& record) {
+    if (__queue__ && xQueueSend (__queue__, &record, 0) == pdTRUE)
+        return true;
+    __atomic_fetch_add (&__dropped__, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+int ThreadSafePingResults_t::receive (record_t *records, int maxRecords, TickType_t ticks) {
+    if (!__queue__ || maxRecords < 1 || xQueueReceive (__queue__, &records [0], ticks) != pdTRUE)
+        return 0;
+    int n = 1;
+    while (n < maxRecords && xQueueReceive (__queue__, &records [n], 0) == pdTRUE)
+        n++;
+    return n;
+}
@@ -0,0 +1,58 @@
+/*
+    ThreadSafePingResults.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    A bounded queue of compact per-echo-request records, filled by the pinging task and drained by some other task in batches,
+    so that slow reporting (printing, publishing, ...) doesn't delay the echo requests or inflate round-trip times like slow
+    onReceive () handlers do. Pushing never blocks: when the queue is full the record is dropped and counted. The same queue
+    can be shared by many sessions, the tag of each record tells them apart.
+
+*/
+
+
+#ifndef __ThreadSafePingResults_H__
+    #define __ThreadSafePingResults_H__
+
+
+    #include <Arduino.h>
+
+
+    #ifndef PING_RESULTS_DEFAULT_LENGTH
+        #define PING_RESULTS_DEFAULT_LENGTH 32  // records the queue can hold
+    #endif
+
+
+    class ThreadSafePingResults_t {
+
+        public:
+            enum { REPLY = 0, LOST = 1, LATE = 2 };
+
+            struct record_t {
+                int64_t sentMicros;             // esp_timer_get_time () when the echo request was sent
+                uint32_t seqno;                 // 32-bit sequence number of the echo request (the session's round for ThreadSafeMultiPing_t)
+                uint32_t elapsedMicros;         // round-trip time, 0 if the echo request was lost
+                int16_t bytes;                  // payload size of the reply, -1 if the echo request was lost
+                uint8_t status;                 // REPLY, LOST or LATE (the reply arrived after its loss has been reported)
+                uint8_t tag;                    // given to setResults (), to tell the sessions apart
+            };
+
+        private:
+            QueueHandle_t __queue__;
+            uint32_t __dropped__ = 0;
+
+        public:
+            ThreadSafePingResults_t (int length = PING_RESULTS_DEFAULT_LENGTH);
+            ~ThreadSafePingResults_t ();
+
+            // doesn't block, returns false if the queue is full (or couldn't be created) and the record has been dropped
+            bool push (const record_t& record);
+
+            // waits up to ticks for the first record and then takes the ones that are already waiting, up to maxRecords, returns the number of records taken
+            int receive (record_t *records, int maxRecords, TickType_t ticks = portMAX_DELAY);
+
+            inline int waiting () { return __queue__ ? uxQueueMessagesWaiting (__queue__) : 0; }
+            inline uint32_t dropped () { return __atomic_load_n (&__dropped__, __ATOMIC_RELAXED); } // records that didn't fit into the queue
+    };
+
+#endif
@@ -0,0 +1,253 @@
+/*
+    ThreadSafePingSweep.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafePingSweep.h"
+#include <new>
+
+
+ThreadSafePingSweep_t::~ThreadSafePingSweep_t () {
+    delete [] __alive__;
+    delete [] __times__;
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingSweep_t::sweep (const char *cidr, const ThreadSafePingSweepOptions_t& options) {
+    char address [INET_ADDRSTRLEN];
+    int prefix = 32;
+
+    const char *slash = strchr (cidr, '/');
+    if (slash) {
+        if (slash - cidr >= (int) sizeof (address))
+            return __errText__ = "invalid network address";
+        memcpy (address, cidr, slash - cidr);
+        address [slash - cidr] = 0;
+        char *end;
+        prefix = strtol (slash + 1, &end, 10);
+        if (end == slash + 1 || *end || prefix < 0 || prefix > 32)
+            return __errText__ = "invalid network address";
+    } else {
+        if (strlen (cidr) >= sizeof (address))
+            return __errText__ = "invalid network address";
+        strcpy (address, cidr);
+    }
+
+    struct in_addr addr;
+    if (inet_pton (AF_INET, address, &addr) <= 0)
+        return __errText__ = "invalid network address";
+
+    uint32_t mask = prefix ? 0xFFFFFFFFUL << (32 - prefix) : 0;
+    uint32_t first = ntohl (addr.s_addr) & mask;
+    uint32_t last = first | ~mask;
+    if (prefix < 31) { // skip the network and broadcast addresses
+        first++;
+        last--;
+    }
+
+    IPAddress f ((first >> 24) & 0xFF, (first >> 16) & 0xFF, (first >> 8) & 0xFF, first & 0xFF);
+    IPAddress l ((last >> 24) & 0xFF, (last >> 16) & 0xFF, (last >> 8) & 0xFF, last & 0xFF);
+    return sweep (f, l, options);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingSweep_t::sweep (const IPAddress& first, const IPAddress& last, const ThreadSafePingSweepOptions_t& options) {
+    if (!WiFi.isConnected () || WiFi.localIP () == IPAddress (0, 0, 0, 0))
+        return __errText__ = "not connected";
+
+    // check argument values
+    if (options.rate < 1 || options.rate > 10000) return __errText__ = "invalid value";
+    if (options.window < 1 || options.window > PING_SWEEP_MAX_WINDOW) return __errText__ = "invalid value";
+    if (options.timeoutMicros < 1000 || options.timeoutMicros > 30000000UL) return __errText__ = "invalid value";
+    if (options.size < 4 || options.size > PING_STACK_MAX_SIZE) return __errText__ = "invalid value";
+    if (options.attempts < 1 || options.attempts > 10) return __errText__ = "invalid value";
+    if (options.onWaitMicros && (options.onWaitMicros < 1000 || options.onWaitMicros > 3600000000UL)) return __errText__ = "invalid value";
+
+    uint32_t f = (uint32_t) first [0] << 24 | (uint32_t) first [1] << 16 | (uint32_t) first [2] << 8 | first [3];
+    uint32_t l = (uint32_t) last [0] << 24 | (uint32_t) last [1] << 16 | (uint32_t) last [2] << 8 | last [3];
+    if (l < f) return __errText__ = "invalid value";
+    if (l - f >= PING_SWEEP_MAX_HOSTS) return __errText__ = "range too large";
+
+    // initialize measuring variables
+    __errText__ = __allocate__ (f, l - f + 1);
+    if (__errText__)
+        return __errText__;
+    __probe__.__resetStatistics__ (options.size);
+    #if PING_IPV6
+        __probe__.__isIPv6__ = false;
+    #endif
+    __probe__.__target_addr_IPv4__ = {};
+    __probe__.__target_addr_IPv4__.sin_family = AF_INET;
+    __probe__.__target_addr_IPv4__.sin_len = sizeof (__probe__.__target_addr_IPv4__);
+    __inFlightHead__ = __inFlightCount__ = 0;
+    __stopped__ = false;
+
+    // payloads of 4 - 7 bytes are padded to hold the 64-bit time stamp, like ThreadSafePing_t does
+    int size = options.size + ThreadSafePing_t::__paddingOf__ (options.size);
+
+    int sockfd = ThreadSafePing_t::__takeSocket__ (false, &__errText__);
+    if (sockfd < 0)
+        return __errText__;
+
+    // the socket may have been used by other pings before, make sure their echo requests in flight are forgotten
+    for (int i = 0; i < PING_MAX_WINDOW; i++)
+        ThreadSafePing_t::__slotClear__ (&ThreadSafePing_t::__getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET][i]);
+
+    // build the echo request only once, the sequence number of each echo request is the host number (in the range)
+    uint32_t packet [(sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE + 3) / 4];
+    ThreadSafePing_t::__buildPacket__ ((char *) packet, false, sockfd, size);
+
+    // begin the sweep ...
+    //  - echo requests are sent one after another, no more often than the rate allows and only while the window isn't full
+    //  - an echo request leaves the window when its reply arrives or when it times out, only replies to echo requests in the window are accepted
+    unsigned long gapMicros = 1000000UL / options.rate;
+    unsigned long dueMicros = micros ();
+    unsigned long lastWaitMicros = micros (); // when onWait () has been called the last time
+    int attempt = 0;
+    int host = 0;
+
+    while (!__stopped__) {
+        // find the next host that hasn't replied yet, the next attempt begins when all the echo requests of this one have been answered or timed out
+        while (host < __hostCount__ && alive (host))
+            host++;
+        if (host >= __hostCount__ && !__inFlightCount__ && attempt + 1 < options.attempts) {
+            attempt++;
+            host = 0;
+            continue;
+        }
+        bool moreToSend = host < __hostCount__;
+
+        // send the next echo request if it is due and the window isn't full
+        if (moreToSend && __inFlightCount__ < options.window && (long) (micros () - dueMicros) >= 0) {
+            dueMicros = micros () - dueMicros < gapMicros ? dueMicros + gapMicros : micros () + gapMicros;
+
+            __probe__.__target_addr_IPv4__.sin_addr.s_addr = htonl (__first__ + host);
+            __probe__.__sent__++;
+            int64_t sentMicros = ThreadSafePing_t::__nowMicros__ (); // before __ping_send__ time-stamps the echo request, so that its reply is not taken for a stale one
+            if (ThreadSafePing_t::__ping_send__ (&__probe__, sockfd, (char *) packet, (uint16_t) host, size) == NULL) {
+                __inFlight_t__ *p = &__inFlight__ [(__inFlightHead__ + __inFlightCount__) % PING_SWEEP_MAX_WINDOW];
+                p->host = host;
+                p->sent_time = sentMicros;
+                __inFlightCount__++;
+            }
+            host++;
+            continue;
+        }
+
+        // pick up all the replies that are waiting
+        __receive__ (sockfd);
+
+        // forget the echo requests that have been answered or have timed out
+        unsigned long waitMicros = 1000000; // the deadlines are checked again by then anyway
+        while (__inFlightCount__) {
+            __inFlight_t__ *p = &__inFlight__ [__inFlightHead__];
+            unsigned long waitingMicros = ThreadSafePing_t::__nowMicros__ () - p->sent_time;
+            if (!alive (p->host) && waitingMicros < options.timeoutMicros) {
+                if (waitMicros > options.timeoutMicros - waitingMicros) waitMicros = options.timeoutMicros - waitingMicros;
+                break;
+            }
+            __inFlightHead__ = (__inFlightHead__ + 1) % PING_SWEEP_MAX_WINDOW;
+            __inFlightCount__--;
+        }
+
+        if (!moreToSend && !__inFlightCount__ && attempt + 1 >= options.attempts)
+            break; // finished
+
+        // report waiting each onWaitMicros
+        if (options.onWaitMicros) {
+            if (micros () - lastWaitMicros >= options.onWaitMicros) {
+                lastWaitMicros = micros ();
+                onWait ();
+            }
+            unsigned long sinceMicros = micros () - lastWaitMicros;
+            unsigned long untilWaitMicros = sinceMicros < options.onWaitMicros ? options.onWaitMicros - sinceMicros : 0;
+            if (waitMicros > untilWaitMicros) waitMicros = untilWaitMicros;
+        }
+
+        // sleep until a reply arrives, the oldest echo request times out or the next echo request is due
+        if (moreToSend && __inFlightCount__ < options.window) {
+            long untilSendMicros = (long) (dueMicros - micros ());
+            if (untilSendMicros < 0) untilSendMicros = 0;
+            if (waitMicros > (unsigned long) untilSendMicros) waitMicros = untilSendMicros;
+        }
+        ThreadSafePing_t::__waitForPacket__ (sockfd, -1, waitMicros);
+    }
+
+    // pick up the replies that have arrived meanwhile
+    __receive__ (sockfd);
+
+    ThreadSafePing_t::__releaseSocket__ (sockfd, false);
+    return NULL; // OK
+}
+
+IPAddress ThreadSafePingSweep_t::address (int host) {
+    uint32_t a = __first__ + host;
+    return IPAddress ((a >> 24) & 0xFF, (a >> 16) & 0xFF, (a >> 8) & 0xFF, a & 0xFF);
+}
+
+// allocates the result arrays for the range (reusing them if they are large enough), returns error text or NULL if OK
+const char *ThreadSafePingSweep_t::__allocate__ (uint32_t first, int hostCount) {
+    if (hostCount > __hostCount__ || !__alive__) {
+        delete [] __alive__;
+        delete [] __times__;
+        __alive__ = new (std::nothrow) uint32_t [(hostCount + 31) / 32];
+        __times__ = new (std::nothrow) uint16_t [hostCount];
+        if (!__alive__ || !__times__) {
+            delete [] __alive__;
+            delete [] __times__;
+            __alive__ = nullptr;
+            __times__ = nullptr;
+            __hostCount__ = 0;
+            return "out of memory";
+        }
+    }
+    __first__ = first;
+    __hostCount__ = hostCount;
+    __aliveCount__ = 0;
+    memset (__alive__, 0, (hostCount + 31) / 32 * sizeof (uint32_t));
+    memset (__times__, 0, hostCount * sizeof (uint16_t));
+    return NULL; // OK
+}
+
+// reads all the packets waiting on the socket and marks the hosts that replied
+void ThreadSafePingSweep_t::__receive__ (int sockfd) {
+    char buf [60 + sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE]; // the longest IPv4 header, longer replies of other sessions get truncated, but their length is still known
+    ThreadSafePing_t::__drainSocket__ (sockfd, false, buf, sizeof (buf), sockfd, 1, &__probe__.__counters__,
+                                       [] (void *context, const ThreadSafePing_t::__packet_t__ *packet) {
+                                           return ((ThreadSafePingSweep_t *) context)->__match__ (packet);
+                                       }, this);
+}
+
+// marks the host that sent an echo reply to one of our echo requests
+bool ThreadSafePingSweep_t::__match__ (const ThreadSafePing_t::__packet_t__ *packet) {
+    if (!packet->isEcho)
+        return false;
+
+    // the sequence number is the host number, the reply must come from that host and answer its echo request in flight, not one of an earlier attempt or of an earlier sweep
+    uint32_t host = ntohl (((const struct sockaddr_in *) packet->from)->sin_addr.s_addr) - __first__;
+    bool inFlight = false;
+    if (host < (uint32_t) __hostCount__ && (uint16_t) host == packet->seqno)
+        for (int i = 0; i < __inFlightCount__ && !inFlight; i++) {
+            __inFlight_t__ *p = &__inFlight__ [(__inFlightHead__ + i) % PING_SWEEP_MAX_WINDOW];
+            inFlight = p->host == host && packet->sentMicros >= p->sent_time;
+        }
+    if (!inFlight) {
+        ThreadSafePing_t::__count__ (&__probe__.__counters__, &ThreadSafePingCounters_t::stale);
+        return true;
+    }
+    if (alive (host))
+        return true; // a duplicate or a reply to an earlier attempt
+
+    unsigned long elapsedMicros = packet->receivedMicros - packet->sentMicros;
+    __alive__ [host / 32] |= 1UL << (host % 32);
+    __times__ [host] = elapsedMicros / 10 < 0xFFFF ? elapsedMicros / 10 : 0xFFFF;
+    __aliveCount__++;
+    __probe__.__received__++;
+
+    // report intermediate results
+    onReceive (host, elapsedMicros / 1000.0f);
+    return true;
+}
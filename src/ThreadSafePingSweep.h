@@ -0,0 +1,99 @@
+/*
+    ThreadSafePingSweep.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Discovers live hosts in an IPv4 range (for example 192.168.1.0/24) by sending one echo request to each of the addresses
+    through a single raw socket, at a limited rate and with a limited number of echo requests in flight. Replies are collected
+    while the sweep goes on. The result is kept in a compact form: a bitmap of live hosts and an array of their round-trip times.
+
+*/
+
+
+#ifndef __ThreadSafePingSweep_H__
+    #define __ThreadSafePingSweep_H__
+
+
+    #include "ThreadSafePing.h"
+
+
+    #ifndef PING_SWEEP_MAX_HOSTS
+        #define PING_SWEEP_MAX_HOSTS        1024    // the largest range that can be swept at once (/22)
+    #endif
+    #ifndef PING_SWEEP_MAX_WINDOW
+        #define PING_SWEEP_MAX_WINDOW       64
+    #endif
+    #ifndef PING_SWEEP_DEFAULT_RATE
+        #define PING_SWEEP_DEFAULT_RATE     100     // echo requests per second
+    #endif
+    #ifndef PING_SWEEP_DEFAULT_WINDOW
+        #define PING_SWEEP_DEFAULT_WINDOW   16
+    #endif
+
+
+    struct ThreadSafePingSweepOptions_t {
+        int rate = PING_SWEEP_DEFAULT_RATE;                                 // 1 - 10000 echo requests per second
+        int window = PING_SWEEP_DEFAULT_WINDOW;                             // 1 - PING_SWEEP_MAX_WINDOW echo requests in flight at the same time
+        unsigned long timeoutMicros = 1000000UL * PING_DEFAULT_TIMEOUT;    // 1 ms - 30 s
+        int size = PING_DEFAULT_SIZE;                                       // 4 - PING_STACK_MAX_SIZE bytes of payload, 4 - 7 are sent padded to the 8-byte time stamp
+        int attempts = 1;                                                   // hosts that haven't replied are probed again, 1 - 10
+        unsigned long onWaitMicros = PING_DEFAULT_ON_WAIT;                  // 1 ms - 3600 s between onWait () calls, 0 = never
+    };
+
+
+    class ThreadSafePingSweep_t {
+
+        private:
+            ThreadSafePingStatistics_t __probe__;       // sends the echo requests, its target address changes with each of them
+
+            uint32_t __first__ = 0;                     // the first address of the range, in host byte order
+            int __hostCount__ = 0;
+            uint32_t *__alive__ = nullptr;              // bitmap of the hosts that replied
+            uint16_t *__times__ = nullptr;              // their round-trip times in 10 us units
+            int __aliveCount__ = 0;
+
+            struct __inFlight_t__ {
+                uint16_t host;
+                int64_t sent_time;
+            };
+            __inFlight_t__ __inFlight__ [PING_SWEEP_MAX_WINDOW];   // ring of the echo requests in flight, in the order they were sent
+            int __inFlightHead__;
+            int __inFlightCount__;
+
+            const char *__errText__ = nullptr;
+            bool __stopped__;
+
+            const char *__allocate__ (uint32_t first, int hostCount);
+            void __receive__ (int sockfd);
+            bool __match__ (const ThreadSafePing_t::__packet_t__ *packet);
+
+        public:
+            ThreadSafePingSweep_t () {}
+            ~ThreadSafePingSweep_t ();
+
+            // sweeps a CIDR range, like "192.168.1.0/24", the network and broadcast addresses are skipped, returns error text or NULL if OK
+            const char *sweep (const char *cidr, const ThreadSafePingSweepOptions_t& options = ThreadSafePingSweepOptions_t ());
+            // sweeps all the addresses from first to last, returns error text or NULL if OK
+            const char *sweep (const IPAddress& first, const IPAddress& last, const ThreadSafePingSweepOptions_t& options = ThreadSafePingSweepOptions_t ());
+
+            inline void stop () { __stopped__ = true; }
+
+            inline int hosts () { return __hostCount__; }
+            IPAddress address (int host);
+            inline bool alive (int host) { return __alive__ [host / 32] & (1UL << (host % 32)); }
+            inline float elapsed_time (int host) { return alive (host) ? __times__ [host] / 100.0f : 0; } // in ms, 655.35 ms at most
+            inline int aliveCount () { return __aliveCount__; }
+            inline uint32_t sent () { return __probe__.sent (); } // echo requests sent, including repeated attempts
+
+            // the compact result: bit (host % 32) of word (host / 32) is set for each live host, times are in 10 us units
+            inline const uint32_t *aliveBitmap () { return __alive__; }
+            inline const uint16_t *times () { return __times__; }
+
+            inline const ThreadSafePingCounters_t& counters () { return __probe__.counters (); }
+            inline const char *errText () { return __errText__; }
+
+            virtual void onReceive (int host, float elapsedTime) {}    // called when a host replies for the first time
+            virtual void onWait () {}
+    };
+
+#endif
@@ -0,0 +1,302 @@
+/*
+    ThreadSafePingTraceroute.cpp
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+*/
+
+
+#include "ThreadSafePingTraceroute.h"
+
+
+#ifndef ICMP6_DST_UNREACH
+    #define ICMP6_DST_UNREACH   1
+#endif
+#ifndef ICMP6_TIME_EXCEEDED
+    #define ICMP6_TIME_EXCEEDED 3
+#endif
+
+enum { __TRACE_REPLY__ = 0, __TRACE_TIME_EXCEEDED__ = 1, __TRACE_UNREACHABLE__ = 2 };
+
+
+// each trace takes its own range of sequence numbers from the upper half (0x8000 - 0xffff), away from the 1, 2, ... that ping () (for its first 32767 echo requests)
+// and sweep () use, and wraps around within it, so that late answers to an earlier trace or ping through the same socket can't be mistaken for answers to this one
+enum { __TRACE_SEQNO_BASE__ = 0x8000, __TRACE_SEQNO_RANGE__ = 0x8000 };
+static uint32_t __nextSeqnoOffset__ = 0;
+
+
+// checks if buf contains time exceeded or destination unreachable message about one of our echo requests, extracts the quoted id and sequence number, returns false if buf should be ignored
+static bool __parseIcmpError__ (bool isIPv6, const char *buf, int bytes, uint16_t *id, uint16_t *seqno, int *type) {
+    const struct icmp_echo_hdr *quoted;
+
+    #if PING_IPV6
+    if (isIPv6) {
+        // IPv6 header, ICMPv6 header, the quoted IPv6 header (without extension headers) and the quoted echo header
+        if (bytes < (int) (40 + 8 + 40 + sizeof (struct icmp6_echo_hdr)))
+            return false;
+        if (buf [40] == ICMP6_TIME_EXCEEDED) *type = __TRACE_TIME_EXCEEDED__;
+        else if (buf [40] == ICMP6_DST_UNREACH) *type = __TRACE_UNREACHABLE__;
+        else return false;
+        if (buf [48 + 6] != IPPROTO_ICMPV6)
+            return false;
+        quoted = (const struct icmp_echo_hdr *) (buf + 40 + 8 + 40);
+        if (quoted->type != ICMP6_ECHO_REQUEST)
+            return false;
+
+    } else
+    #endif
+    {
+        // IPv4 header, ICMP header, the quoted IPv4 header and (at least) the first 8 bytes of the quoted datagram: the echo header
+        const struct ip_hdr *iphdr = (const struct ip_hdr *) buf;
+        int iphdr_len = IPH_HL (iphdr) * 4;
+        if (bytes < (int) (iphdr_len + 8 + 20 + sizeof (struct icmp_echo_hdr)))
+            return false;
+        uint8_t icmpType = buf [iphdr_len];
+        if (icmpType == ICMP_TE) *type = __TRACE_TIME_EXCEEDED__;
+        else if (icmpType == ICMP_DUR) *type = __TRACE_UNREACHABLE__;
+        else return false;
+        const struct ip_hdr *quotedIphdr = (const struct ip_hdr *) (buf + iphdr_len + 8);
+        int quotedIphdr_len = IPH_HL (quotedIphdr) * 4;
+        if (IPH_PROTO (quotedIphdr) != IPPROTO_ICMP || bytes < (int) (iphdr_len + 8 + quotedIphdr_len + sizeof (struct icmp_echo_hdr)))
+            return false;
+        quoted = (const struct icmp_echo_hdr *) (buf + iphdr_len + 8 + quotedIphdr_len);
+        if (quoted->type != ICMP_ECHO)
+            return false;
+    }
+
+    *id = quoted->id;
+    *seqno = quoted->seqno;
+    return true;
+}
+
+
+// returns error text or NULL if OK
+const char *ThreadSafePingTraceroute_t::trace (const char *target, const ThreadSafePingTracerouteOptions_t& options) {
+    __errText__ = __probe__.__resolveTargetName__ (target);
+    if (__errText__)
+        return __errText__;
+    return __trace__ (options);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingTraceroute_t::trace (const IPAddress& target, const ThreadSafePingTracerouteOptions_t& options) {
+    char address [INET_ADDRSTRLEN];
+    snprintf (address, sizeof (address), "%u.%u.%u.%u", target [0], target [1], target [2], target [3]);
+    return trace (address, options);
+}
+
+// returns error text or NULL if OK
+const char *ThreadSafePingTraceroute_t::__trace__ (const ThreadSafePingTracerouteOptions_t& options) {
+    // check argument values
+    if (options.maxHops < 1 || options.maxHops > PING_TRACEROUTE_MAX_HOPS) return __errText__ = "invalid value";
+    if (options.probes < 1 || options.probes > 10) return __errText__ = "invalid value";
+    if (options.window < 1 || options.window > PING_TRACEROUTE_MAX_WINDOW) return __errText__ = "invalid value";
+    if (options.rate < 1 || options.rate > 10000) return __errText__ = "invalid value";
+    if (options.timeoutMicros < 1000 || options.timeoutMicros > 30000000UL) return __errText__ = "invalid value";
+    if (options.size < 4 || options.size > PING_STACK_MAX_SIZE) return __errText__ = "invalid value";
+    if (options.onWaitMicros && (options.onWaitMicros < 1000 || options.onWaitMicros > 3600000000UL)) return __errText__ = "invalid value";
+
+    // initialize measuring variables
+    bool isIPv6 = __probe__.__isIPv6__;
+    int probeCount = options.maxHops * options.probes;
+    memset (__hops__, 0, sizeof (__hops__));
+    __maxHops__ = options.maxHops;
+    __probes__ = options.probes;
+    __lastHop__ = options.maxHops;
+    __reached__ = false;
+    uint32_t offset = __atomic_load_n (&__nextSeqnoOffset__, __ATOMIC_RELAXED);
+    uint32_t base;
+    do {
+        base = offset + probeCount <= __TRACE_SEQNO_RANGE__ ? offset : 0; // the range of this trace must not wrap around 16 bits
+    } while (!__atomic_compare_exchange_n (&__nextSeqnoOffset__, &offset, base + probeCount, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __seqnoBase__ = __TRACE_SEQNO_BASE__ + base;
+    __probe__.__resetStatistics__ (options.size);
+    __inFlightHead__ = __inFlightCount__ = 0;
+    __stopped__ = false;
+
+    // payloads of 4 - 7 bytes are padded to hold the 64-bit time stamp, like ThreadSafePing_t does
+    int size = options.size + ThreadSafePing_t::__paddingOf__ (options.size);
+
+    int sockfd = ThreadSafePing_t::__takeSocket__ (isIPv6, &__errText__);
+    if (sockfd < 0)
+        return __errText__;
+
+    // the socket may have been used by other pings before, make sure their echo requests in flight are forgotten
+    for (int i = 0; i < PING_MAX_WINDOW; i++)
+        ThreadSafePing_t::__slotClear__ (&ThreadSafePing_t::__getPingReplies__ () [sockfd - LWIP_SOCKET_OFFSET][i]);
+
+    // the socket goes back to the pool with its previous TTL
+    int previousTtl;
+    int ttl = 1;
+    __errText__ = ThreadSafePing_t::__setTtl__ (sockfd, isIPv6, ttl, &previousTtl);
+    if (__errText__) {
+        ThreadSafePing_t::__releaseSocket__ (sockfd, isIPv6);
+        return __errText__;
+    }
+
+    // build the echo request only once
+    uint32_t packet [(sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE + 3) / 4];
+    ThreadSafePing_t::__buildPacket__ ((char *) packet, isIPv6, sockfd, size);
+
+    // begin the trace ...
+    //  - echo requests are sent one after another, the first one to each hop, then the second one to each hop, ..., no more often than the rate allows and only while the window isn't full
+    //  - as soon as the target (or destination unreachable) answers, the hops behind it are not probed any more
+    //  - an echo request leaves the window when it gets answered or when it times out
+    unsigned long gapMicros = 1000000UL / options.rate;
+    unsigned long dueMicros = micros ();
+    unsigned long lastWaitMicros = micros (); // when onWait () has been called the last time
+    int probe = 0;
+
+    while (!__stopped__) {
+        // skip the echo requests to the hops behind the end of the route
+        while (probe < probeCount && probe % __maxHops__ + 1 > __lastHop__)
+            probe++;
+        bool moreToSend = probe < probeCount;
+
+        // send the next echo request if it is due and the window isn't full
+        if (moreToSend && __inFlightCount__ < options.window && (long) (micros () - dueMicros) >= 0) {
+            dueMicros = micros () - dueMicros < gapMicros ? dueMicros + gapMicros : micros () + gapMicros;
+
+            int hop = probe % __maxHops__ + 1;
+            if (hop != ttl) {
+                __errText__ = ThreadSafePing_t::__setTtl__ (sockfd, isIPv6, hop);
+                if (__errText__)
+                    break;
+                ttl = hop;
+            }
+
+            __probe__.__sent__++;
+            __hops__ [hop - 1].sent++;
+            if (ThreadSafePing_t::__ping_send__ (&__probe__, sockfd, (char *) packet, __seqnoBase__ + probe, size) == NULL) {
+                __inFlight_t__ *p = &__inFlight__ [(__inFlightHead__ + __inFlightCount__) % PING_TRACEROUTE_MAX_WINDOW];
+                p->probe = probe;
+                p->answered = false;
+                memcpy (&p->sent_time, (char *) packet + sizeof (struct icmp_echo_hdr), sizeof (int64_t)); // the time stamp __ping_send__ has put into the echo request, routers don't quote it
+                __inFlightCount__++;
+            }
+            probe++;
+            continue;
+        }
+
+        // pick up all the answers that are waiting
+        __receive__ (sockfd);
+
+        // forget the echo requests that have been answered, have timed out or went behind the end of the route
+        unsigned long waitMicros = 1000000; // the deadlines are checked again by then anyway
+        while (__inFlightCount__) {
+            __inFlight_t__ *p = &__inFlight__ [__inFlightHead__];
+            unsigned long waitingMicros = ThreadSafePing_t::__nowMicros__ () - p->sent_time;
+            if (!p->answered && p->probe % __maxHops__ + 1 <= __lastHop__ && waitingMicros < options.timeoutMicros) {
+                if (waitMicros > options.timeoutMicros - waitingMicros) waitMicros = options.timeoutMicros - waitingMicros;
+                break;
+            }
+            if (!p->answered && p->probe % __maxHops__ + 1 <= __lastHop__)
+                __probe__.__lost__++;
+            __inFlightHead__ = (__inFlightHead__ + 1) % PING_TRACEROUTE_MAX_WINDOW;
+            __inFlightCount__--;
+        }
+
+        if (!moreToSend && !__inFlightCount__)
+            break; // finished
+
+        // report waiting each onWaitMicros
+        if (options.onWaitMicros) {
+            if (micros () - lastWaitMicros >= options.onWaitMicros) {
+                lastWaitMicros = micros ();
+                onWait ();
+            }
+            unsigned long sinceMicros = micros () - lastWaitMicros;
+            unsigned long untilWaitMicros = sinceMicros < options.onWaitMicros ? options.onWaitMicros - sinceMicros : 0;
+            if (waitMicros > untilWaitMicros) waitMicros = untilWaitMicros;
+        }
+
+        // sleep until an answer arrives, the oldest echo request times out or the next echo request is due
+        if (moreToSend && __inFlightCount__ < options.window) {
+            long untilSendMicros = (long) (dueMicros - micros ());
+            if (untilSendMicros < 0) untilSendMicros = 0;
+            if (waitMicros > (unsigned long) untilSendMicros) waitMicros = untilSendMicros;
+        }
+        ThreadSafePing_t::__waitForPacket__ (sockfd, -1, waitMicros);
+    }
+
+    ThreadSafePing_t::__setTtl__ (sockfd, isIPv6, previousTtl);
+    ThreadSafePing_t::__releaseSocket__ (sockfd, isIPv6);
+    return __errText__; // NULL if OK
+}
+
+// reads all the packets waiting on the socket and counts the answers to our echo requests
+void ThreadSafePingTraceroute_t::__receive__ (int sockfd) {
+    char buf [60 + 8 + 60 + sizeof (struct icmp_echo_hdr) + PING_STACK_MAX_SIZE]; // the longest IPv4 header, the ICMP header and the quoted IPv4 header, longer packets get truncated, but their length is still known
+    ThreadSafePing_t::__drainSocket__ (sockfd, __probe__.__isIPv6__, buf, sizeof (buf), sockfd, 1, &__probe__.__counters__,
+                                       [] (void *context, const ThreadSafePing_t::__packet_t__ *packet) {
+                                           return ((ThreadSafePingTraceroute_t *) context)->__match__ (packet);
+                                       }, this);
+}
+
+// counts an echo reply or an ICMP error that answers one of our echo requests
+bool ThreadSafePingTraceroute_t::__match__ (const ThreadSafePing_t::__packet_t__ *packet) {
+    uint16_t seqno = packet->seqno;
+    int type = __TRACE_REPLY__;
+    if (!packet->isEcho) {
+        uint16_t id;
+        if (!__parseIcmpError__ (packet->isIPv6, packet->buf, packet->size, &id, &seqno, &type) || id != packet->sockfd)
+            return false;
+    }
+
+    char address [PING_ADDRSTRLEN];
+    #if PING_IPV6
+        if (packet->isIPv6)
+            inet_ntop (AF_INET6, &((const struct sockaddr_in6 *) packet->from)->sin6_addr, address, sizeof (address));
+        else
+    #endif
+    inet_ntop (AF_INET, &((const struct sockaddr_in *) packet->from)->sin_addr, address, sizeof (address));
+    __countReply__ (seqno, address, packet->receivedMicros, type);
+    return true;
+}
+
+// updates the statistics of the hop the answered echo request was sent to
+void ThreadSafePingTraceroute_t::__countReply__ (uint16_t seqno, const char *address, int64_t receivedMicros, int type) {
+    // find the echo request in flight
+    uint16_t probe = seqno - __seqnoBase__;
+    __inFlight_t__ *p = NULL;
+    if (probe < __maxHops__ * __probes__)
+        for (int i = 0; i < __inFlightCount__; i++) {
+            __inFlight_t__ *q = &__inFlight__ [(__inFlightHead__ + i) % PING_TRACEROUTE_MAX_WINDOW];
+            if (q->probe == probe) {
+                if (!q->answered)
+                    p = q;
+                break;
+            }
+        }
+    if (!p) {
+        ThreadSafePing_t::__count__ (&__probe__.__counters__, &ThreadSafePingCounters_t::stale);
+        return; // a duplicate, a late answer or an answer to an earlier trace
+    }
+    p->answered = true;
+
+    int hop = probe % __maxHops__ + 1;
+    if (hop > __lastHop__)
+        return; // behind the end of the route, the target has already answered to an echo request with lower TTL
+
+    // the echo request has got to the target or to a router that can't forward it, so the route ends here
+    if (type != __TRACE_TIME_EXCEEDED__) {
+        __lastHop__ = hop;
+        __reached__ = type == __TRACE_REPLY__;
+    }
+
+    __hop_t__ *h = &__hops__ [hop - 1];
+    if (!*h->address)
+        strcpy (h->address, address);
+    if (type == __TRACE_UNREACHABLE__)
+        h->unreachable = true;
+
+    float elapsedTime = (receivedMicros - p->sent_time) / 1000.0f;
+    h->received++;
+    if (h->received == 1 || elapsedTime < h->min_time) h->min_time = elapsedTime;
+    if (elapsedTime > h->max_time) h->max_time = elapsedTime;
+    h->mean_time += (elapsedTime - h->mean_time) / h->received;
+    __probe__.__received__++;
+
+    // report intermediate results
+    onReceive (hop, address, elapsedTime);
+}
@@ -0,0 +1,114 @@
+/*
+    ThreadSafePingTraceroute.h
+
+    This file is part of the ThreadSafe ESP32 Ping class: https://github.com/BojanJurca/Thread-safe-ping-Arduino-library-for-ESP32
+
+    Finds the routers on the way to the target by sending echo requests with increasing TTL (hop limit) through a single raw socket.
+    The echo requests for different hops are in flight at the same time, so the whole route is traced in about one time-out instead of
+    one time-out per hop. Time exceeded messages of the routers are matched back to the echo requests by the echo header they quote.
+
+*/
+
+
+#ifndef __ThreadSafePingTraceroute_H__
+    #define __ThreadSafePingTraceroute_H__
+
+
+    #include "ThreadSafePing.h"
+
+
+    #ifndef PING_TRACEROUTE_MAX_HOPS
+        #define PING_TRACEROUTE_MAX_HOPS        32
+    #endif
+    #ifndef PING_TRACEROUTE_MAX_WINDOW
+        #define PING_TRACEROUTE_MAX_WINDOW      32
+    #endif
+    #ifndef PING_TRACEROUTE_DEFAULT_WINDOW
+        #define PING_TRACEROUTE_DEFAULT_WINDOW  16
+    #endif
+    #ifndef PING_TRACEROUTE_DEFAULT_RATE
+        #define PING_TRACEROUTE_DEFAULT_RATE    100     // echo requests per second, routers usually limit the rate of their time exceeded messages
+    #endif
+
+
+    struct ThreadSafePingTracerouteOptions_t {
+        int maxHops = 30;                                                   // 1 - PING_TRACEROUTE_MAX_HOPS
+        int probes = 3;                                                     // 1 - 10 echo requests per hop
+        int window = PING_TRACEROUTE_DEFAULT_WINDOW;                        // 1 - PING_TRACEROUTE_MAX_WINDOW echo requests in flight at the same time
+        int rate = PING_TRACEROUTE_DEFAULT_RATE;                            // 1 - 10000 echo requests per second
+        unsigned long timeoutMicros = 1000000UL * PING_DEFAULT_TIMEOUT;    // 1 ms - 30 s
+        int size = PING_DEFAULT_SIZE;                                       // 4 - PING_STACK_MAX_SIZE bytes of payload, 4 - 7 are sent padded to the 8-byte time stamp
+        unsigned long onWaitMicros = PING_DEFAULT_ON_WAIT;                  // 1 ms - 3600 s between onWait () calls, 0 = never
+    };
+
+
+    class ThreadSafePingTraceroute_t {
+
+        private:
+            ThreadSafePingStatistics_t __probe__;       // resolves the target and sends the echo requests
+
+            struct __hop_t__ {
+                char address [PING_ADDRSTRLEN];          // of the first router (or the target) that answered, "" if none did
+                uint8_t sent;
+                uint8_t received;
+                bool unreachable;                       // the router answered with destination unreachable
+                float min_time;
+                float mean_time;
+                float max_time;
+            };
+            __hop_t__ __hops__ [PING_TRACEROUTE_MAX_HOPS];
+            int __maxHops__ = 0;
+            int __probes__ = 0;
+            int __lastHop__ = 0;                        // the hop where the route ends: the target or an unreachable destination, __maxHops__ if unknown
+            bool __reached__ = false;
+
+            // echo request p is sent to hop p % maxHops + 1 with sequence number __seqnoBase__ + p, so all the hops get their first echo request before any of them gets its second
+            uint16_t __seqnoBase__;
+
+            struct __inFlight_t__ {
+                uint16_t probe;
+                bool answered;
+                int64_t sent_time;
+            };
+            __inFlight_t__ __inFlight__ [PING_TRACEROUTE_MAX_WINDOW];  // ring of the echo requests in flight, in the order they were sent
+            int __inFlightHead__;
+            int __inFlightCount__;
+
+            const char *__errText__ = nullptr;
+            bool __stopped__;
+
+            const char *__trace__ (const ThreadSafePingTracerouteOptions_t& options);
+            void __receive__ (int sockfd);
+            bool __match__ (const ThreadSafePing_t::__packet_t__ *packet);
+            void __countReply__ (uint16_t seqno, const char *address, int64_t receivedMicros, int type);
+
+        public:
+            ThreadSafePingTraceroute_t () {}
+
+            // traces the route to the target, returns error text or NULL if OK
+            const char *trace (const char *target, const ThreadSafePingTracerouteOptions_t& options = ThreadSafePingTracerouteOptions_t ());
+            const char *trace (const IPAddress& target, const ThreadSafePingTracerouteOptions_t& options = ThreadSafePingTracerouteOptions_t ());
+
+            inline void stop () { __stopped__ = true; }
+
+            inline char *target () { return __probe__.target (); }
+            inline bool reached () { return __reached__; }      // the target has answered
+            inline int hops () { return __lastHop__; }          // the number of hops up to (and including) the target, hops are numbered from 1 on
+
+            inline const char *address (int hop) { return __hops__ [hop - 1].address; }
+            inline int sent (int hop) { return __hops__ [hop - 1].sent; }
+            inline int received (int hop) { return __hops__ [hop - 1].received; }
+            inline int lost (int hop) { return __hops__ [hop - 1].sent - __hops__ [hop - 1].received; }
+            inline bool unreachable (int hop) { return __hops__ [hop - 1].unreachable; }
+            inline float min_time (int hop) { return __hops__ [hop - 1].received ? __hops__ [hop - 1].min_time : 0; } // in ms
+            inline float mean_time (int hop) { return __hops__ [hop - 1].mean_time; }
+            inline float max_time (int hop) { return __hops__ [hop - 1].max_time; }
+
+            inline const ThreadSafePingCounters_t& counters () { return __probe__.counters (); }
+            inline const char *errText () { return __errText__; }
+
+            virtual void onReceive (int hop, const char *address, float elapsedTime) {}  // called for each answered echo request
+            virtual void onWait () {}
+    };
+
+#endif